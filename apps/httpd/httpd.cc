@@ -56,10 +56,21 @@ class http_server {
     uint64_t _requests_served = 0;
     sstring _date = http_date();
     timer<> _date_format_timer{[this] { _date = http_date(); }};
+    // served instead of the built-in page, if set
+    std::experimental::optional<file> _file;
+    size_t _file_size = 0;
 public:
     http_server() {
         _date_format_timer.arm_periodic(1s);
     }
+    future<> serve_file(sstring name) {
+        return engine().open_file_dma(name).then([this] (file f) {
+            _file = std::move(f);
+            return _file->size();
+        }).then([this] (size_t size) {
+            _file_size = size;
+        });
+    }
     future<> listen(ipv4_addr addr) {
         listen_options lo;
         lo.reuse_address = true;
@@ -110,6 +121,9 @@ public:
         connection(http_server& server, connected_socket&& fd, socket_address addr)
             : _server(server), _fd(std::move(fd)), _read_buf(_fd.input())
             , _write_buf(_fd.output()) {
+            // responses to pipelined requests are sent together, unless the
+            // headers must go out before transmit_file() sends the body
+            _write_buf.set_batch_flushes(!_server._file);
             ++_server._total_connections;
             ++_server._current_connections;
         }
@@ -118,9 +132,16 @@ public:
         }
         future<> process() {
             // Launch read and write "threads" simultaneously:
-            return when_all(read(), respond()).then([] (std::tuple<future<>, future<>> joined) {
+            return when_all(read(), respond()).then([this] (std::tuple<future<>, future<>> joined) {
                 // FIXME: notify any exceptions in joined?
-                return make_ready_future<>();
+                // wait for the batched flush before the connection goes away
+                return _write_buf.close().then_wrapped([] (future<> f) {
+                    try {
+                        f.get();
+                    } catch (...) {
+                        // swallow error
+                    }
+                });
             });
         }
         future<> read() {
@@ -162,7 +183,7 @@ public:
         future<> start_response() {
             _resp->_headers["Server"] = "Seastar httpd";
             _resp->_headers["Date"] = _server._date;
-            _resp->_headers["Content-Length"] = to_sstring(_resp->_body.size());
+            _resp->_headers["Content-Length"] = to_sstring(_server._file ? _server._file_size : _resp->_body.size());
             return _write_buf.write(_resp->_response_line.begin(), _resp->_response_line.size()).then(
                     [this] {
                 return write_response_headers(_resp->_headers.begin());
@@ -226,6 +247,9 @@ public:
             return should_close;
         }
         future<> write_body() {
+            if (_server._file) {
+                return _fd.transmit_file(_write_buf, *_server._file, 0, _server._file_size);
+            }
             return _write_buf.write(_resp->_body.begin(), _resp->_body.size());
         }
     };
@@ -273,12 +297,22 @@ namespace bpo = boost::program_options;
 int main(int ac, char** av) {
     app_template app;
     app.add_options()
-        ("port", bpo::value<uint16_t>()->default_value(10000), "HTTP Server port") ;
+        ("port", bpo::value<uint16_t>()->default_value(10000), "HTTP Server port")
+        ("file", bpo::value<std::string>(), "serve the contents of this file instead of the built-in page") ;
     return app.run(ac, av, [&] {
         auto&& config = app.configuration();
         uint16_t port = config["port"].as<uint16_t>();
+        sstring file_name;
+        if (config.count("file")) {
+            file_name = config["file"].as<std::string>();
+        }
         auto server = new distributed<http_server>;
-        server->start().then([server = std::move(server), port] () mutable {
+        server->start().then([server, file_name] {
+            if (file_name.empty()) {
+                return make_ready_future<>();
+            }
+            return server->invoke_on_all(&http_server::serve_file, file_name);
+        }).then([server, port] () mutable {
             server->invoke_on_all(&http_server::listen, ipv4_addr{port});
         }).then([port] {
             std::cout << "Seastar HTTP server listening on port " << port << " ...\n";
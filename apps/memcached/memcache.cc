@@ -26,12 +26,15 @@
 #include <boost/optional.hpp>
 #include <iomanip>
 #include <sstream>
+#include <experimental/string_view>
 #include "core/app-template.hh"
 #include "core/future-util.hh"
 #include "core/timer-set.hh"
 #include "core/shared_ptr.hh"
 #include "core/stream.hh"
 #include "core/memory.hh"
+#include "core/lsa.hh"
+#include "core/object_pool.hh"
 #include "core/units.hh"
 #include "core/distributed.hh"
 #include "core/vector-data-sink.hh"
@@ -229,6 +232,12 @@ public:
     }
 };
 
+template <bool WithFlashCache>
+class item_migrator final : public lsa::migrator {
+public:
+    virtual bool migrate(void* src, void* dst, size_t size) noexcept override;
+};
+
 template <bool WithFlashCache>
 class item : public std::conditional<WithFlashCache, flashcache_item_base, memcache_item_base>::type {
 public:
@@ -236,37 +245,72 @@ public:
     using version_type = uint64_t;
     using time_point = clock_type::time_point;
     using duration = clock_type::duration;
+    using string_view = std::experimental::string_view;
 private:
     using hook_type = bi::unordered_set_member_hook<>;
     // TODO: align shared data to cache line boundary
-    item_key _key;
-    sstring _data;
-    const sstring _ascii_prefix;
+    //
+    // Key, ascii prefix and (while in memory) value live back to back in a
+    // blob allocated from the cache's lsa region.  The blob starts with a
+    // pointer back to the item, so that compaction can move it.
+    char* _blob;
+    size_t _key_hash;
+    uint32_t _key_size;
+    uint32_t _ascii_prefix_size;
+    uint32_t _value_size;
     version_type _version;
     int _ref_count;
     hook_type _cache_link;
     bi::list_member_hook<> _lru_link;
     bi::list_member_hook<> _timer_link;
     time_point _expiry;
+    static item_migrator<WithFlashCache> _migrator;
+    static constexpr size_t blob_header_size = sizeof(item_type*);
     template <bool>
     friend class cache;
+    template <bool>
+    friend class item_migrator;
     friend class memcache_cache_base;
     friend class flashcache_cache_base;
+private:
+    size_t blob_size(size_t value_size) const {
+        return blob_header_size + _key_size + _ascii_prefix_size + value_size;
+    }
+    void allocate_blob(lsa::region& region, size_t value_size) {
+        _blob = static_cast<char*>(region.allocate(blob_size(value_size), _migrator));
+        *reinterpret_cast<item_type**>(_blob) = this;
+    }
+    char* key_begin() const {
+        return _blob + blob_header_size;
+    }
+    char* ascii_prefix_begin() const {
+        return key_begin() + _key_size;
+    }
 public:
-    item(item_key&& key, sstring&& ascii_prefix, sstring&& data, clock_type::time_point expiry, version_type version = 1)
+    item(lsa::region& region, const item_key& key, const sstring& ascii_prefix, const sstring& data,
+            clock_type::time_point expiry, version_type version = 1)
         : std::conditional<WithFlashCache, flashcache_item_base, memcache_item_base>::type(data.size())
-        , _key(std::move(key))
-        , _data(std::move(data))
-        , _ascii_prefix(std::move(ascii_prefix))
+        , _key_hash(key.hash())
+        , _key_size(key.key().size())
+        , _ascii_prefix_size(ascii_prefix.size())
+        , _value_size(data.size())
         , _version(version)
         , _ref_count(0)
         , _expiry(expiry)
     {
+        allocate_blob(region, _value_size);
+        std::copy(key.key().begin(), key.key().end(), key_begin());
+        std::copy(ascii_prefix.begin(), ascii_prefix.end(), ascii_prefix_begin());
+        std::copy(data.begin(), data.end(), data_begin());
     }
 
     item(const item&) = delete;
     item(item&&) = delete;
 
+    ~item() {
+        lsa::region::free(_blob);
+    }
+
     clock_type::time_point get_timeout() {
         return _expiry;
     }
@@ -275,26 +319,52 @@ public:
         return _version;
     }
 
-    sstring& data() {
-        return _data;
+    string_view data() const {
+        return string_view(data_begin(), _value_size);
+    }
+
+    char* data_begin() const {
+        return ascii_prefix_begin() + _ascii_prefix_size;
+    }
+
+    // Drops the value from memory, keeping key and ascii prefix.
+    void drop_data() {
+        lsa::region::shrink(_blob, blob_size(0));
+        _value_size = 0;
     }
 
-    const sstring& ascii_prefix() {
-        return _ascii_prefix;
+    // Makes room in memory for a value of @size bytes, to be filled in
+    // through data_begin().
+    void reserve_data(size_t size) {
+        auto old_blob = _blob;
+        // Items only change while in the cache, whose region outlives them
+        auto region = lsa::region::of(old_blob);
+        assert(region);
+        allocate_blob(*region, size);
+        std::copy_n(old_blob + blob_header_size, _key_size + _ascii_prefix_size, key_begin());
+        lsa::region::free(old_blob);
+        _value_size = size;
     }
 
-    const sstring& key() {
-        return _key.key();
+    string_view ascii_prefix() const {
+        return string_view(ascii_prefix_begin(), _ascii_prefix_size);
+    }
+
+    string_view key() const {
+        return string_view(key_begin(), _key_size);
+    }
+
+    bool has_key(const item_key& key) const {
+        return key.hash() == _key_hash && string_view(key.key().begin(), key.key().size()) == this->key();
     }
 
     optional<uint64_t> data_as_integral() {
-        auto str = _data.c_str();
-        if (str[0] == '-') {
+        auto str = data_begin();
+        auto len = _value_size;
+        if (!len || str[0] == '-') {
             return {};
         }
 
-        auto len = _data.size();
-
         // Strip trailing space
         while (len && str[len - 1] == ' ') {
             len--;
@@ -314,11 +384,11 @@ public:
     }
 
     friend bool operator==(const item_type &a, const item_type &b) {
-         return a._key == b._key;
+         return a._key_hash == b._key_hash && a.key() == b.key();
     }
 
     friend std::size_t hash_value(const item_type &i) {
-        return std::hash<item_key>()(i._key);
+        return i._key_hash;
     }
 
     friend inline void intrusive_ptr_add_ref(item_type* it) {
@@ -327,23 +397,37 @@ public:
 
     friend inline void intrusive_ptr_release(item_type* it) {
         if (--it->_ref_count == 0) {
-            delete it;
+            object_pool<item_type>::local().destroy(it);
         }
     }
-
-    template <bool>
-    friend class item_key_cmp;
 };
 
+template <bool WithFlashCache>
+item_migrator<WithFlashCache> item<WithFlashCache>::_migrator;
+
+// Items referenced from outside the cache (e.g. by a response that is still
+// being sent, or by a flashcache load or store) may have their data in use,
+// so they are pinned.
+template <bool WithFlashCache>
+bool item_migrator<WithFlashCache>::migrate(void* src, void* dst, size_t size) noexcept {
+    auto it = *reinterpret_cast<item<WithFlashCache>**>(src);
+    if (it->_ref_count > 1 || !it->_cache_link.is_linked()) {
+        return false;
+    }
+    std::memcpy(dst, src, size);
+    it->_blob = static_cast<char*>(dst);
+    return true;
+}
+
 template <bool WithFlashCache>
 struct item_key_cmp
 {
     bool operator()(const item_key& key, const item<WithFlashCache>& it) const {
-        return key == it._key;
+        return it.has_key(key);
     }
 
     bool operator()(const item<WithFlashCache>& it, const item_key& key) const {
-        return key == it._key;
+        return it.has_key(key);
     }
 };
 
@@ -370,6 +454,9 @@ struct cache_stats {
     size_t _resize_failure {};
     size_t _size {};
     size_t _reclaims{};
+    size_t _compacted_segments{};
+    size_t _region_bytes{};
+    size_t _region_live_bytes{};
     // flashcache-only stats.
     size_t _loads{};
     size_t _stores{};
@@ -394,6 +481,9 @@ struct cache_stats {
         _resize_failure += o._resize_failure;
         _size += o._size;
         _reclaims += o._reclaims;
+        _compacted_segments += o._compacted_segments;
+        _region_bytes += o._region_bytes;
+        _region_live_bytes += o._region_live_bytes;
         _loads += o._loads;
         _stores += o._stores;
     }
@@ -530,7 +620,7 @@ public:
 
                 assert(victim.data().size() == item_data_size);
                 _mem_disk_lru.erase(_mem_disk_lru.iterator_to(victim));
-                victim.data().reset();
+                victim.drop_data();
                 assert(victim.data().size() == 0);
                 victim.set_state(item_state::DISK);
                 _disk_lru.push_front(victim);
@@ -612,15 +702,14 @@ future<> flashcache_cache_base::load_item_data(boost::intrusive_ptr<item_type> i
 
         flashcache::subdevice& subdev = this->get_subdevice();
         auto sem = make_lw_shared<semaphore>({ 0 });
-        auto& item_data = item->data();
         auto item_size = item->size();
         auto blocks_to_load = item->used_blocks_size();
-        assert(item_data.empty());
+        assert(item->data().empty());
         assert(item_size >= 1);
         assert(blocks_to_load == (item_size + (flashcache::block_size - 1)) / flashcache::block_size);
 
         auto to_read = item_size;
-        item_data = sstring(sstring::initialized_later(), item_size);
+        item->reserve_data(item_size);
         for (auto i = 0U; i < blocks_to_load; ++i) {
             auto read_size = std::min(to_read, flashcache::block_size);
 
@@ -637,7 +726,7 @@ future<> flashcache_cache_base::load_item_data(boost::intrusive_ptr<item_type> i
                 return subdev.read(blk, rb).then(
                         [item, read_size, rbuf = std::move(rbuf), i] (size_t ret) mutable {
                     assert(ret == flashcache::block_size);
-                    char *data = item->data().begin();
+                    char *data = item->data_begin();
                     assert(data != nullptr);
                     assert((i * flashcache::block_size + read_size) <= item->data().size()); // overflow check
                     memcpy(data + (i * flashcache::block_size), rbuf.get(), read_size);
@@ -650,8 +739,7 @@ future<> flashcache_cache_base::load_item_data(boost::intrusive_ptr<item_type> i
         }
 
         return sem->wait(blocks_to_load).then([this, item] () mutable {
-            auto& item_data = item->data();
-            auto item_data_size = item_data.size();
+            auto item_data_size = item->data().size();
             assert(item_data_size == item->size());
 
             if (item->get_state() != item_state::ERASED) {
@@ -678,10 +766,9 @@ future<> flashcache_cache_base::store_item_data(boost::intrusive_ptr<item_type>
 
     flashcache::subdevice& subdev = this->get_subdevice();
     auto sem = make_lw_shared<semaphore>({ 0 });
-    auto& item_data = item->data();
     auto item_size = item->size();
     auto blocks_to_store = (item_size + (flashcache::block_size - 1)) / flashcache::block_size;
-    assert(item_data.size() == item_size);
+    assert(item->data().size() == item_size);
     assert(item->used_blocks_empty());
     assert(blocks_to_store >= 1);
 
@@ -695,7 +782,7 @@ future<> flashcache_cache_base::store_item_data(boost::intrusive_ptr<item_type>
                 return make_ready_future<>();
             }
             auto wbuf = allocate_aligned_buffer<unsigned char>(flashcache::block_size, flashcache::block_size);
-            const char *data = item->data().c_str();
+            const char *data = item->data().data();
             assert(data != nullptr);
             assert((i * flashcache::block_size + write_size) <= item->data().size()); // overflow check
             memcpy(wbuf.get(), data + (i * flashcache::block_size), write_size);
@@ -716,8 +803,7 @@ future<> flashcache_cache_base::store_item_data(boost::intrusive_ptr<item_type>
     return sem->wait(blocks_to_store).then([this, item] () mutable {
         // NOTE: Item was removed previously from mem lru so as to avoid races, i.e.
         // upon another set, the same item would be popped from the back of the lru.
-        auto& item_data = item->data();
-        auto item_data_size = item_data.size();
+        auto item_data_size = item->data().size();
         assert(item_data_size == item->size());
 
         if (item->get_state() != item_state::ERASED) {
@@ -743,6 +829,8 @@ private:
     static constexpr size_t initial_bucket_count = 1 << 10;
     static constexpr float load_factor = 0.75f;
     size_t _resize_up_threshold = load_factor * initial_bucket_count;
+    // Declared before the items' containers so that it outlives the items destroyed with the cache.
+    lsa::region _region;
     cache_bucket* _buckets;
     cache_type _cache;
     timer_set<item_type, &item_type::_timer_link> _alive;
@@ -751,7 +839,7 @@ private:
     memory::reclaimer _reclaimer;
 private:
     size_t item_footprint(item_type& item_ref) {
-        return sizeof(item_type) + item_ref._data.size() + item_ref._ascii_prefix.size() + item_ref.key().size();
+        return sizeof(item_type) + item_ref.data().size() + item_ref.ascii_prefix().size() + item_ref.key().size();
     }
 
     template <bool IsInCache = true, bool IsInTimerList = true>
@@ -783,13 +871,12 @@ private:
         return _cache.find(key, std::hash<item_key>(), item_key_cmp<WithFlashCache>());
     }
 
-    template <typename Origin>
     inline
     cache_iterator add_overriding(cache_iterator i, item_insertion_data& insertion) {
         auto& old_item = *i;
 
-        auto new_item = new item_type(Origin::move_if_local(insertion.key), Origin::move_if_local(insertion.ascii_prefix),
-            Origin::move_if_local(insertion.data), insertion.expiry, old_item._version + 1);
+        auto new_item = object_pool<item_type>::local().construct(_region, insertion.key, insertion.ascii_prefix,
+            insertion.data, insertion.expiry, old_item._version + 1);
         intrusive_ptr_add_ref(new_item);
 
         erase(old_item);
@@ -805,11 +892,10 @@ private:
         return insert_result.first;
     }
 
-    template <typename Origin>
     inline
     void add_new(item_insertion_data& insertion) {
-        auto new_item = new item_type(Origin::move_if_local(insertion.key), Origin::move_if_local(insertion.ascii_prefix),
-            Origin::move_if_local(insertion.data), insertion.expiry);
+        auto new_item = object_pool<item_type>::local().construct(_region, insertion.key, insertion.ascii_prefix,
+            insertion.data, insertion.expiry);
         intrusive_ptr_add_ref(new_item);
         auto& item_ref = *new_item;
         _cache.insert(item_ref);
@@ -848,17 +934,32 @@ private:
     }
 
     void reclaim(size_t target) {
-        size_t reclaimed_so_far = 0;
         this->_stats._reclaims++;
 
+        // Compaction gives memory back without losing any data, so try it
+        // first.  Data dropped below only leaves dead space in the region,
+        // which is given back by compacting again.
+        auto compacted = _region.compact(target);
+        if (compacted >= target) {
+            return;
+        }
+        target -= compacted;
+        auto reclaimed_so_far = drop_data(target);
+        _region.compact(reclaimed_so_far);
+    }
+
+    // Drops at least @target bytes worth of item data, if possible.
+    size_t drop_data(size_t target) {
+        size_t reclaimed_so_far = 0;
+
         reclaimed_so_far += this->do_reclaim(target);
         if (reclaimed_so_far >= target) {
-            return;
+            return reclaimed_so_far;
         }
 
         auto i = this->_lru.end();
         if (i == this->_lru.begin()) {
-            return;
+            return reclaimed_so_far;
         }
 
         --i;
@@ -885,6 +986,7 @@ private:
                 }
             }
         } while (!done);
+        return reclaimed_so_far;
     }
 public:
     cache()
@@ -920,11 +1022,11 @@ public:
     bool set(item_insertion_data& insertion) {
         auto i = find(insertion.key);
         if (i != _cache.end()) {
-            add_overriding<Origin>(i, insertion);
+            add_overriding(i, insertion);
             this->_stats._set_replaces++;
             return true;
         } else {
-            add_new<Origin>(insertion);
+            add_new(insertion);
             this->_stats._set_adds++;
             return false;
         }
@@ -942,7 +1044,7 @@ public:
         }
 
         this->_stats._set_adds++;
-        add_new<Origin>(insertion);
+        add_new(insertion);
         return true;
     }
 
@@ -958,7 +1060,7 @@ public:
         }
 
         this->_stats._set_replaces++;
-        add_overriding<Origin>(i, insertion);
+        add_overriding(i, insertion);
         return true;
     }
 
@@ -1005,7 +1107,7 @@ public:
             return cas_result::bad_version;
         }
         this->_stats._cas_hits++;
-        add_overriding<Origin>(i, insertion);
+        add_overriding(i, insertion);
         return cas_result::stored;
     }
 
@@ -1023,6 +1125,10 @@ public:
 
     cache_stats stats() {
         this->_stats._size = size();
+        auto& region_stats = _region.stats();
+        this->_stats._compacted_segments = region_stats.compacted_segments;
+        this->_stats._region_bytes = region_stats.total_bytes();
+        this->_stats._region_live_bytes = region_stats.live_bytes + region_stats.large_bytes;
         return this->_stats;
     }
 
@@ -1041,11 +1147,11 @@ public:
         }
         item_insertion_data insertion {
             .key = Origin::move_if_local(key),
-            .ascii_prefix = item_ref._ascii_prefix,
+            .ascii_prefix = sstring(item_ref.ascii_prefix().data(), item_ref.ascii_prefix().size()),
             .data = to_sstring(*value + delta),
             .expiry = item_ref._expiry
         };
-        i = add_overriding<local_origin_tag>(i, insertion);
+        i = add_overriding(i, insertion);
         return {boost::intrusive_ptr<item_type>(&*i), true};
     }
 
@@ -1068,11 +1174,11 @@ public:
         }
         item_insertion_data insertion {
             .key = Origin::move_if_local(key),
-            .ascii_prefix = item_ref._ascii_prefix,
+            .ascii_prefix = sstring(item_ref.ascii_prefix().data(), item_ref.ascii_prefix().size()),
             .data = to_sstring(*value - std::min(*value, delta)),
             .expiry = item_ref._expiry
         };
-        i = add_overriding<local_origin_tag>(i, insertion);
+        i = add_overriding(i, insertion);
         return {boost::intrusive_ptr<item_type>(&*i), true};
     }
 
@@ -1263,7 +1369,6 @@ private:
     memcache_ascii_parser _parser;
     item_key _item_key;
     item_insertion_data _insertion;
-    std::vector<item_ptr<WithFlashCache>> _items;
 private:
     static constexpr uint32_t seconds_in_a_month = 60 * 60 * 24 * 30;
     static constexpr const char *msg_crlf = "\r\n";
@@ -1287,8 +1392,10 @@ private:
         }
 
         msg.append_static("VALUE ");
-        msg.append_static(item->key());
-        msg.append_static(item->ascii_prefix());
+        auto key = item->key();
+        auto ascii_prefix = item->ascii_prefix();
+        msg.append_static(key.data(), key.size());
+        msg.append_static(ascii_prefix.data(), ascii_prefix.size());
 
         if (WithVersion) {
              msg.append_static(" ");
@@ -1296,7 +1403,8 @@ private:
         }
 
         msg.append_static(msg_crlf);
-        msg.append_static(item->data());
+        auto data = item->data();
+        msg.append_static(data.data(), data.size());
         msg.append_static(msg_crlf);
         msg.on_delete([item = std::move(item)] {});
     }
@@ -1312,15 +1420,15 @@ private:
                 return out.write(std::move(msg));
             });
         } else {
-            _items.clear();
-            return parallel_for_each(_parser._keys.begin(), _parser._keys.end(), [this] (const auto& key) {
-                return _cache.get(key).then([this] (auto item) {
-                    _items.emplace_back(std::move(item));
-                });
-            }).then([this, &out] () {
+            std::vector<future<item_ptr<WithFlashCache>>> lookups;
+            lookups.reserve(_parser._keys.size());
+            for (auto& key : _parser._keys) {
+                lookups.push_back(_cache.get(key));
+            }
+            return when_all(lookups.begin(), lookups.end()).then([&out] (auto items) {
                 scattered_message<char> msg;
-                for (auto& item : _items) {
-                    append_item<WithVersion>(msg, std::move(item));
+                for (auto& item : items) {
+                    this_type::append_item<WithVersion>(msg, std::get<0>(item.get()));
                 }
                 msg.append_static(msg_end);
                 return out.write(std::move(msg));
@@ -1409,6 +1517,12 @@ private:
                             return this->print_stat(out, "seastar.expired", v);
                         }).then([this, &out, v = all_cache_stats._resize_failure] {
                             return this->print_stat(out, "seastar.resize_failure", v);
+                        }).then([this, &out, v = all_cache_stats._compacted_segments] {
+                            return this->print_stat(out, "seastar.compacted_segments", v);
+                        }).then([this, &out, v = all_cache_stats._region_bytes] {
+                            return this->print_stat(out, "seastar.region_bytes", v);
+                        }).then([this, &out, v = all_cache_stats._region_live_bytes] {
+                            return this->print_stat(out, "seastar.region_live_bytes", v);
                         }).then([this, &out, v = all_cache_stats._evicted] {
                             return this->print_stat(out, "evictions", v);
                         }).then([this, &out, v = all_cache_stats._bytes] {
@@ -1578,7 +1692,8 @@ public:
                         if (!incremented) {
                             return out.write(msg_error_non_numeric_value);
                         }
-                        return out.write(item->data()).then([&out] {
+                        auto data = item->data();
+                        return out.write(data.data(), data.size()).then([&out] {
                             return out.write(msg_crlf);
                         });
                     });
@@ -1599,7 +1714,8 @@ public:
                         if (!decremented) {
                             return out.write(msg_error_non_numeric_value);
                         }
-                        return out.write(item->data()).then([&out] {
+                        auto data = item->data();
+                        return out.write(data.data(), data.size()).then([&out] {
                             return out.write(msg_crlf);
                         });
                     });
@@ -1755,10 +1871,14 @@ public:
         keep_doing([this] {
             return _listener->accept().then([this] (connected_socket fd, socket_address addr) mutable {
                 auto conn = make_lw_shared<connection>(std::move(fd), addr, _cache, _system_stats);
+                // responses to pipelined requests are sent together
+                conn->_out.set_batch_flushes(true);
                 do_until([conn] { return conn->_in.eof(); }, [this, conn] {
                     return conn->_proto.handle(conn->_in, conn->_out).then([conn] {
                         return conn->_out.flush();
                     });
+                }).then_wrapped([conn] (future<> f) {
+                    return conn->_out.close();
                 });
             });
         }).or_terminate();
@@ -20,6 +20,7 @@
  */
 
 #include "core/ragel.hh"
+#include "core/scan.hh"
 #include <memory>
 #include <unordered_map>
 
@@ -58,6 +59,19 @@ action extend_field  {
     _rsp->_headers[_field_name] += sstring(" ") + std::move(_value);
 }
 
+# Skip the rest of a run in one go.  The skipped bytes would only have
+# looped in the current state.  Embed these after >mark, so that mark sees
+# the run's first byte.
+action skip_to_cr_or_lf {
+    fexec scan::find_first_of(p + 1, pe, '\r', '\n');
+}
+
+action skip_to_cr {
+    if (fc != '\r') {
+        fexec scan::find(p + 1, pe, '\r');
+    }
+}
+
 action done {
     done = true;
     fbreak;
@@ -78,8 +92,9 @@ http_version = 'HTTP/' (digit '.' digit) >mark %store_version;
 
 field = tchar+ >mark %store_field_name;
 value = any* >mark %store_value;
-start_line = http_version space digit digit digit space (any - cr - lf)* crlf;
-header_1st = (field sp_ht* ':' value :> crlf) %assign_field;
+line_value = (any* >mark) $skip_to_cr %store_value;
+start_line = http_version space digit digit digit space ((any - cr - lf) $skip_to_cr_or_lf)* crlf;
+header_1st = (field sp_ht* ':' line_value :> crlf) %assign_field;
 header_cont = (sp_ht+ value sp_ht* crlf) %extend_field;
 header = header_1st header_cont*;
 main := start_line header* :> (crlf @done);
@@ -89,18 +89,32 @@ tests = [
     'tests/ip_test',
     'tests/timertest',
     'tests/tcp_test',
+    'tests/tcp_sack_test',
+    'tests/tcp_syn_cookie_test',
+    'tests/tcp_gro_test',
+    'tests/tcp_rto_test',
+    'tests/tcp_receive_window_test',
+    'tests/tcp_time_wait_test',
     'tests/futures_test',
     'tests/smp_test',
     'tests/udp_server',
     'tests/udp_client',
     'tests/blkdiscard_test',
     'tests/sstring_test',
+    'tests/connection_table_test',
+    'tests/gso_test',
     'tests/memcached/test_ascii_parser',
     'tests/tcp_server',
     'tests/tcp_client',
     'tests/allocator_test',
+    'tests/lsa_test',
+    'tests/thread_test',
     'tests/output_stream_test',
     'tests/udp_zero_copy',
+    'tests/posix_zero_copy_test',
+    'tests/sendfile_test',
+    'tests/parser_perf',
+    'tests/tcp_congestion_perf',
     ]
 
 apps = [
@@ -149,11 +163,15 @@ libnet = [
     'net/ip_checksum.cc',
     'net/udp.cc',
     'net/tcp.cc',
+    'net/tcp-congestion.cc',
+    'net/gso.cc',
+    'net/gro.cc',
     'net/dhcp.cc',
     ]
 
 core = [
     'core/reactor.cc',
+    'core/thread.cc',
     'core/fstream.cc',
     'core/posix.cc',
     'core/memory.cc',
@@ -161,6 +179,7 @@ core = [
     'core/scollectd.cc',
     'core/app-template.cc',
     'core/dpdk_rte.cc',
+    'core/scan.cc',
     'util/conversions.cc',
     'net/packet.cc',
     'net/posix-stack.cc',
@@ -215,6 +234,13 @@ deps = {
     'tests/l3_test': ['tests/l3_test.cc'] + core + libnet,
     'tests/ip_test': ['tests/ip_test.cc'] + core + libnet,
     'tests/tcp_test': ['tests/tcp_test.cc'] + core + libnet,
+    'tests/tcp_sack_test': ['tests/tcp_sack_test.cc'] + core + libnet,
+    'tests/tcp_syn_cookie_test': ['tests/tcp_syn_cookie_test.cc'] + core + libnet,
+    'tests/tcp_gro_test': ['tests/tcp_gro_test.cc'] + core + libnet,
+    'tests/tcp_rto_test': ['tests/tcp_rto_test.cc'] + core + libnet,
+    'tests/tcp_receive_window_test': ['tests/tcp_receive_window_test.cc'] + core + libnet,
+    'tests/tcp_time_wait_test': ['tests/tcp_time_wait_test.cc'] + core + libnet,
+    'tests/tcp_congestion_perf': ['tests/tcp_congestion_perf.cc'] + core + libnet,
     'tests/timertest': ['tests/timertest.cc'] + core,
     'tests/futures_test': ['tests/futures_test.cc'] + core,
     'tests/smp_test': ['tests/smp_test.cc'] + core,
@@ -225,9 +251,16 @@ deps = {
     'apps/seawreck/seawreck': ['apps/seawreck/seawreck.cc', 'apps/seawreck/http_response_parser.rl'] + core + libnet,
     'tests/blkdiscard_test': ['tests/blkdiscard_test.cc'] + core,
     'tests/sstring_test': ['tests/sstring_test.cc'] + core,
+    'tests/connection_table_test': ['tests/connection_table_test.cc'] + core,
+    'tests/gso_test': ['tests/gso_test.cc'] + core + libnet,
     'tests/allocator_test': ['tests/allocator_test.cc', 'core/memory.cc', 'core/posix.cc'],
+    'tests/lsa_test': ['tests/lsa_test.cc'] + core,
+    'tests/thread_test': ['tests/thread_test.cc'] + core,
     'tests/output_stream_test': ['tests/output_stream_test.cc'] + core + libnet,
     'tests/udp_zero_copy': ['tests/udp_zero_copy.cc'] + core + libnet,
+    'tests/posix_zero_copy_test': ['tests/posix_zero_copy_test.cc'] + core + libnet,
+    'tests/sendfile_test': ['tests/sendfile_test.cc'] + core + libnet,
+    'tests/parser_perf': ['tests/parser_perf.cc', 'apps/httpd/request_parser.rl'] + core,
 }
 
 warnings = [
@@ -0,0 +1,121 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#ifndef CORE_ABORT_SOURCE_HH_
+#define CORE_ABORT_SOURCE_HH_
+
+#include <boost/intrusive/list.hpp>
+#include <experimental/optional>
+#include <functional>
+#include <exception>
+
+class abort_requested_exception : public std::exception {
+public:
+    virtual const char* what() const noexcept override {
+        return "abort requested";
+    }
+};
+
+// Cancellation token.
+//
+// Operations that accept an abort_source subscribe to it while they wait;
+// request_abort() runs the subscribers, which fail the pending operation
+// with abort_requested_exception and release whatever it was holding.
+// Subscriptions unsubscribe when destroyed, so an operation that completes
+// normally simply drops its subscription.
+//
+// An abort_source, like the operations observing it, is local to one cpu.
+class abort_source {
+    struct construct_tag {};
+public:
+    class subscription : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> {
+        std::function<void ()> _callback;
+    private:
+        void on_abort() {
+            // the callback may destroy this subscription
+            auto callback = std::move(_callback);
+            callback();
+        }
+    public:
+        // Only abort_source can name the tag, so only it can subscribe; the
+        // constructor is public so the subscription can be built in place.
+        subscription(abort_source::construct_tag, abort_source& as, std::function<void ()> callback)
+                : _callback(std::move(callback)) {
+            as._subscriptions.push_back(*this);
+        }
+        subscription(subscription&& x) noexcept
+                : _callback(std::move(x._callback)) {
+            swap_nodes(x);
+        }
+        subscription& operator=(subscription&& x) noexcept {
+            if (this != &x) {
+                this->~subscription();
+                new (this) subscription(std::move(x));
+            }
+            return *this;
+        }
+        friend class abort_source;
+    };
+private:
+    using subscription_list = boost::intrusive::list<subscription, boost::intrusive::constant_time_size<false>>;
+    subscription_list _subscriptions;
+    bool _abort_requested = false;
+public:
+    abort_source() = default;
+    abort_source(const abort_source&) = delete;
+    abort_source& operator=(const abort_source&) = delete;
+    ~abort_source() {
+        _subscriptions.clear();
+    }
+
+    // Registers callback to be called on request_abort().  Returns a
+    // disengaged optional if abort was already requested.
+    std::experimental::optional<subscription> subscribe(std::function<void ()> callback) {
+        if (_abort_requested) {
+            return {};
+        }
+        return std::experimental::optional<subscription>(std::experimental::in_place, construct_tag(), *this, std::move(callback));
+    }
+
+    // Runs and unregisters all subscribers.  Subsequent subscribe() calls
+    // fail.
+    void request_abort() {
+        _abort_requested = true;
+        while (!_subscriptions.empty()) {
+            auto& s = _subscriptions.front();
+            s.unlink();
+            s.on_abort();
+        }
+    }
+
+    bool abort_requested() const {
+        return _abort_requested;
+    }
+
+    // Throws abort_requested_exception if abort was requested.
+    void check() const {
+        if (_abort_requested) {
+            throw abort_requested_exception();
+        }
+    }
+};
+
+#endif /* CORE_ABORT_SOURCE_HH_ */
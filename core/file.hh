@@ -24,6 +24,7 @@
 
 #include "stream.hh"
 #include "sstring.hh"
+#include "abort_source.hh"
 #include <experimental/optional>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -54,6 +55,14 @@ public:
     virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov) = 0;
     virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len) = 0;
     virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov) = 0;
+    // Abortable variants; the default implementations ignore the
+    // abort_source.
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, abort_source& as) {
+        return write_dma(pos, buffer, len);
+    }
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, abort_source& as) {
+        return read_dma(pos, buffer, len);
+    }
     virtual future<> flush(void) = 0;
     virtual future<struct stat> stat(void) = 0;
     virtual future<> discard(uint64_t offset, uint64_t length) = 0;
@@ -77,6 +86,8 @@ public:
     future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov);
     future<size_t> read_dma(uint64_t pos, void* buffer, size_t len);
     future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov);
+    future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, abort_source& as) override;
+    future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, abort_source& as) override;
     future<> flush(void);
     future<struct stat> stat(void);
     future<> discard(uint64_t offset, uint64_t length);
@@ -119,6 +130,13 @@ public:
         return _file_impl->read_dma(pos, std::move(iov));
     }
 
+    // Fails with abort_requested_exception if as is aborted before the
+    // request is submitted to the kernel.
+    template <typename CharType>
+    future<size_t> dma_read(uint64_t pos, CharType* buffer, size_t len, abort_source& as) {
+        return _file_impl->read_dma(pos, buffer, len, as);
+    }
+
     template <typename CharType>
     future<size_t> dma_write(uint64_t pos, const CharType* buffer, size_t len) {
         return _file_impl->write_dma(pos, buffer, len);
@@ -128,6 +146,11 @@ public:
         return _file_impl->write_dma(pos, std::move(iov));
     }
 
+    template <typename CharType>
+    future<size_t> dma_write(uint64_t pos, const CharType* buffer, size_t len, abort_source& as) {
+        return _file_impl->write_dma(pos, buffer, len, as);
+    }
+
     future<> flush() {
         return _file_impl->flush();
     }
@@ -25,26 +25,91 @@
 #include "future.hh"
 #include "shared_ptr.hh"
 #include "reactor.hh"
+#include "abort_source.hh"
 #include <tuple>
+#include <chrono>
+#include <vector>
+#include <iterator>
+
+namespace future_util_impl {
+
+template <typename Iterator>
+inline
+size_t
+distance_hint(Iterator begin, Iterator end, std::forward_iterator_tag) {
+    return std::distance(begin, end);
+}
+
+template <typename Iterator>
+inline
+size_t
+distance_hint(Iterator begin, Iterator end, std::input_iterator_tag) {
+    return 0;
+}
+
+// Number of elements in [begin, end), if it can be known without consuming
+// the range; used to size vectors up front.
+template <typename Iterator>
+inline
+size_t
+distance_hint(Iterator begin, Iterator end) {
+    return distance_hint(begin, end, typename std::iterator_traits<Iterator>::iterator_category());
+}
+
+// Waits for futures[pos...] in order.  Futures that are already available
+// when reached cost nothing; only one continuation is allocated for each
+// future still pending at that point.
+template <typename Future>
+inline
+future<std::vector<Future>>
+complete_when_all(std::vector<Future>&& futures, size_t pos) {
+    while (pos < futures.size() && futures[pos].available()) {
+        ++pos;
+    }
+    if (pos == futures.size()) {
+        return make_ready_future<std::vector<Future>>(std::move(futures));
+    }
+    auto& f = futures[pos];
+    return std::move(f).then_wrapped([futures = std::move(futures), pos] (Future f) mutable {
+        futures[pos] = std::move(f);
+        return complete_when_all(std::move(futures), pos + 1);
+    });
+}
+
+}
 
 // parallel_for_each - run tasks in parallel
 //
 // Given a range [@begin, @end) of objects, run func(*i) for each i in
 // the range, and return a future<> that resolves when all the functions
 // complete.  @func should return a future<> that indicates when it is
-// complete.
+// complete.  If any of them fail, the returned future fails with one of
+// the exceptions.
 template <typename Iterator, typename Func>
 inline
 future<>
 parallel_for_each(Iterator begin, Iterator end, Func&& func) {
-    auto ret = make_ready_future<>();
+    std::vector<future<>> pending;
     while (begin != end) {
-        auto f = func(*begin++).then([ret = std::move(ret)] () mutable {
-            return std::move(ret);
-        });
-        ret = std::move(f);
+        auto f = func(*begin++);
+        if (!f.available() || f.failed()) {
+            if (pending.empty()) {
+                pending.reserve(1 + future_util_impl::distance_hint(begin, end));
+            }
+            pending.push_back(std::move(f));
+        }
+    }
+    if (pending.empty()) {
+        return make_ready_future<>();
     }
-    return ret;
+    return future_util_impl::complete_when_all(std::move(pending), 0).then([] (std::vector<future<>> done) {
+        for (auto& f : done) {
+            if (f.failed()) {
+                return std::move(f);
+            }
+        }
+        return make_ready_future<>();
+    });
 }
 
 // The AsyncAction concept represents an action which can complete later than
@@ -174,6 +239,24 @@ when_all(Future&& fut, Rest&&... rest) {
     });
 }
 
+// when_all - wait for a range of futures
+//
+// Moves the futures in [@begin, @end) into a vector and returns a future for
+// that vector, which becomes available once all of them are available.  The
+// futures are not checked for failure; examine each one with failed() or
+// get().  Costs one allocation for the vector, plus a continuation for each
+// future still pending by the time its predecessors resolved.
+template <typename FutureIterator>
+inline
+future<std::vector<std::decay_t<decltype(*std::declval<FutureIterator>())>>>
+when_all(FutureIterator begin, FutureIterator end) {
+    using future_type = std::decay_t<decltype(*begin)>;
+    std::vector<future_type> futures;
+    futures.reserve(future_util_impl::distance_hint(begin, end));
+    std::move(begin, end, std::back_inserter(futures));
+    return future_util_impl::complete_when_all(std::move(futures), 0);
+}
+
 template <typename T>
 struct reducer_with_get_traits {
     using result_type = decltype(std::declval<T>().get());
@@ -222,6 +305,31 @@ map_reduce(Iterator begin, Iterator end, Mapper&& mapper, Reducer&& r)
     return reducer_traits<Reducer>::maybe_call_get(std::move(ret), r_ptr);
 }
 
+// @Mapper is a callable which transforms values from the iterator range
+// into a future<T>.  @reduce is called as reduce(Initial, T) for each result,
+// in range order, and returns the new Initial; the final value is returned.
+//
+// All mapper calls are made before any reduction; the results are gathered
+// with a single allocation (see when_all()).
+template <typename Iterator, typename Mapper, typename Initial, typename Reduce>
+inline
+future<Initial>
+map_reduce(Iterator begin, Iterator end, Mapper&& mapper, Initial initial, Reduce reduce) {
+    using future_type = std::decay_t<decltype(mapper(*begin))>;
+    std::vector<future_type> futures;
+    futures.reserve(future_util_impl::distance_hint(begin, end));
+    while (begin != end) {
+        futures.push_back(mapper(*begin++));
+    }
+    return future_util_impl::complete_when_all(std::move(futures), 0).then(
+            [initial = std::move(initial), reduce = std::move(reduce)] (std::vector<future_type> results) mutable {
+        for (auto& f : results) {
+            initial = reduce(std::move(initial), std::get<0>(f.get()));
+        }
+        return make_ready_future<Initial>(std::move(initial));
+    });
+}
+
 // Implements @Reducer concept. Calculates the result by
 // adding elements to the accumulator.
 template <typename Result, typename Addend = Result>
@@ -245,27 +353,182 @@ future<> now() {
 
 // Converts a type to a future type, if it isn't already.
 //
-// Result in member type 'type'.
+// Result in member type 'type'.  apply() calls a function with a tuple of
+// arguments and converts its result, or the exception it throws, to that
+// future type.
 template <typename T>
 struct futurize;
 
 template <typename T>
 struct futurize {
     using type = future<T>;
+    using promise_type = promise<T>;
+
+    template <typename Func, typename... FuncArgs>
+    static type apply(Func&& func, std::tuple<FuncArgs...>&& args) {
+        try {
+            return make_ready_future<T>(::apply(std::forward<Func>(func), std::move(args)));
+        } catch (...) {
+            return make_exception_future<T>(std::current_exception());
+        }
+    }
 };
 
 template <>
 struct futurize<void> {
     using type = future<>;
+    using promise_type = promise<>;
+
+    template <typename Func, typename... FuncArgs>
+    static type apply(Func&& func, std::tuple<FuncArgs...>&& args) {
+        try {
+            ::apply(std::forward<Func>(func), std::move(args));
+            return make_ready_future<>();
+        } catch (...) {
+            return make_exception_future<>(std::current_exception());
+        }
+    }
 };
 
 template <typename... Args>
 struct futurize<future<Args...>> {
     using type = future<Args...>;
+    using promise_type = promise<Args...>;
+
+    template <typename Func, typename... FuncArgs>
+    static type apply(Func&& func, std::tuple<FuncArgs...>&& args) {
+        try {
+            return ::apply(std::forward<Func>(func), std::move(args));
+        } catch (...) {
+            return make_exception_future<Args...>(std::current_exception());
+        }
+    }
 };
 
 // Converts a type to a future type, if it isn't already.
 template <typename T>
 using futurize_t = typename futurize<T>::type;
 
+namespace future_util_impl {
+
+template <typename Func, typename... T, size_t... I>
+inline
+auto
+apply_to_refs(Func& func, std::tuple<T...>& objects, std::index_sequence<I...>) {
+    return func(std::get<I>(objects)...);
+}
+
+template <typename Tuple, size_t... I>
+inline
+auto
+take_values(Tuple&& all, std::index_sequence<I...>) {
+    return std::make_tuple(std::move(std::get<I>(all))...);
+}
+
+}
+
+// do_with - keep objects alive for the duration of an asynchronous operation
+//
+// Moves @rvalue into a heap allocation, calls @f with a reference to it, and
+// keeps it alive until the future returned by @f resolves.  This replaces
+// capturing an lw_shared_ptr in every continuation of the chain; the object
+// is allocated once and no reference counting takes place.
+template <typename T, typename F>
+inline
+auto
+do_with(T&& rvalue, F&& f) {
+    static_assert(!std::is_lvalue_reference<T>::value, "do_with() takes ownership of its arguments; pass rvalues");
+    auto obj = std::make_unique<T>(std::forward<T>(rvalue));
+    auto fut = f(*obj);
+    return fut.finally([obj = std::move(obj)] {});
+}
+
+// Like do_with() above, for several objects, all held in one allocation.
+// The last argument is the function; it is called with a reference to each
+// object.
+template <typename T1, typename T2, typename... More>
+inline
+auto
+do_with(T1&& rv1, T2&& rv2, More&&... more) {
+    auto all = std::forward_as_tuple(std::forward<T1>(rv1), std::forward<T2>(rv2), std::forward<More>(more)...);
+    constexpr size_t nr = sizeof...(More) + 1;
+    auto values = future_util_impl::take_values(std::move(all), std::make_index_sequence<nr>());
+    auto obj = std::make_unique<decltype(values)>(std::move(values));
+    auto&& func = std::get<nr>(all);
+    auto fut = future_util_impl::apply_to_refs(func, *obj, std::make_index_sequence<nr>());
+    return fut.finally([obj = std::move(obj)] {});
+}
+
+class timed_out_error : public std::exception {
+public:
+    virtual const char* what() const noexcept override {
+        return "timedout";
+    }
+};
+
+namespace future_util_impl {
+
+template <typename Clock, typename... T>
+struct timeout_state {
+    promise<T...> pr;
+    ::timer<Clock> tmr;
+};
+
+}
+
+// with_timeout - bound the time spent waiting for a future
+//
+// Returns a future that resolves with the result of @f, or fails with
+// timed_out_error if @f is not available by @timeout.  The operation behind
+// @f is not stopped: its result is discarded when it eventually arrives.
+// Use the abort_source overload to also release what the operation holds.
+//
+// Clock must be one the reactor has timers for; lowres_clock is the cheapest.
+template <typename Clock, typename Duration, typename... T>
+inline
+future<T...>
+with_timeout(std::chrono::time_point<Clock, Duration> timeout, future<T...> f) {
+    if (f.available()) {
+        return f;
+    }
+    auto st = std::make_unique<future_util_impl::timeout_state<Clock, T...>>();
+    auto& s = *st;
+    auto result = s.pr.get_future();
+    s.tmr.set_callback([&s] {
+        s.pr.set_exception(timed_out_error());
+    });
+    s.tmr.arm(std::chrono::time_point_cast<typename Clock::duration>(timeout));
+    // The state lives until f resolves, which is after the timer either
+    // fired or was cancelled.
+    std::move(f).then_wrapped([st = std::move(st)] (future<T...> f) mutable {
+        if (st->tmr.cancel()) {
+            f.forward_to(std::move(st->pr));
+        }
+        return make_ready_future<>();
+    });
+    return result;
+}
+
+// Like with_timeout() above, but also requests @as to abort on timeout, so
+// that an operation observing @as can give up the resources it waits on.
+template <typename Clock, typename Duration, typename... T>
+inline
+future<T...>
+with_timeout(std::chrono::time_point<Clock, Duration> timeout, future<T...> f, abort_source& as) {
+    if (f.available()) {
+        return f;
+    }
+    return with_timeout(timeout, std::move(f)).then_wrapped([&as] (future<T...> f) mutable {
+        if (f.failed()) {
+            try {
+                f.get();
+            } catch (timed_out_error&) {
+                as.request_abort();
+                throw;
+            }
+        }
+        return std::move(f);
+    });
+}
+
 #endif /* CORE_FUTURE_UTIL_HH_ */
@@ -40,6 +40,20 @@ future<T...> make_ready_future(A&&... value);
 template <typename... T>
 future<T...> make_exception_future(std::exception_ptr value) noexcept;
 
+namespace seastar {
+
+class thread_context;
+
+namespace thread_impl {
+
+thread_context* get();
+void switch_in(thread_context* to);
+void switch_out(thread_context* from);
+
+}
+
+}
+
 class task {
 public:
     virtual ~task() noexcept {}
@@ -175,6 +189,12 @@ struct future_state {
         }
         return std::move(_u.value);
     }
+    // Returns the stored exception without rethrowing it, so that failures
+    // can be propagated without paying for a throw/catch.
+    std::exception_ptr get_exception() const noexcept {
+        assert(_state == state::exception);
+        return _u.ex;
+    }
     void forward_to(promise<T...>& pr) noexcept {
         assert(_state != state::future);
         if (_state == state::exception) {
@@ -252,6 +272,10 @@ struct future_state<> {
         }
         return {};
     }
+    std::exception_ptr get_exception() const noexcept {
+        assert(_u.st >= state::exception_min);
+        return _u.ex;
+    }
     void forward_to(promise<>& pr) noexcept;
 };
 
@@ -420,10 +444,27 @@ public:
             _promise->_future = nullptr;
         }
     }
+    // Returns the value, or throws the exception, held by the future.  May
+    // only be called on an unavailable future from within a seastar::thread,
+    // which is then suspended until the future resolves.
     std::tuple<T...> get() {
+        if (!state()->available()) {
+            wait();
+        }
         return state()->get();
     }
 
+    // Suspends the calling seastar::thread until the future is available.
+    void wait() noexcept {
+        auto thread = seastar::thread_impl::get();
+        assert(thread);
+        schedule([this, thread] (future_state<T...>& new_state) {
+            *state() = std::move(new_state);
+            seastar::thread_impl::switch_in(thread);
+        });
+        seastar::thread_impl::switch_out(thread);
+    }
+
     bool available() noexcept {
         return state()->available();
     }
@@ -439,6 +480,9 @@ public:
     future<> then(Func&& func,
             std::enable_if_t<std::is_same<std::result_of_t<Func(T&&...)>, void>::value, void*> = nullptr) noexcept {
         if (state()->available() && (++future_avail_count % 256)) {
+            if (state()->failed()) {
+                return make_exception_future(state()->get_exception());
+            }
             try {
                 apply(std::move(func), std::move(state()->get()));
                 return make_ready_future<>();
@@ -450,6 +494,10 @@ public:
         auto fut = pr.get_future();
 
         schedule([pr = std::move(pr), func = std::forward<Func>(func)] (auto& state) mutable {
+            if (state.failed()) {
+                pr.set_exception(state.get_exception());
+                return;
+            }
             try {
                 apply(std::move(func), state.get());
                 pr.set_value();
@@ -476,6 +524,11 @@ public:
             std::enable_if_t<is_future<std::result_of_t<Func(T&&...)>>::value, void*> = nullptr) noexcept {
         using P = typename std::result_of_t<Func(T&&...)>::promise_type;
         if (state()->available() && (++future_avail_count % 256)) {
+            if (state()->failed()) {
+                P pr;
+                pr.set_exception(state()->get_exception());
+                return pr.get_future();
+            }
             try {
                 return apply(std::move(func), std::move(state()->get()));
             } catch (...) {
@@ -487,6 +540,10 @@ public:
         P pr;
         auto next_fut = pr.get_future();
         schedule([func = std::forward<Func>(func), pr = std::move(pr)] (auto& state) mutable {
+            if (state.failed()) {
+                pr.set_exception(state.get_exception());
+                return;
+            }
             try {
                 auto result = state.get();
                 auto next_fut = apply(std::move(func), std::move(result));
@@ -666,4 +723,15 @@ future<T...> make_exception_future(Exception&& ex) noexcept {
     return make_exception_future<T...>(std::make_exception_ptr(std::forward<Exception>(ex)));
 }
 
+// Returns a preallocated, per-cpu exception_ptr holding a default-constructed
+// Exception.  Hot error paths (connection resets, broken semaphores) can fail
+// futures with it without allocating a new exception object each time.
+// The exception object is shared, so it must not be modified by handlers.
+template <typename Exception>
+inline
+std::exception_ptr static_exception_ptr() {
+    static thread_local const std::exception_ptr ex = std::make_exception_ptr(Exception());
+    return ex;
+}
+
 #endif /* FUTURE_HH_ */
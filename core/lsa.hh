@@ -0,0 +1,486 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#ifndef LSA_HH_
+#define LSA_HH_
+
+// Log-structured region allocator.
+//
+// Objects are bump-allocated from large, aligned segments.  Freeing an
+// object only marks it dead; memory goes back to the system a whole
+// segment at a time, either when the last object in a segment is freed,
+// or when compact() evacuates the live objects of sparsely used segments
+// into the segment currently being filled.  This keeps memory utilization
+// high even when object sizes churn, at the cost of objects being movable:
+// every allocation names a migrator which performs each move and fixes up
+// the pointers that refer to the object.
+//
+// Objects too large to be worth packing are allocated directly from the
+// page allocator and are never moved.
+//
+// Like the rest of the allocator, a region is local to a cpu and is not
+// thread safe.
+
+#include "memory.hh"
+#include "align.hh"
+#include <boost/intrusive/list.hpp>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <new>
+
+namespace lsa {
+
+namespace bi = boost::intrusive;
+
+class region;
+
+class migrator {
+public:
+    virtual ~migrator() {}
+    // Move the @size byte object at @src into the uninitialized memory at
+    // @dst, and update all references to it.  May refuse (by returning false,
+    // without touching @dst) when the object cannot be moved right now, for
+    // example because it is referenced from outside its owner; the object
+    // then stays where it is.
+    virtual bool migrate(void* src, void* dst, size_t size) noexcept = 0;
+};
+
+struct region_stats {
+    size_t segments = 0;         // segments currently held
+    size_t live_bytes = 0;       // bytes in live objects, headers included
+    size_t large_bytes = 0;      // bytes in objects allocated outside segments
+    uint64_t compacted_segments = 0;
+    uint64_t migrations = 0;
+    uint64_t refused_migrations = 0;
+
+    size_t total_bytes() const;
+    // Fraction of the memory held by the region that holds live data.
+    float occupancy() const {
+        auto total = total_bytes();
+        return total ? float(live_bytes + large_bytes) / total : 1.0f;
+    }
+};
+
+namespace internal {
+
+struct object_header {
+    migrator* m;     // nullptr once the object is dead
+    uint32_t size;   // payload size, excluding the header
+    uint32_t flags;
+};
+
+static constexpr uint32_t large_object = 1;
+static constexpr size_t object_alignment = 8;
+
+struct segment {
+    bi::list_member_hook<> link;
+    region* owner;   // nullptr if the region was destroyed before the segment emptied
+    uint32_t pos;    // offset of the first unallocated byte
+    uint32_t live;   // bytes in live objects, headers included
+    unsigned bucket;
+};
+
+struct large_header {
+    bi::list_member_hook<> link;
+    region* owner;
+    uint64_t pad;
+};
+
+}
+
+class region {
+public:
+    static constexpr size_t segment_size = 128 * 1024;
+    // Objects larger than this are allocated directly from the page allocator.
+    static constexpr size_t max_managed_object_size = segment_size / 8;
+private:
+    using object_header = internal::object_header;
+    using segment = internal::segment;
+    using large_header = internal::large_header;
+    using segment_list = bi::list<segment,
+        bi::member_hook<segment, bi::list_member_hook<>, &segment::link>,
+        bi::constant_time_size<false>>;
+    using large_list = bi::list<large_header,
+        bi::member_hook<large_header, bi::list_member_hook<>, &large_header::link>,
+        bi::constant_time_size<false>>;
+    // Closed segments are kept in buckets according to their occupancy, so
+    // that the compactor can find the emptiest ones without scanning.
+    static constexpr unsigned nr_buckets = 8;
+    static constexpr size_t segment_data_offset = align_up(sizeof(segment), size_t(16));
+    static constexpr size_t segment_capacity = segment_size - segment_data_offset;
+    segment* _active = nullptr;
+    std::array<segment_list, nr_buckets> _closed;
+    size_t _nr_closed = 0;
+    large_list _large;
+    region_stats _stats;
+public:
+    region() = default;
+    region(const region&) = delete;
+    region(region&&) = delete;
+    ~region();
+    void operator=(const region&) = delete;
+
+    // Allocates @size bytes, which @m may later move.  The object is aligned
+    // to object_alignment.
+    void* allocate(size_t size, migrator& m);
+    // Frees an object allocated from any region.
+    static void free(void* obj);
+    // Shrinks an object in place, returning the tail to the region.
+    static void shrink(void* obj, size_t new_size);
+    // Returns the region that owns a live object, or nullptr if that
+    // region was destroyed before the object was freed.
+    static region* of(void* obj);
+    static size_t object_size(void* obj) {
+        return header_of(obj)->size;
+    }
+
+    // Evacuates sparsely used segments until at least @target bytes have been
+    // released to the page allocator, or no segment is worth compacting.
+    // Returns the number of bytes released.
+    size_t compact(size_t target);
+
+    const region_stats& stats() const { return _stats; }
+private:
+    static object_header* header_of(void* obj) {
+        return reinterpret_cast<object_header*>(obj) - 1;
+    }
+    static size_t footprint(size_t size) {
+        return align_up(sizeof(object_header) + size, internal::object_alignment);
+    }
+    static segment* segment_of(void* p) {
+        return reinterpret_cast<segment*>(align_down(reinterpret_cast<uintptr_t>(p), segment_size));
+    }
+    static char* segment_data(segment* seg) {
+        return reinterpret_cast<char*>(seg) + segment_data_offset;
+    }
+    static unsigned bucket_of(size_t live) {
+        return std::min<size_t>(live * nr_buckets / segment_capacity, nr_buckets - 1);
+    }
+    void* allocate_large(size_t size, migrator& m);
+    static void free_large(object_header* h);
+    object_header* bump(size_t size, migrator& m);
+    void unbump(object_header* h);
+    void open_segment();
+    void close_active();
+    void link_closed(segment* seg);
+    void unlink_closed(segment* seg);
+    void release_segment(segment* seg);
+    void on_free(segment* seg, size_t bytes);
+    segment* pick_victim();
+    bool evacuate(segment* seg);
+    static void release_orphan(segment* seg, size_t bytes);
+};
+
+inline
+size_t region_stats::total_bytes() const {
+    return segments * region::segment_size + large_bytes;
+}
+
+inline
+region::~region() {
+    // Objects may outlive the region (for example, when they are still
+    // referenced by a response in flight).  Their segments are orphaned and
+    // released when the last of them is freed.
+    auto orphan = [] (segment* seg) {
+        if (seg->live) {
+            seg->owner = nullptr;
+        } else {
+            ::operator delete(seg, with_alignment(segment_size));
+        }
+    };
+    if (_active) {
+        orphan(_active);
+    }
+    for (auto&& list : _closed) {
+        list.clear_and_dispose(orphan);
+    }
+    _large.clear_and_dispose([] (large_header* lh) {
+        lh->owner = nullptr;
+    });
+}
+
+inline
+void region::open_segment() {
+    auto seg = static_cast<segment*>(::operator new(segment_size, with_alignment(segment_size)));
+    new (seg) segment;
+    seg->owner = this;
+    seg->pos = segment_data_offset;
+    seg->live = 0;
+    seg->bucket = 0;
+    _active = seg;
+    ++_stats.segments;
+}
+
+inline
+void region::link_closed(segment* seg) {
+    seg->bucket = bucket_of(seg->live);
+    _closed[seg->bucket].push_back(*seg);
+    ++_nr_closed;
+}
+
+inline
+void region::unlink_closed(segment* seg) {
+    _closed[seg->bucket].erase(_closed[seg->bucket].iterator_to(*seg));
+    --_nr_closed;
+}
+
+inline
+void region::close_active() {
+    auto seg = _active;
+    _active = nullptr;
+    if (!seg) {
+        return;
+    }
+    if (seg->live) {
+        link_closed(seg);
+    } else {
+        release_segment(seg);
+    }
+}
+
+inline
+void region::release_segment(segment* seg) {
+    seg->~segment();
+    ::operator delete(seg, with_alignment(segment_size));
+    --_stats.segments;
+}
+
+inline
+region::object_header* region::bump(size_t size, migrator& m) {
+    auto bytes = footprint(size);
+    if (!_active || segment_size - _active->pos < bytes) {
+        close_active();
+        open_segment();
+    }
+    auto h = reinterpret_cast<object_header*>(reinterpret_cast<char*>(_active) + _active->pos);
+    h->m = &m;
+    h->size = size;
+    h->flags = 0;
+    _active->pos += bytes;
+    _active->live += bytes;
+    _stats.live_bytes += bytes;
+    return h;
+}
+
+// Undoes the most recent bump().
+inline
+void region::unbump(object_header* h) {
+    auto bytes = footprint(h->size);
+    assert(reinterpret_cast<char*>(h) + bytes == reinterpret_cast<char*>(_active) + _active->pos);
+    _active->pos -= bytes;
+    _active->live -= bytes;
+    _stats.live_bytes -= bytes;
+}
+
+inline
+void* region::allocate(size_t size, migrator& m) {
+    if (size > max_managed_object_size) {
+        return allocate_large(size, m);
+    }
+    return bump(size, m) + 1;
+}
+
+inline
+void* region::allocate_large(size_t size, migrator& m) {
+    auto p = static_cast<char*>(::operator new(sizeof(large_header) + sizeof(object_header) + size));
+    auto lh = new (p) large_header;
+    lh->owner = this;
+    _large.push_back(*lh);
+    auto h = reinterpret_cast<object_header*>(lh + 1);
+    h->m = &m;
+    h->size = size;
+    h->flags = internal::large_object;
+    _stats.large_bytes += size;
+    return h + 1;
+}
+
+inline
+void region::free_large(object_header* h) {
+    auto lh = reinterpret_cast<large_header*>(h) - 1;
+    if (lh->owner) {
+        auto& r = *lh->owner;
+        r._large.erase(r._large.iterator_to(*lh));
+        r._stats.large_bytes -= h->size;
+    }
+    lh->~large_header();
+    ::operator delete(lh);
+}
+
+inline
+void region::on_free(segment* seg, size_t bytes) {
+    seg->live -= bytes;
+    _stats.live_bytes -= bytes;
+    if (seg == _active) {
+        return;
+    }
+    if (!seg->live) {
+        unlink_closed(seg);
+        release_segment(seg);
+    } else if (bucket_of(seg->live) != seg->bucket) {
+        unlink_closed(seg);
+        link_closed(seg);
+    }
+}
+
+inline
+void region::release_orphan(segment* seg, size_t bytes) {
+    seg->live -= bytes;
+    if (!seg->live) {
+        seg->~segment();
+        ::operator delete(seg, with_alignment(segment_size));
+    }
+}
+
+inline
+void region::free(void* obj) {
+    auto h = header_of(obj);
+    if (h->flags & internal::large_object) {
+        return free_large(h);
+    }
+    h->m = nullptr;
+    auto seg = segment_of(h);
+    auto bytes = footprint(h->size);
+    if (seg->owner) {
+        seg->owner->on_free(seg, bytes);
+    } else {
+        release_orphan(seg, bytes);
+    }
+}
+
+inline
+void region::shrink(void* obj, size_t new_size) {
+    auto h = header_of(obj);
+    assert(new_size <= h->size);
+    if (h->flags & internal::large_object) {
+        if (auto owner = (reinterpret_cast<large_header*>(h) - 1)->owner) {
+            owner->_stats.large_bytes -= h->size - new_size;
+        }
+        h->size = new_size;
+        return;
+    }
+    auto old_bytes = footprint(h->size);
+    auto new_bytes = footprint(new_size);
+    // The tail becomes a dead object, so it needs room for a header.
+    if (old_bytes - new_bytes < sizeof(object_header)) {
+        return;
+    }
+    h->size = new_size;
+    auto tail = reinterpret_cast<object_header*>(reinterpret_cast<char*>(h) + new_bytes);
+    tail->m = nullptr;
+    tail->size = old_bytes - new_bytes - sizeof(object_header);
+    tail->flags = 0;
+    auto seg = segment_of(h);
+    if (seg->owner) {
+        seg->owner->on_free(seg, old_bytes - new_bytes);
+    } else {
+        release_orphan(seg, old_bytes - new_bytes);
+    }
+}
+
+inline
+region* region::of(void* obj) {
+    auto h = header_of(obj);
+    if (h->flags & internal::large_object) {
+        return (reinterpret_cast<large_header*>(h) - 1)->owner;
+    }
+    return segment_of(h)->owner;
+}
+
+// Returns the emptiest closed segment, or nullptr if none is worth
+// compacting.  Evacuating a segment that is nearly full costs almost a full
+// segment of copying for very little gain, so the top bucket is never chosen.
+inline
+region::segment* region::pick_victim() {
+    for (unsigned i = 0; i < nr_buckets - 1; ++i) {
+        if (!_closed[i].empty()) {
+            return &_closed[i].front();
+        }
+    }
+    return nullptr;
+}
+
+// Moves all live objects out of @seg.  Returns false if some of them
+// refused to move, in which case the segment stays.
+inline
+bool region::evacuate(segment* seg) {
+    auto p = segment_data(seg);
+    auto end = reinterpret_cast<char*>(seg) + seg->pos;
+    while (p != end) {
+        auto h = reinterpret_cast<object_header*>(p);
+        auto bytes = footprint(h->size);
+        p += bytes;
+        if (!h->m) {
+            continue;
+        }
+        auto dst = bump(h->size, *h->m);
+        if (h->m->migrate(h + 1, dst + 1, h->size)) {
+            h->m = nullptr;
+            seg->live -= bytes;
+            _stats.live_bytes -= bytes;
+            ++_stats.migrations;
+        } else {
+            unbump(dst);
+            ++_stats.refused_migrations;
+        }
+    }
+    return !seg->live;
+}
+
+inline
+size_t region::compact(size_t target) {
+    size_t released = 0;
+    // Each closed segment is visited at most once; segments holding objects
+    // that refused to move are requeued behind their peers.
+    auto budget = _nr_closed;
+    while (released < target && budget--) {
+        auto seg = pick_victim();
+        if (!seg) {
+            break;
+        }
+        unlink_closed(seg);
+        bool evacuated;
+        try {
+            evacuated = evacuate(seg);
+        } catch (std::bad_alloc&) {
+            // No memory for a fresh segment to evacuate into; stop here.
+            if (seg->live) {
+                link_closed(seg);
+            } else {
+                release_segment(seg);
+                released += segment_size;
+            }
+            break;
+        }
+        if (evacuated) {
+            release_segment(seg);
+            released += segment_size;
+            ++_stats.compacted_segments;
+        } else {
+            link_closed(seg);
+        }
+    }
+    return released;
+}
+
+}
+
+#endif /* LSA_HH_ */
@@ -196,6 +196,7 @@ public:
     explicit small_pool(unsigned object_size) noexcept;
     ~small_pool();
     void* allocate();
+    size_t allocate_batch(void** objs, size_t n);
     void deallocate(void* object);
     unsigned object_size() const { return _object_size; }
     static constexpr unsigned size_to_idx(unsigned size);
@@ -292,9 +293,12 @@ struct cpu_pages {
     void* allocate_large(unsigned nr_pages);
     void* allocate_large_aligned(unsigned align_pages, unsigned nr_pages);
     void free_large(void* ptr);
+    bool grow_large_in_place(void* ptr, unsigned new_nr_pages);
+    void shrink_large_in_place(void* ptr, unsigned new_nr_pages);
     void free_span(pageidx start, uint32_t nr_pages);
     void free_span_no_merge(pageidx start, uint32_t nr_pages);
     void* allocate_small(unsigned size);
+    size_t allocate_small_batch(unsigned size, void** objs, size_t n);
     void free(void* ptr);
     void free(void* ptr, size_t size);
     void free_cross_cpu(unsigned cpu_id, void* ptr);
@@ -404,13 +408,13 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer) {
         span = &pages[span_idx];
 
     }
-    if (t.nr_pages < span->span_size) {
+    if (t.nr_pages < span_size) {
         free_span_no_merge(span_idx + t.nr_pages, span_size - t.nr_pages);
         span_size = t.nr_pages;
     }
-    auto span_end = &pages[span_idx + n_pages - 1];
+    auto span_end = &pages[span_idx + span_size - 1];
     span->free = span_end->free = false;
-    span->span_size = span_end->span_size = n_pages;
+    span->span_size = span_end->span_size = span_size;
     span->pool = nullptr;
     if (nr_free_pages < current_min_free_pages) {
         drain_cross_cpu_freelist();
@@ -441,12 +445,65 @@ cpu_pages::allocate_small(unsigned size) {
     return pool.allocate();
 }
 
+size_t
+cpu_pages::allocate_small_batch(unsigned size, void** objs, size_t n) {
+    auto idx = small_pool::size_to_idx(size);
+    auto& pool = small_pools[idx];
+    assert(size <= pool.object_size());
+    return pool.allocate_batch(objs, n);
+}
+
 void cpu_pages::free_large(void* ptr) {
     pageidx idx = (reinterpret_cast<char*>(ptr) - mem()) / page_size;
     page* span = &pages[idx];
     free_span(idx, span->span_size);
 }
 
+// Extends a large allocation into the free span that immediately follows
+// it, if that span is big enough.  Returns false (and leaves the allocation
+// untouched) otherwise.
+bool cpu_pages::grow_large_in_place(void* ptr, unsigned new_nr_pages) {
+    pageidx idx = (reinterpret_cast<char*>(ptr) - mem()) / page_size;
+    page* span = &pages[idx];
+    auto old_nr_pages = span->span_size;
+    if (new_nr_pages <= old_nr_pages) {
+        return true;
+    }
+    page* after = &pages[idx + old_nr_pages];
+    auto extra = new_nr_pages - old_nr_pages;
+    if (!after->free || after->span_size < extra) {
+        return false;
+    }
+    auto a_size = after->span_size;
+    unlink(fsu.free_spans[index_of(a_size)], after);
+    nr_free_pages -= a_size;
+    if (a_size > extra) {
+        free_span_no_merge(idx + new_nr_pages, a_size - extra);
+    }
+    auto span_end = &pages[idx + new_nr_pages - 1];
+    span_end->free = false;
+    span->span_size = span_end->span_size = new_nr_pages;
+    if (nr_free_pages < current_min_free_pages) {
+        drain_cross_cpu_freelist();
+        reclaim();
+    }
+    return true;
+}
+
+// Returns the tail of a large allocation to the free lists.
+void cpu_pages::shrink_large_in_place(void* ptr, unsigned new_nr_pages) {
+    pageidx idx = (reinterpret_cast<char*>(ptr) - mem()) / page_size;
+    page* span = &pages[idx];
+    auto old_nr_pages = span->span_size;
+    if (new_nr_pages >= old_nr_pages) {
+        return;
+    }
+    auto span_end = &pages[idx + new_nr_pages - 1];
+    span_end->free = false;
+    span->span_size = span_end->span_size = new_nr_pages;
+    free_span(idx + new_nr_pages, old_nr_pages - new_nr_pages);
+}
+
 size_t cpu_pages::object_size(void* ptr) {
     pageidx idx = (reinterpret_cast<char*>(ptr) - mem()) / page_size;
     page* span = &pages[idx];
@@ -689,6 +746,33 @@ small_pool::allocate() {
     return obj;
 }
 
+// Hands out objects straight off the free list, which add_more_objects()
+// refills a whole span at a time, so a batch costs one pass over the list
+// rather than n trips through the allocator.
+size_t
+small_pool::allocate_batch(void** objs, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        if (!_free) {
+            try {
+                add_more_objects();
+            } catch (std::bad_alloc&) {
+                if (i) {
+                    break;
+                }
+                throw;
+            }
+        }
+        auto take = std::min(n - i, _free_count);
+        for (size_t j = 0; j < take; ++j) {
+            objs[i++] = _free;
+            _free = _free->next;
+        }
+        _free_count -= take;
+    }
+    return i;
+}
+
 void
 small_pool::deallocate(void* object) {
     auto o = reinterpret_cast<free_object*>(object);
@@ -781,6 +865,25 @@ size_t object_size(void* ptr) {
     return cpu_pages::all_cpus[object_cpu_id(ptr)]->object_size(ptr);
 }
 
+// Resizes a large allocation owned by this cpu without moving it, growing
+// into the following free span or trimming the tail.  Small objects, objects
+// owned by other cpus and sizes that belong in a small pool are not handled.
+bool try_resize_in_place(void* ptr, size_t size) {
+    if (size <= max_small_allocation || object_cpu_id(ptr) != cpu_mem.cpu_id) {
+        return false;
+    }
+    if (cpu_mem.to_page(ptr)->pool) {
+        return false;
+    }
+    unsigned size_in_pages = (size + page_size - 1) >> page_bits;
+    auto old_size_in_pages = cpu_mem.to_page(ptr)->span_size;
+    if (size_in_pages > old_size_in_pages) {
+        return cpu_mem.grow_large_in_place(ptr, size_in_pages);
+    }
+    cpu_mem.shrink_large_in_place(ptr, size_in_pages);
+    return true;
+}
+
 void* allocate(size_t size) {
     ++g_allocs;
     if (size <= sizeof(free_object)) {
@@ -809,6 +912,26 @@ void* allocate_aligned(size_t align, size_t size) {
     }
 }
 
+size_t allocate_batch(size_t size, size_t align, void** objs, size_t n) {
+    size = std::max(size, align);
+    if (size <= sizeof(free_object)) {
+        size = sizeof(free_object);
+    }
+    size_t done;
+    if (size > max_small_allocation) {
+        objs[0] = align > alignof(std::max_align_t) ? allocate_large_aligned(align, size) : allocate_large(size);
+        done = 1;
+    } else {
+        if (align > alignof(std::max_align_t)) {
+            // As in allocate_aligned()
+            size = 1 << log2(size);
+        }
+        done = cpu_mem.allocate_small_batch(size, objs, n);
+    }
+    g_allocs += done;
+    return done;
+}
+
 void free(void* obj) {
     ++g_frees;
     cpu_mem.free(obj);
@@ -943,6 +1066,9 @@ void* __libc_calloc(size_t n, size_t m) throw ();
 extern "C"
 [[gnu::visibility("default")]]
 void* realloc(void* ptr, size_t size) {
+    if (ptr && try_resize_in_place(ptr, size)) {
+        return ptr;
+    }
     auto old_size = ptr ? object_size(ptr) : 0;
     auto nptr = malloc(size);
     if (!nptr) {
@@ -1154,6 +1280,15 @@ void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
 void configure(std::vector<resource::memory> m, std::experimental::optional<std::string> hugepages_path) {
 }
 
+size_t allocate_batch(size_t size, size_t align, void** objs, size_t n) {
+    if (align > alignof(std::max_align_t)) {
+        objs[0] = ::operator new(size, with_alignment(align));
+    } else {
+        objs[0] = ::operator new(size);
+    }
+    return 1;
+}
+
 statistics stats() {
     return statistics{0, 0, 0};
 }
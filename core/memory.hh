@@ -24,6 +24,7 @@
 
 #include "resource.hh"
 #include <new>
+#include <cstddef>
 #include <functional>
 #include <vector>
 
@@ -39,6 +40,12 @@ void configure(std::vector<resource::memory> m,
 
 void* allocate_reclaimable(size_t size);
 
+// Allocates up to @n objects of @size bytes aligned to @align into @objs,
+// taking small objects a whole pool span at a time.  Returns how many were
+// allocated, at least one; throws std::bad_alloc if none could be.  The
+// objects are freed individually, like any other.
+size_t allocate_batch(size_t size, size_t align, void** objs, size_t n);
+
 class reclaimer {
     std::function<void ()> _reclaim;
 public:
@@ -0,0 +1,186 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#ifndef OBJECT_POOL_HH_
+#define OBJECT_POOL_HH_
+
+#include "align.hh"
+#include "memory.hh"
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+
+// Per-shard free list of fixed-size objects of type T.
+//
+// Hot objects that are allocated and freed at a high rate (I/O completions,
+// cache items) skip the size-class lookup of the general allocator and are
+// recycled while still warm in the cache.  The free list is refilled in
+// batches, so consecutive objects come from the same small pool span, and
+// objects beyond max_free are returned to the allocator so an idle pool does
+// not hold on to memory.
+//
+// Align lets hot types be laid out on cache line boundaries so that two
+// objects never share a line.
+//
+// A pool is only ever touched by its own shard; objects freed on another
+// shard must be sent back to their owner, like any other shard-local memory.
+template <typename T, size_t Align = alignof(T)>
+class object_pool {
+    struct free_object {
+        free_object* next;
+    };
+public:
+    static constexpr size_t alignment = Align < alignof(free_object) ? alignof(free_object) : Align;
+    static constexpr size_t object_size = align_up(sizeof(T) < sizeof(free_object) ? sizeof(free_object) : sizeof(T), alignment);
+    struct stats {
+        uint64_t allocations = 0;
+        uint64_t deallocations = 0;
+        uint64_t refills = 0;      // allocator round trips to refill the free list
+        uint64_t releases = 0;     // objects returned to the allocator
+        size_t free_objects = 0;
+    };
+private:
+    static constexpr size_t max_refill_batch = 64;
+    free_object* _free = nullptr;
+    size_t _free_count = 0;
+    size_t _refill_batch;
+    size_t _max_free;
+    stats _stats;
+public:
+    explicit object_pool(size_t refill_batch = 32, size_t max_free = 1024)
+        : _refill_batch(refill_batch), _max_free(max_free) {
+#ifdef DEFAULT_ALLOCATOR
+        // Recycling objects would hide use-after-free from the sanitizers.
+        _refill_batch = 1;
+        _max_free = 0;
+#endif
+    }
+    object_pool(const object_pool&) = delete;
+    object_pool& operator=(const object_pool&) = delete;
+    ~object_pool() {
+        while (_free) {
+            auto obj = _free;
+            _free = obj->next;
+            free_object_memory(obj);
+        }
+    }
+
+    // The calling shard's pool.
+    static object_pool& local() {
+        static thread_local object_pool pool;
+        return pool;
+    }
+
+    void* allocate() {
+        if (!_free) {
+            refill();
+        }
+        auto obj = _free;
+        _free = obj->next;
+        --_free_count;
+        ++_stats.allocations;
+        return obj;
+    }
+
+    void deallocate(void* ptr) noexcept {
+        ++_stats.deallocations;
+        auto obj = static_cast<free_object*>(ptr);
+        obj->next = _free;
+        _free = obj;
+        if (++_free_count > _max_free) {
+            release_one();
+        }
+    }
+
+    template <typename... Args>
+    T* construct(Args&&... args) {
+        auto p = allocate();
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(p);
+            throw;
+        }
+    }
+
+    void destroy(T* obj) noexcept {
+        obj->~T();
+        deallocate(obj);
+    }
+
+    stats get_stats() const {
+        auto s = _stats;
+        s.free_objects = _free_count;
+        return s;
+    }
+private:
+    static void free_object_memory(void* p) noexcept {
+        if (alignment > alignof(std::max_align_t)) {
+            ::operator delete(p, with_alignment(alignment));
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    void refill() {
+        ++_stats.refills;
+        // One call takes the batch off the allocator's free list for this
+        // size, which it refills a span at a time; a partial batch is fine.
+        void* objs[max_refill_batch];
+        auto n = memory::allocate_batch(object_size, alignment, objs,
+                std::min(std::max<size_t>(_refill_batch, 1), size_t(max_refill_batch)));
+        for (size_t i = 0; i < n; ++i) {
+            auto obj = static_cast<free_object*>(objs[i]);
+            obj->next = _free;
+            _free = obj;
+        }
+        _free_count += n;
+    }
+
+    void release_one() noexcept {
+        auto obj = _free;
+        _free = obj->next;
+        --_free_count;
+        ++_stats.releases;
+        free_object_memory(obj);
+    }
+};
+
+template <typename T, size_t Align = alignof(T)>
+struct object_pool_deleter {
+    void operator()(T* obj) const noexcept {
+        object_pool<T, Align>::local().destroy(obj);
+    }
+};
+
+template <typename T, size_t Align = alignof(T)>
+using pooled_ptr = std::unique_ptr<T, object_pool_deleter<T, Align>>;
+
+// Allocates a T from the calling shard's pool.
+template <typename T, size_t Align = alignof(T), typename... Args>
+inline
+pooled_ptr<T, Align> make_pooled(Args&&... args) {
+    return pooled_ptr<T, Align>(object_pool<T, Align>::local().construct(std::forward<Args>(args)...));
+}
+
+#endif /* OBJECT_POOL_HH_ */
@@ -353,6 +353,32 @@ void throw_kernel_error(T r) {
     }
 }
 
+// Returns an exception_ptr holding std::system_error(error).  Errors that
+// peers can trigger at will (resets, broken pipes) come from a per-thread
+// preallocated pool, so failing a read with them costs no allocation.
+inline
+std::exception_ptr make_system_error_ptr(int error) {
+    auto make = [] (int error) {
+        return std::make_exception_ptr(std::system_error(error, std::system_category()));
+    };
+    switch (error) {
+    case ECONNRESET: {
+        static thread_local const std::exception_ptr ex = make(ECONNRESET);
+        return ex;
+    }
+    case EPIPE: {
+        static thread_local const std::exception_ptr ex = make(EPIPE);
+        return ex;
+    }
+    case ETIMEDOUT: {
+        static thread_local const std::exception_ptr ex = make(ETIMEDOUT);
+        return ex;
+    }
+    default:
+        return make(error);
+    }
+}
+
 inline
 sigset_t make_sigset_mask(int signo) {
     sigset_t set;
@@ -24,6 +24,7 @@
 
 #include "circular_buffer.hh"
 #include "future.hh"
+#include "abort_source.hh"
 #include <queue>
 #include <experimental/optional>
 
@@ -71,6 +72,10 @@ public:
     // available when some element is available.
     future<T> pop_eventually();
 
+    // Like pop_eventually(), but fails with abort_requested_exception if
+    // as is aborted while the queue is empty.
+    future<T> pop_eventually(abort_source& as);
+
     // Pushes the element now or when there is room. Returns a future<> which
     // resolves when data was pushed.
     future<> push_eventually(T&& data);
@@ -137,6 +142,26 @@ future<T> queue<T>::pop_eventually() {
     }
 }
 
+template <typename T>
+inline
+future<T> queue<T>::pop_eventually(abort_source& as) {
+    if (!empty()) {
+        return make_ready_future<T>(pop());
+    }
+    auto sub = as.subscribe([this] {
+        if (_not_empty) {
+            _not_empty->set_exception(abort_requested_exception());
+            _not_empty = std::experimental::optional<promise<>>();
+        }
+    });
+    if (!sub) {
+        return make_exception_future<T>(abort_requested_exception());
+    }
+    return not_empty().then([this, sub = std::move(sub)] {
+        return make_ready_future<T>(pop());
+    });
+}
+
 template <typename T>
 inline
 future<> queue<T>::push_eventually(T&& data) {
@@ -22,6 +22,7 @@
 #include <sys/syscall.h>
 #include "reactor.hh"
 #include "memory.hh"
+#include "object_pool.hh"
 #include "core/posix.hh"
 #include "net/packet.hh"
 #include "resource.hh"
@@ -33,6 +34,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
 #include <boost/thread/barrier.hpp>
 #include <atomic>
 #include <dirent.h>
@@ -177,6 +180,31 @@ future<> reactor_backend_epoll::writeable(pollable_fd_state& fd) {
     return get_epoll_future(fd, &pollable_fd_state::pollout, EPOLLOUT);
 }
 
+future<> reactor_backend_epoll::error_queue_readable(pollable_fd_state& fd) {
+    // epoll always reports EPOLLERR, but only for descriptors it watches,
+    // so it is installed like any other event.
+    return get_epoll_future(fd, &pollable_fd_state::pollerr, EPOLLERR);
+}
+
+void reactor_backend_epoll::abort_fd(pollable_fd_state& pfd, std::exception_ptr ex,
+        promise<> pollable_fd_state::* pr, int event) {
+    // The event stays installed in epoll; it is removed lazily by
+    // wait_and_process() once it fires with nobody waiting for it.
+    if (pfd.events_requested & event) {
+        pfd.events_requested &= ~event;
+        (pfd.*pr).set_exception(std::move(ex));
+        pfd.*pr = promise<>();
+    }
+}
+
+void reactor_backend_epoll::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollin, EPOLLIN);
+}
+
+void reactor_backend_epoll::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollout, EPOLLOUT);
+}
+
 void reactor_backend_epoll::forget(pollable_fd_state& fd) {
     if (fd.events_epoll) {
         ::epoll_ctl(_epollfd.get(), EPOLL_CTL_DEL, fd.fd.get(), nullptr);
@@ -198,6 +226,9 @@ reactor::posix_listen(socket_address sa, listen_options opts) {
     if (opts.reuse_address) {
         fd.setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
     }
+    if (!opts.congestion_control.empty()) {
+        fd.setsockopt(IPPROTO_TCP, TCP_CONGESTION, opts.congestion_control.c_str());
+    }
     if (_reuseport)
         fd.setsockopt(SOL_SOCKET, SO_REUSEPORT, 1);
 
@@ -251,21 +282,56 @@ void reactor_backend_epoll::complete_epoll_event(pollable_fd_state& pfd, promise
     }
 }
 
+template <typename Func>
+future<io_event>
+reactor::submit_io_now(Func& prepare_io) {
+    auto pr = make_pooled<promise<io_event>>();
+    iocb io;
+    prepare_io(io);
+    io.data = pr.get();
+    iocb* p = &io;
+    auto r = ::io_submit(_io_context, 1, &p);
+    throw_kernel_error(r);
+    return pr.release()->get_future();
+}
+
 template <typename Func>
 future<io_event>
 reactor::submit_io(Func prepare_io) {
     return _io_context_available.wait(1).then([this, prepare_io = std::move(prepare_io)] () mutable {
-        auto pr = std::make_unique<promise<io_event>>();
-        iocb io;
-        prepare_io(io);
-        io.data = pr.get();
-        iocb* p = &io;
-        auto r = ::io_submit(_io_context, 1, &p);
-        throw_kernel_error(r);
-        return pr.release()->get_future();
+        return submit_io_now(prepare_io);
+    });
+}
+
+// Once submitted, an aio request cannot be reliably cancelled (io_cancel()
+// is not implemented for most files), so abort is only observed while
+// waiting for a free slot in the aio context.
+template <typename Func>
+future<io_event>
+reactor::submit_io(Func prepare_io, abort_source& as) {
+    return _io_context_available.wait(as, 1).then([this, prepare_io = std::move(prepare_io)] () mutable {
+        return submit_io_now(prepare_io);
     });
 }
 
+bool
+reactor::flush_pending_batch() {
+    if (_flush_batch.empty()) {
+        return false;
+    }
+    // poll_flush() may re-add streams whose flush completes immediately;
+    // they are handled on the next poll.
+    auto n = _flush_batch.size();
+    for (size_t i = 0; i < n; ++i) {
+        // streams that left the batch are nulled out
+        if (_flush_batch[i]) {
+            _flush_batch[i]->poll_flush();
+        }
+    }
+    _flush_batch.erase(_flush_batch.begin(), _flush_batch.begin() + n);
+    return true;
+}
+
 bool reactor::process_io()
 {
     io_event ev[max_aio];
@@ -275,7 +341,7 @@ bool reactor::process_io()
     for (size_t i = 0; i < size_t(n); ++i) {
         auto pr = reinterpret_cast<promise<io_event>*>(ev[i].data);
         pr->set_value(ev[i]);
-        delete pr;
+        object_pool<promise<io_event>>::local().destroy(pr);
     }
     _io_context_available.signal(n);
     return n;
@@ -311,6 +377,26 @@ posix_file_impl::read_dma(uint64_t pos, void* buffer, size_t len) {
     });
 }
 
+future<size_t>
+posix_file_impl::write_dma(uint64_t pos, const void* buffer, size_t len, abort_source& as) {
+    return engine().submit_io([this, pos, buffer, len] (iocb& io) {
+        io_prep_pwrite(&io, _fd, const_cast<void*>(buffer), len, pos);
+    }, as).then([] (io_event ev) {
+        throw_kernel_error(long(ev.res));
+        return make_ready_future<size_t>(size_t(ev.res));
+    });
+}
+
+future<size_t>
+posix_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, abort_source& as) {
+    return engine().submit_io([this, pos, buffer, len] (iocb& io) {
+        io_prep_pread(&io, _fd, buffer, len, pos);
+    }, as).then([] (io_event ev) {
+        throw_kernel_error(long(ev.res));
+        return make_ready_future<size_t>(size_t(ev.res));
+    });
+}
+
 future<size_t>
 posix_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov) {
     return engine().submit_io([this, pos, iov = std::move(iov)] (iocb& io) {
@@ -392,6 +478,92 @@ posix_file_impl::size(void) {
     });
 }
 
+future<>
+reactor::transmit_file(pollable_fd_state& fd, file& f, uint64_t pos, size_t len) {
+    auto& pf = dynamic_cast<posix_file_impl&>(*f._file_impl);
+    // Our files are opened with O_DIRECT, which would make sendfile() bypass
+    // the page cache and require aligned offsets; send from a buffered
+    // descriptor for the same file instead.
+    auto path = sprint("/proc/self/fd/%d", pf._fd);
+    return _thread_pool.submit<syscall_result<int>>([path] {
+        return wrap_syscall<int>(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    }).then([this, &fd, pos, len] (syscall_result<int> sr) {
+        sr.throw_if_error();
+        return transmit_file_part(fd, file(sr.result), pos, len);
+    });
+}
+
+// sendfile() may block on reading the file, so it runs in the syscall
+// thread, sending as much as it can until the non-blocking socket's buffer
+// fills up; only then do we wait for the socket to become writeable again.
+future<>
+reactor::transmit_file_part(pollable_fd_state& fd, file in, uint64_t pos, size_t len) {
+    if (!len) {
+        return make_ready_future<>();
+    }
+    auto in_fd = static_cast<posix_file_impl&>(*in._file_impl)._fd;
+    return _thread_pool.submit<syscall_result_extra<size_t>>([out_fd = fd.fd.get(), in_fd, pos, len] {
+        size_t sent = 0;
+        while (sent < len) {
+            off_t off = pos + sent;
+            auto r = ::sendfile(out_fd, in_fd, &off, len - sent);
+            if (r <= 0) {
+                if (r == -1 && errno == EINTR) {
+                    continue;
+                }
+                return wrap_syscall(r, sent);
+            }
+            sent += r;
+        }
+        return wrap_syscall(0, sent);
+    }).then([this, &fd, in = std::move(in), pos, len] (syscall_result_extra<size_t> sr) mutable {
+        if (sr.result == -1 && sr.error != EAGAIN) {
+            sr.throw_if_error();
+        }
+        if (sr.result == 0 && sr.extra < len) {
+            throw std::runtime_error("transmit_file: unexpected end of file");
+        }
+        auto sent = sr.extra;
+        if (sent == len) {
+            fd.speculate_epoll(EPOLLOUT);
+            return make_ready_future<>();
+        }
+        return writeable(fd).then([this, &fd, in = std::move(in), pos, len, sent] () mutable {
+            return transmit_file_part(fd, std::move(in), pos + sent, len - sent);
+        });
+    });
+}
+
+static future<> write_file_range(output_stream<char>& out, file& f, uint64_t pos, size_t len) {
+    if (!len) {
+        return out.flush();
+    }
+    // dma_read() needs aligned offsets, so read from the start of the
+    // enclosing block and skip the head.
+    static constexpr size_t align = 4096;
+    static constexpr size_t chunk = 128 * 1024;
+    auto start = pos & ~uint64_t(align - 1);
+    auto buf = allocate_aligned_buffer<char>(chunk, align);
+    auto p = buf.get();
+    return f.dma_read(start, p, chunk).then([&out, &f, pos, len, start, buf = std::move(buf)] (size_t n) mutable {
+        size_t skip = pos - start;
+        if (n <= skip) {
+            throw std::runtime_error("transmit_file: unexpected end of file");
+        }
+        auto now = std::min(n - skip, len);
+        auto data = buf.get() + skip;
+        net::packet pkt(net::fragment{data, now}, make_free_deleter(buf.release()));
+        return out.write(std::move(pkt)).then([&out, &f, pos, len, now] {
+            return write_file_range(out, f, pos + now, len - now);
+        });
+    });
+}
+
+future<>
+connected_socket_impl::transmit_file(output_stream<char>& out, file& f, uint64_t pos, size_t len) {
+    return write_file_range(out, f, pos, len);
+}
+
 future<size_t>
 blockdev_file_impl::size(void) {
     return engine()._thread_pool.submit<syscall_result_extra<size_t>>([this] {
@@ -738,6 +910,10 @@ int reactor::run() {
         });
     });
 
+    // Runs after the tasks ready in this iteration, so responses to all
+    // requests processed by them are flushed together.
+    poller flush_batch_poller([this] { return flush_pending_batch(); });
+
     poller drain_cross_cpu_freelist([] {
         return memory::drain_cross_cpu_freelist();
     });
@@ -922,10 +1098,11 @@ reactor_backend_epoll::wait_and_process() {
     for (int i = 0; i < nr; ++i) {
         auto& evt = eevt[i];
         auto pfd = reinterpret_cast<pollable_fd_state*>(evt.data.ptr);
-        auto events = evt.events & (EPOLLIN | EPOLLOUT);
-        auto events_to_remove = events & ~pfd->events_requested;
+        auto events = evt.events & (EPOLLIN | EPOLLOUT | EPOLLERR);
+        auto events_to_remove = events & pfd->events_epoll & ~pfd->events_requested;
         complete_epoll_event(*pfd, &pollable_fd_state::pollin, events, EPOLLIN);
         complete_epoll_event(*pfd, &pollable_fd_state::pollout, events, EPOLLOUT);
+        complete_epoll_event(*pfd, &pollable_fd_state::pollerr, events, EPOLLERR);
         if (events_to_remove) {
             pfd->events_epoll &= ~events_to_remove;
             evt.events = pfd->events_epoll;
@@ -957,6 +1134,8 @@ void syscall_work_queue::complete() {
     _queue_has_room.signal(nr);
 }
 
+constexpr size_t smp_message_queue::batch_size;
+
 smp_message_queue::smp_message_queue()
     : _pending()
     , _completed()
@@ -976,19 +1155,68 @@ void smp_message_queue::move_pending() {
     _current_queue_length += nr;
     _last_snt_batch = nr;
     _sent += nr;
+    smp::_poll_state[_receiver].incoming.set(_sender);
+}
+
+// With few messages in flight the receiver is likely idle and waiting, so
+// send right away; as the queue fills up, amortize the ring and notification
+// cost over bigger batches.
+size_t smp_message_queue::request_batch_size() const {
+    return std::min(std::max<size_t>(_current_queue_length / 2, 1), batch_size);
+}
+
+size_t smp_message_queue::response_batch_size() const {
+    return std::min(std::max<size_t>((_received - _responded) / 2, 1), batch_size);
 }
 
 void smp_message_queue::submit_item(smp_message_queue::work_item* item) {
     _tx.a.pending_fifo.push_back(item);
-    if (_tx.a.pending_fifo.size() >= batch_size) {
+    if (_tx.a.pending_fifo.size() >= request_batch_size()) {
         move_pending();
     }
+    if (!_tx.a.pending_fifo.empty() && !_tx.a.flush_queued) {
+        _tx.a.flush_queued = true;
+        smp::_poll_state[_sender].unflushed_requests.push_back(this);
+    }
+}
+
+smp_message_queue::work_item_slot* smp_message_queue::allocate_slot() {
+    auto& a = _tx.a;
+    if (!a.slots) {
+        a.slots.reset(new work_item_slot[nr_slots]);
+        a.free_slots.reserve(nr_slots);
+        for (size_t i = 0; i < nr_slots; ++i) {
+            a.free_slots.push_back(&a.slots[nr_slots - 1 - i]);
+        }
+    }
+    if (a.free_slots.empty()) {
+        return nullptr;
+    }
+    auto slot = a.free_slots.back();
+    a.free_slots.pop_back();
+    return slot;
+}
+
+void smp_message_queue::release_item(work_item* item) {
+    auto& a = _tx.a;
+    auto p = reinterpret_cast<work_item_slot*>(item);
+    if (a.slots && p >= a.slots.get() && p < a.slots.get() + nr_slots) {
+        item->~work_item();
+        a.free_slots.push_back(p);
+    } else {
+        delete item;
+    }
 }
 
 void smp_message_queue::respond(work_item* item) {
     _completed_fifo.push_back(item);
-    if (_completed_fifo.size() >= batch_size || engine()._stopped) {
+    auto batch = response_batch_size();
+    ++_responded;
+    if (_completed_fifo.size() >= batch || engine()._stopped) {
         flush_response_batch();
+    } else if (!_response_flush_queued) {
+        _response_flush_queued = true;
+        smp::_poll_state[_receiver].unflushed_responses.push_back(this);
     }
 }
 
@@ -996,6 +1224,7 @@ void smp_message_queue::flush_response_batch() {
     if (!_completed_fifo.empty()) {
         _completed.push(_completed_fifo.begin(), _completed_fifo.end());
         _completed_fifo.clear();
+        smp::_poll_state[_sender].completions.set(_receiver);
     }
 }
 
@@ -1023,9 +1252,9 @@ size_t smp_message_queue::process_queue(lf_queue& q, Func process) {
 }
 
 size_t smp_message_queue::process_completions() {
-    auto nr = process_queue<prefetch_cnt*2>(_completed, [] (work_item* wi) {
+    auto nr = process_queue<prefetch_cnt*2>(_completed, [this] (work_item* wi) {
         wi->complete();
-        delete wi;
+        release_item(wi);
     });
     _current_queue_length -= nr;
     _compl += nr;
@@ -1051,6 +1280,8 @@ size_t smp_message_queue::process_incoming() {
 
 void smp_message_queue::start(unsigned cpuid) {
     _tx.init();
+    _sender = engine().cpu_id();
+    _receiver = cpuid;
     char instance[10];
     std::snprintf(instance, sizeof(instance), "%u-%u", engine().cpu_id(), cpuid);
     _collectd_regs = {
@@ -1236,9 +1467,43 @@ smp::get_options_description()
 
 std::vector<smp::thread_adaptor> smp::_threads;
 smp_message_queue** smp::_qs;
+smp::poll_state* smp::_poll_state;
 std::thread::id smp::_tmain;
 unsigned smp::count = 1;
 
+bool smp::poll_queues() {
+    size_t got = 0;
+    auto& ps = _poll_state[engine().cpu_id()];
+    if (!ps.unflushed_responses.empty()) {
+        std::swap(ps.flushing, ps.unflushed_responses);
+        for (auto q : ps.flushing) {
+            q->_response_flush_queued = false;
+            q->flush_response_batch();
+        }
+        ps.flushing.clear();
+    }
+    ps.incoming.consume([&got] (unsigned sender) {
+        got += _qs[engine().cpu_id()][sender].process_incoming();
+    });
+    if (!ps.unflushed_requests.empty()) {
+        std::swap(ps.flushing, ps.unflushed_requests);
+        for (auto q : ps.flushing) {
+            q->_tx.a.flush_queued = false;
+            q->flush_request_batch();
+            // the ring may have been full; retry on the next poll
+            if (!q->_tx.a.pending_fifo.empty()) {
+                q->_tx.a.flush_queued = true;
+                ps.unflushed_requests.push_back(q);
+            }
+        }
+        ps.flushing.clear();
+    }
+    ps.completions.consume([&got] (unsigned receiver) {
+        got += _qs[receiver][engine().cpu_id()].process_completions();
+    });
+    return got != 0;
+}
+
 void smp::start_all_queues()
 {
     for (unsigned c = 0; c < count; c++) {
@@ -1337,6 +1602,11 @@ void smp::configure(boost::program_options::variables_map configuration)
     for(unsigned i = 0; i < smp::count; i++) {
         smp::_qs[i] = new smp_message_queue[smp::count];
     }
+    smp::_poll_state = new smp::poll_state[smp::count];
+    for (unsigned i = 0; i < smp::count; i++) {
+        smp::_poll_state[i].incoming.resize(smp::count);
+        smp::_poll_state[i].completions.resize(smp::count);
+    }
 
 #ifdef HAVE_DPDK
     dpdk::eal::cpuset cpus;
@@ -1511,6 +1781,24 @@ reactor_backend_osv::writeable(pollable_fd_state& fd) {
     abort();
 }
 
+future<>
+reactor_backend_osv::error_queue_readable(pollable_fd_state& fd) {
+    std::cout << "reactor_backend_osv does not support file descriptors - error_queue_readable() shouldn't have been called!\n";
+    abort();
+}
+
+void
+reactor_backend_osv::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_reader() shouldn't have been called!\n";
+    abort();
+}
+
+void
+reactor_backend_osv::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_writer() shouldn't have been called!\n";
+    abort();
+}
+
 void
 reactor_backend_osv::forget(pollable_fd_state& fd) {
     std::cout << "reactor_backend_osv does not support file descriptors - forget() shouldn't have been called!\n";
@@ -43,6 +43,7 @@
 #include <chrono>
 #include <ratio>
 #include <atomic>
+#include <limits>
 #include <experimental/optional>
 #include <boost/lockfree/spsc_queue.hpp>
 #include <boost/optional.hpp>
@@ -59,6 +60,7 @@
 #include "circular_buffer.hh"
 #include "file.hh"
 #include "semaphore.hh"
+#include "abort_source.hh"
 #include "core/scattered_message.hh"
 
 #ifdef HAVE_OSV
@@ -171,6 +173,7 @@ public:
     int events_known = 0;     // returned from epoll
     promise<> pollin;
     promise<> pollout;
+    promise<> pollerr;
     friend class reactor;
     friend class pollable_fd;
 };
@@ -202,10 +205,19 @@ public:
     future<> write_all(net::packet& p);
     future<> readable();
     future<> writeable();
+    // Resolves when the socket's error queue (MSG_ERRQUEUE) may have
+    // something to read, or a socket error is pending.
+    future<> error_queue_readable();
+    // Like readable()/writeable(), but fail with abort_requested_exception
+    // if as is aborted first.
+    future<> readable(abort_source& as);
+    future<> writeable(abort_source& as);
     future<pollable_fd, socket_address> accept();
     future<size_t> sendmsg(struct msghdr *msg);
     future<size_t> recvmsg(struct msghdr *msg);
     future<size_t> sendto(socket_address addr, const void* buf, size_t len);
+    // Sends len bytes of f, starting at pos, with sendfile().
+    future<> transmit_file(file& f, uint64_t pos, size_t len);
     file_desc& get_file_desc() const { return _s->fd; }
     void close() { _s.reset(); }
 protected:
@@ -222,6 +234,9 @@ public:
     virtual ~connected_socket_impl() {}
     virtual input_stream<char> input() = 0;
     virtual output_stream<char> output() = 0;
+    // The default implementation reads the range and writes it to out;
+    // stacks that can send straight from the file flush out and override it.
+    virtual future<> transmit_file(output_stream<char>& out, file& f, uint64_t pos, size_t len);
 };
 
 class connected_socket {
@@ -231,6 +246,10 @@ public:
         : _csi(std::move(csi)) {}
     input_stream<char> input();
     output_stream<char> output();
+    // Sends len bytes of f, starting at pos, after what was written to out,
+    // an output_stream of this socket that does not batch its flushes.  out
+    // and f must be kept alive until the returned future resolves.
+    future<> transmit_file(output_stream<char>& out, file& f, uint64_t pos, size_t len);
 };
 
 class server_socket_impl {
@@ -403,8 +422,51 @@ private:
     friend class thread_pool;
 };
 
+// Set of peer cpus, written concurrently by the peers and consumed by the
+// owning cpu.  Used to tell a cpu which of its smp queues have work, so
+// that polling does not have to touch every queue.
+class smp_queue_mask {
+    static constexpr unsigned word_bits = std::numeric_limits<uint64_t>::digits;
+    std::unique_ptr<std::atomic<uint64_t>[]> _words;
+    unsigned _nr_words = 0;
+public:
+    void resize(unsigned nr_cpus) {
+        _nr_words = (nr_cpus + word_bits - 1) / word_bits;
+        _words.reset(new std::atomic<uint64_t>[_nr_words]);
+        for (unsigned i = 0; i < _nr_words; ++i) {
+            _words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    // Called by a peer after it pushed to the ring.  Always writes: skipping
+    // the write when the bit looks set could race with consume() and lose
+    // the notification.
+    void set(unsigned cpu) {
+        _words[cpu / word_bits].fetch_or(uint64_t(1) << (cpu % word_bits), std::memory_order_release);
+    }
+    // Clears the set and calls func(cpu) for each cpu that was in it.  Words
+    // with no bits set are only read, so an idle cpu does not bounce cache
+    // lines with its peers.
+    template <typename Func>
+    void consume(Func func) {
+        for (unsigned i = 0; i < _nr_words; ++i) {
+            if (!_words[i].load(std::memory_order_relaxed)) {
+                continue;
+            }
+            auto w = _words[i].exchange(0, std::memory_order_acquire);
+            while (w) {
+                auto bit = __builtin_ctzll(w);
+                w &= w - 1;
+                func(i * word_bits + bit);
+            }
+        }
+    }
+};
+
 class smp_message_queue {
     static constexpr size_t queue_length = 128;
+    // Upper bound for request and response batches; the actual batch size
+    // follows the number of messages in flight, so that a lightly loaded
+    // queue sends each message right away.
     static constexpr size_t batch_size = 16;
     static constexpr size_t prefetch_cnt = 2;
     struct work_item;
@@ -426,8 +488,13 @@ class smp_message_queue {
     std::vector<scollectd::registration> _collectd_regs;
     struct alignas(64) {
         size_t _received = 0;
+        size_t _responded = 0;
         size_t _last_rcv_batch = 0;
+        bool _response_flush_queued = false;
     };
+    // set by start(), read-only afterwards
+    unsigned _sender = 0;
+    unsigned _receiver = 0;
     struct work_item {
         virtual ~work_item() {}
         virtual future<> process() = 0;
@@ -465,12 +532,24 @@ class smp_message_queue {
         }
         Future get_future() { return _promise.get_future(); }
     };
+    // Small work items are constructed in preallocated slots instead of on
+    // the heap.  Slots are owned by the sending cpu: it allocates them in
+    // submit() and releases them after complete(), so no synchronization is
+    // needed.
+    static constexpr size_t slot_size = 128;
+    static constexpr size_t nr_slots = queue_length;
+    struct alignas(64) work_item_slot {
+        char data[slot_size];
+    };
     union tx_side {
         tx_side() {}
         ~tx_side() {}
         void init() { new (&a) aa; }
         struct aa {
             std::deque<work_item*> pending_fifo;
+            bool flush_queued = false;
+            std::unique_ptr<work_item_slot[]> slots;
+            std::vector<work_item_slot*> free_slots;
         } a;
     } _tx;
     std::vector<work_item*> _completed_fifo;
@@ -479,7 +558,22 @@ public:
     template <typename Func>
     std::result_of_t<Func()> submit(Func func) {
         using future = std::result_of_t<Func()>;
-        auto wi = new async_work_item<Func, future>(std::move(func));
+        using item_type = async_work_item<Func, future>;
+        item_type* wi = nullptr;
+        if (sizeof(item_type) <= sizeof(work_item_slot) && alignof(item_type) <= alignof(work_item_slot)) {
+            auto slot = allocate_slot();
+            if (slot) {
+                try {
+                    wi = new (slot) item_type(std::move(func));
+                } catch (...) {
+                    _tx.a.free_slots.push_back(slot);
+                    throw;
+                }
+            }
+        }
+        if (!wi) {
+            wi = new item_type(std::move(func));
+        }
         auto fut = wi->get_future();
         submit_item(wi);
         return fut;
@@ -492,10 +586,14 @@ public:
 private:
     void work();
     void submit_item(work_item* wi);
+    work_item_slot* allocate_slot();
+    void release_item(work_item* wi);
     void respond(work_item* wi);
     void move_pending();
     void flush_request_batch();
     void flush_response_batch();
+    size_t request_batch_size() const;
+    size_t response_batch_size() const;
 
     friend class smp;
 };
@@ -539,6 +637,10 @@ public:
     // they are called (which is fine if no file descriptors are waited on):
     virtual future<> readable(pollable_fd_state& fd) = 0;
     virtual future<> writeable(pollable_fd_state& fd) = 0;
+    virtual future<> error_queue_readable(pollable_fd_state& fd) = 0;
+    // Fail a pending readable()/writeable() future with ex, if any.
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) = 0;
     virtual void forget(pollable_fd_state& fd) = 0;
     // Methods that allow polling on a reactor_notifier. This is currently
     // used only for reactor_backend_osv, but in the future it should really
@@ -559,12 +661,17 @@ private:
             promise<> pollable_fd_state::* pr, int event);
     void complete_epoll_event(pollable_fd_state& fd,
             promise<> pollable_fd_state::* pr, int events, int event);
+    void abort_fd(pollable_fd_state& fd, std::exception_ptr ex,
+            promise<> pollable_fd_state::* pr, int event);
 public:
     reactor_backend_epoll();
     virtual ~reactor_backend_epoll() override { }
     virtual bool wait_and_process() override;
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual future<> error_queue_readable(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
     virtual void forget(pollable_fd_state& fd) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
@@ -587,6 +694,9 @@ public:
     virtual void wait_and_process() override;
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual future<> error_queue_readable(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
     virtual void forget(pollable_fd_state& fd) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
@@ -647,6 +757,8 @@ private:
     io_context_t _io_context;
     semaphore _io_context_available;
     circular_buffer<std::unique_ptr<task>> _pending_tasks;
+    // output streams with a batched flush pending
+    std::vector<output_stream<char>*> _flush_batch;
     circular_buffer<std::unique_ptr<task>> _at_destroy_tasks;
     size_t _task_quota;
     std::unique_ptr<network_stack> _network_stack;
@@ -679,6 +791,7 @@ private:
     std::atomic<uint64_t> _pending_signals;
     std::unordered_map<int, signal_handler> _signal_handlers;
     bool poll_signal();
+    bool flush_pending_batch();
     friend void sigaction(int signo, siginfo_t* siginfo, void* ignore);
 
     thread_pool _thread_pool;
@@ -722,11 +835,15 @@ public:
 
     future<> write_all(pollable_fd_state& fd, const void* buffer, size_t size);
 
+    future<> transmit_file(pollable_fd_state& fd, file& f, uint64_t pos, size_t len);
+
     future<file> open_file_dma(sstring name);
     future<file> open_directory(sstring name);
 
     template <typename Func>
     future<io_event> submit_io(Func prepare_io);
+    template <typename Func>
+    future<io_event> submit_io(Func prepare_io, abort_source& as);
 
     void handle_signal(int signo, std::function<void ()>&& handler);
     void handle_signal_once(int signo, std::function<void ()>&& handler);
@@ -746,6 +863,11 @@ public:
     }
 
     void add_task(std::unique_ptr<task>&& t) { _pending_tasks.push_back(std::move(t)); }
+    void add_to_flush_batch(output_stream<char>* os) { _flush_batch.push_back(os); }
+    // For a stream that moves or goes away while queued; nullptr removes it
+    void replace_in_flush_batch(output_stream<char>* os, output_stream<char>* with) {
+        std::replace(_flush_batch.begin(), _flush_batch.end(), os, with);
+    }
 
     network_stack& net() { return *_network_stack; }
     unsigned cpu_id() const { return _id; }
@@ -772,6 +894,9 @@ private:
     struct collectd_registrations;
     collectd_registrations register_collectd_metrics();
     future<> write_all_part(pollable_fd_state& fd, const void* buffer, size_t size, size_t completed);
+    future<> transmit_file_part(pollable_fd_state& fd, file in, uint64_t pos, size_t len);
+    template <typename Func>
+    future<io_event> submit_io_now(Func& prepare_io);
 
     bool process_io();
 
@@ -805,6 +930,15 @@ public:
     future<> writeable(pollable_fd_state& fd) {
         return _backend.writeable(fd);
     }
+    future<> error_queue_readable(pollable_fd_state& fd) {
+        return _backend.error_queue_readable(fd);
+    }
+    void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+        _backend.abort_reader(fd, std::move(ex));
+    }
+    void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+        _backend.abort_writer(fd, std::move(ex));
+    }
     void forget(pollable_fd_state& fd) {
         _backend.forget(fd);
     }
@@ -883,21 +1017,19 @@ public:
             return make_ready_future<>();
         });
     }
-    static bool poll_queues() {
-        size_t got = 0;
-        for (unsigned i = 0; i < count; i++) {
-            if (engine().cpu_id() != i) {
-                auto& rxq = _qs[engine().cpu_id()][i];
-                rxq.flush_response_batch();
-                got += rxq.process_incoming();
-                auto& txq = _qs[i][engine()._id];
-                txq.flush_request_batch();
-                got += txq.process_completions();
-            }
-        }
-        return got != 0;
-    }
+    static bool poll_queues();
 private:
+    // Per-cpu view of the queues that need attention.
+    struct poll_state {
+        smp_queue_mask incoming;        // senders with requests in our rx rings
+        smp_queue_mask completions;     // receivers with responses in our tx rings
+        std::vector<smp_message_queue*> unflushed_requests;
+        std::vector<smp_message_queue*> unflushed_responses;
+        std::vector<smp_message_queue*> flushing;  // scratch for poll_queues()
+    };
+    static poll_state* _poll_state;
+    friend class smp_message_queue;
+
     static void start_all_queues();
     static void pin(unsigned cpu_id);
     static void allocate_reactor();
@@ -914,6 +1046,9 @@ class data_source_impl {
 public:
     virtual ~data_source_impl() {}
     virtual future<temporary_buffer<char>> get() = 0;
+    // Upper bound on the size of buffers returned by get().  Sources that
+    // read into fixed-size buffers ignore it.
+    virtual void set_max_buffer_size(size_t size) {}
 };
 
 class data_source {
@@ -924,6 +1059,7 @@ public:
     explicit data_source(std::unique_ptr<data_source_impl> dsi) : _dsi(std::move(dsi)) {}
     data_source(data_source&& x) = default;
     future<temporary_buffer<char>> get() { return _dsi->get(); }
+    void set_max_buffer_size(size_t size) { _dsi->set_max_buffer_size(size); }
 };
 
 class data_sink_impl {
@@ -982,7 +1118,10 @@ public:
         void operator()(tmp_buf data, Done done);
     };
     using char_type = CharType;
-    explicit input_stream(data_source fd, size_t buf_size = 8192) : _fd(std::move(fd)), _buf(0) {}
+    // buf_size bounds the buffers requested from the data source.
+    explicit input_stream(data_source fd, size_t buf_size = 65536) : _fd(std::move(fd)), _buf(0) {
+        _fd.set_max_buffer_size(buf_size);
+    }
     future<temporary_buffer<CharType>> read_exactly(size_t n);
     template <typename Consumer>
     future<> consume(Consumer& c);
@@ -999,31 +1138,78 @@ private:
 //
 // The data sink will not receive empty chunks.
 //
+// With batch_flushes, flush() only marks the stream for flushing and returns
+// immediately; the reactor flushes all marked streams once it runs out of
+// ready tasks, so that responses to pipelined requests leave in one put().
+// Errors are then reported by the next flush() or close().  close() sends
+// what is still marked, so it must be called, and waited for, before the
+// stream is destroyed if that data matters; a stream destroyed or moved
+// while marked leaves the batch.
+//
 template <typename CharType>
 class output_stream {
     static_assert(sizeof(CharType) == 1, "must buffer stream of bytes");
     data_sink _fd;
     temporary_buffer<CharType> _buf;
+    // Zero-copy packets, interleaved with buffered data preceding them,
+    // waiting to be sent as one scatter-gather packet.  Buffered bytes in
+    // [_begin, _end) follow them.  Disengaged unless write(net::packet) was
+    // used since the last flush; always disengaged for trim_to_size streams.
+    std::experimental::optional<net::packet> _zc_bufs;
     size_t _size;
     size_t _begin = 0;
     size_t _end = 0;
     bool _trim_to_size;
+    bool _batch_flushes;
+    // a flush was requested since the reactor last flushed this stream
+    bool _flush = false;
+    // engaged while the stream is queued for, or undergoing, a batched flush
+    std::experimental::optional<promise<>> _in_batch;
+    // the reactor's flush batch points to this stream
+    bool _queued = false;
+    std::exception_ptr _ex;
+    // serializes puts from write() with the reactor's batched flushes
+    semaphore _put_sem{1};
 private:
     size_t available() const { return _end - _begin; }
     size_t possibly_available() const { return _size - _begin; }
     future<> split_and_put(temporary_buffer<CharType> buf);
+    void append_buffered();
+    future<> put_zc_bufs();
+    future<> write_mixed(const CharType* buf, size_t n);
+    template <typename Data>
+    future<> put(Data data);
+    future<> do_flush();
+    void queue_flush();
+    void poll_flush();
 public:
     using char_type = CharType;
-    output_stream(data_sink fd, size_t size, bool trim_to_size = false)
-        : _fd(std::move(fd)), _size(size), _trim_to_size(trim_to_size) {}
+    output_stream(data_sink fd, size_t size, bool trim_to_size = false, bool batch_flushes = false)
+        : _fd(std::move(fd)), _size(size), _trim_to_size(trim_to_size), _batch_flushes(batch_flushes) {}
+    output_stream(output_stream&& x) noexcept;
+    output_stream& operator=(output_stream&& x) noexcept {
+        if (this != &x) {
+            this->~output_stream();
+            new (this) output_stream(std::move(x));
+        }
+        return *this;
+    }
+    ~output_stream();
     future<> write(const char_type* buf, size_t n);
     future<> write(const char_type* buf);
     future<> write(const sstring& s);
     future<> write(net::packet p);
     future<> write(scattered_message<char_type> msg);
     future<> flush();
-    future<> close() { return _fd.close(); }
+    future<> close();
+    // Switches to batched flushes, see above.  Must be called before the
+    // first flush().
+    void set_batch_flushes(bool batch_flushes) {
+        assert(!_in_batch);
+        _batch_flushes = batch_flushes;
+    }
 private:
+    friend class reactor;
 };
 
 template<typename CharType>
@@ -1043,6 +1229,9 @@ future<> output_stream<CharType>::write(scattered_message<CharType> msg) {
     return write(std::move(msg).release());
 }
 
+// Small zero-copy packets are not sent right away: they are appended, along
+// with any buffered data written before them, to _zc_bufs, which is sent as
+// a single packet on flush() or once it reaches the buffer size.
 template<typename CharType>
 future<> output_stream<CharType>::write(net::packet p) {
     static_assert(std::is_same<CharType, char>::value, "packet works on char");
@@ -1051,19 +1240,88 @@ future<> output_stream<CharType>::write(net::packet p) {
         return make_ready_future<>();
     }
 
-    assert(!_end && "Mixing buffered writes and zero-copy writes not supported yet");
+    if (_trim_to_size) {
+        // Each put() is a datagram of at most _size bytes; keep buffered
+        // data and packets in separate puts.
+        if (_end) {
+            return do_flush().then([this, p = std::move(p)] () mutable {
+                return write(std::move(p));
+            });
+        }
+        if (p.len() <= _size) {
+            return put(std::move(p));
+        }
+        auto head = p.share(0, _size);
+        p.trim_front(_size);
+        return put(std::move(head)).then([this, p = std::move(p)] () mutable {
+            return write(std::move(p));
+        });
+    }
 
-    if (!_trim_to_size || p.len() <= _size) {
-        // TODO: aggregate buffers for later coalescing. Currently we flush right
-        // after appending the message anyway, so it doesn't matter.
-        return _fd.put(std::move(p));
+    append_buffered();
+    if (_zc_bufs) {
+        _zc_bufs->append(std::move(p));
+    } else {
+        _zc_bufs = std::move(p);
     }
+    if (_zc_bufs->len() >= _size) {
+        return put_zc_bufs();
+    }
+    return make_ready_future<>();
+}
 
-    auto head = p.share(0, _size);
-    p.trim_front(_size);
-    return _fd.put(std::move(head)).then([this, p = std::move(p)] () mutable {
-        return write(std::move(p));
-    });
+// Moves buffered bytes not yet in _zc_bufs there, sharing _buf, so that
+// later writes can keep filling the rest of it.
+template <typename CharType>
+void
+output_stream<CharType>::append_buffered() {
+    if (_end > _begin) {
+        auto b = _buf.share(_begin, _end - _begin);
+        net::packet p(net::fragment{b.get_write(), b.size()}, b.release());
+        if (_zc_bufs) {
+            _zc_bufs->append(std::move(p));
+        } else {
+            _zc_bufs = std::move(p);
+        }
+        _begin = _end;
+    }
+}
+
+template <typename CharType>
+future<>
+output_stream<CharType>::put_zc_bufs() {
+    append_buffered();
+    _buf = {};
+    _begin = _end = 0;
+    auto p = std::move(*_zc_bufs);
+    _zc_bufs = {};
+    return put(std::move(p));
+}
+
+// write() while zero-copy packets are pending: copy into _buf, moving
+// full buffers to _zc_bufs, so that ordering is preserved.
+template <typename CharType>
+future<>
+output_stream<CharType>::write_mixed(const char_type* buf, size_t n) {
+    while (n) {
+        if (!_buf) {
+            _buf = temporary_buffer<CharType>(_size);
+            _begin = _end = 0;
+        }
+        auto now = std::min(n, _size - _end);
+        std::copy(buf, buf + now, _buf.get_write() + _end);
+        _end += now;
+        buf += now;
+        n -= now;
+        if (_end == _size) {
+            append_buffered();
+            _buf = {};
+        }
+    }
+    if (_zc_bufs->len() + available() >= _size) {
+        return put_zc_bufs();
+    }
+    return make_ready_future<>();
 }
 
 inline
@@ -1093,14 +1351,19 @@ inline
 future<size_t>
 reactor::read_some(pollable_fd_state& fd, void* buffer, size_t len) {
     return readable(fd).then([this, &fd, buffer, len] () mutable {
-        auto r = fd.fd.read(buffer, len);
-        if (!r) {
-            return read_some(fd, buffer, len);
+        // Not file_desc::read(): read errors (mostly peer resets) are
+        // reported without throwing
+        auto r = ::read(fd.fd.get(), buffer, len);
+        if (r == -1) {
+            if (errno == EAGAIN) {
+                return read_some(fd, buffer, len);
+            }
+            return make_exception_future<size_t>(make_system_error_ptr(errno));
         }
-        if (size_t(*r) == len) {
+        if (size_t(r) == len) {
             fd.speculate_epoll(EPOLLIN);
         }
-        return make_ready_future<size_t>(*r);
+        return make_ready_future<size_t>(r);
     });
 }
 
@@ -1111,14 +1374,17 @@ reactor::read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) {
         ::msghdr mh = {};
         mh.msg_iov = &iov[0];
         mh.msg_iovlen = iov.size();
-        auto r = fd.fd.recvmsg(&mh, 0);
-        if (!r) {
-            return read_some(fd, iov);
+        auto r = ::recvmsg(fd.fd.get(), &mh, 0);
+        if (r == -1) {
+            if (errno == EAGAIN) {
+                return read_some(fd, iov);
+            }
+            return make_exception_future<size_t>(make_system_error_ptr(errno));
         }
-        if (size_t(*r) == iovec_len(iov)) {
+        if (size_t(r) == iovec_len(iov)) {
             fd.speculate_epoll(EPOLLIN);
         }
-        return make_ready_future<size_t>(*r);
+        return make_ready_future<size_t>(r);
     });
 }
 
@@ -1275,7 +1541,7 @@ output_stream<CharType>::split_and_put(temporary_buffer<CharType> buf) {
 
     auto chunk = buf.share(0, _size);
     buf.trim_front(_size);
-    return _fd.put(std::move(chunk)).then([this, buf = std::move(buf)] () mutable {
+    return put(std::move(chunk)).then([this, buf = std::move(buf)] () mutable {
         return split_and_put(std::move(buf));
     });
 }
@@ -1283,6 +1549,9 @@ output_stream<CharType>::split_and_put(temporary_buffer<CharType> buf) {
 template <typename CharType>
 future<>
 output_stream<CharType>::write(const char_type* buf, size_t n) {
+    if (_zc_bufs) {
+        return write_mixed(buf, n);
+    }
     auto bulk_threshold = _end ? (2 * _size - _end) : _size;
     if (n >= bulk_threshold) {
         if (_end) {
@@ -1291,11 +1560,12 @@ output_stream<CharType>::write(const char_type* buf, size_t n) {
             _end = _size;
             temporary_buffer<char> tmp(n - now);
             std::copy(buf + now, buf + n, tmp.get_write());
-            return flush().then([this, tmp = std::move(tmp)]() mutable {
+            // Not flush(): a batched flush would send tmp before _buf
+            return do_flush().then([this, tmp = std::move(tmp)]() mutable {
                 if (_trim_to_size) {
                     return split_and_put(std::move(tmp));
                 } else {
-                    return _fd.put(std::move(tmp));
+                    return put(std::move(tmp));
                 }
             });
         } else {
@@ -1304,7 +1574,7 @@ output_stream<CharType>::write(const char_type* buf, size_t n) {
             if (_trim_to_size) {
                 return split_and_put(std::move(tmp));
             } else {
-                return _fd.put(std::move(tmp));
+                return put(std::move(tmp));
             }
         }
     }
@@ -1323,19 +1593,138 @@ output_stream<CharType>::write(const char_type* buf, size_t n) {
         std::copy(buf + now, buf + n, next.get_write());
         _end = n - now;
         std::swap(next, _buf);
-        return _fd.put(std::move(next));
+        return put(std::move(next));
     }
 }
 
+template <typename CharType>
+template <typename Data>
+future<>
+output_stream<CharType>::put(Data data) {
+    if (!_batch_flushes) {
+        return _fd.put(std::move(data));
+    }
+    return _put_sem.wait().then([this, data = std::move(data)] () mutable {
+        return _fd.put(std::move(data)).finally([this] {
+            _put_sem.signal();
+        });
+    });
+}
+
 template <typename CharType>
 future<>
 output_stream<CharType>::flush() {
+    if (!_batch_flushes) {
+        return do_flush();
+    }
+    if (_ex) {
+        return make_exception_future<>(_ex);
+    }
+    _flush = true;
+    if (!_in_batch) {
+        _in_batch = promise<>();
+        queue_flush();
+    }
+    return make_ready_future<>();
+}
+
+template <typename CharType>
+void
+output_stream<CharType>::queue_flush() {
+    engine().add_to_flush_batch(this);
+    _queued = true;
+}
+
+// Called by the reactor for streams in the flush batch.
+template <typename CharType>
+void
+output_stream<CharType>::poll_flush() {
+    _queued = false;
+    if (!_flush) {
+        // nothing was written since the last batched flush completed
+        auto pr = std::move(*_in_batch);
+        _in_batch = {};
+        pr.set_value();
+        return;
+    }
+    _flush = false;
+    do_flush().then_wrapped([this] (future<> f) {
+        try {
+            f.get();
+        } catch (...) {
+            _ex = std::current_exception();
+        }
+        // flush() may have been called again meanwhile; recheck on the next
+        // batch
+        queue_flush();
+        return make_ready_future<>();
+    });
+}
+
+template <typename CharType>
+output_stream<CharType>::output_stream(output_stream&& x) noexcept
+        : _fd(std::move(x._fd))
+        , _buf(std::move(x._buf))
+        , _zc_bufs(std::move(x._zc_bufs))
+        , _size(x._size)
+        , _begin(x._begin)
+        , _end(x._end)
+        , _trim_to_size(x._trim_to_size)
+        , _batch_flushes(x._batch_flushes)
+        , _flush(x._flush)
+        , _in_batch(std::move(x._in_batch))
+        , _queued(x._queued)
+        , _ex(std::move(x._ex))
+        , _put_sem(std::move(x._put_sem)) {
+    x._in_batch = {};
+    if (_queued) {
+        x._queued = false;
+        engine().replace_in_flush_batch(&x, this);
+    }
+}
+
+template <typename CharType>
+output_stream<CharType>::~output_stream() {
+    if (_queued) {
+        engine().replace_in_flush_batch(this, nullptr);
+    }
+}
+
+template <typename CharType>
+future<>
+output_stream<CharType>::close() {
+    if (!_in_batch) {
+        return _fd.close();
+    }
+    auto flushed = _in_batch->get_future();
+    if (_queued) {
+        // Flush now rather than leave the reactor a pointer to a stream
+        // that may be gone by the time it polls
+        engine().replace_in_flush_batch(this, nullptr);
+        poll_flush();
+    }
+    return std::move(flushed).then([this] {
+        return _fd.close();
+    }).then([this] {
+        if (_ex) {
+            return make_exception_future<>(_ex);
+        }
+        return make_ready_future<>();
+    });
+}
+
+template <typename CharType>
+future<>
+output_stream<CharType>::do_flush() {
+    if (_zc_bufs) {
+        return put_zc_bufs();
+    }
     if (!_end) {
         return make_ready_future<>();
     }
     _buf.trim(_end);
     _end = 0;
-    return _fd.put(std::move(_buf));
+    return put(std::move(_buf));
 }
 
 inline
@@ -1397,6 +1786,11 @@ future<> pollable_fd::write_all(net::packet& p) {
     });
 }
 
+inline
+future<> pollable_fd::transmit_file(file& f, uint64_t pos, size_t len) {
+    return engine().transmit_file(*_s, f, pos, len);
+}
+
 inline
 future<> pollable_fd::readable() {
     return engine().readable(*_s);
@@ -1407,6 +1801,35 @@ future<> pollable_fd::writeable() {
     return engine().writeable(*_s);
 }
 
+inline
+future<> pollable_fd::error_queue_readable() {
+    return engine().error_queue_readable(*_s);
+}
+
+inline
+future<> pollable_fd::readable(abort_source& as) {
+    auto s = _s.get();
+    auto sub = as.subscribe([s] {
+        engine().abort_reader(*s, std::make_exception_ptr(abort_requested_exception()));
+    });
+    if (!sub) {
+        return make_exception_future<>(abort_requested_exception());
+    }
+    return engine().readable(*_s).finally([sub = std::move(sub)] {});
+}
+
+inline
+future<> pollable_fd::writeable(abort_source& as) {
+    auto s = _s.get();
+    auto sub = as.subscribe([s] {
+        engine().abort_writer(*s, std::make_exception_ptr(abort_requested_exception()));
+    });
+    if (!sub) {
+        return make_exception_future<>(abort_requested_exception());
+    }
+    return engine().writeable(*_s).finally([sub = std::move(sub)] {});
+}
+
 inline
 future<pollable_fd, socket_address> pollable_fd::accept() {
     return engine().accept(*_s);
@@ -1560,4 +1983,10 @@ connected_socket::output() {
     return _csi->output();
 }
 
+inline
+future<>
+connected_socket::transmit_file(output_stream<char>& out, file& f, uint64_t pos, size_t len) {
+    return _csi->transmit_file(out, f, pos, len);
+}
+
 #endif /* REACTOR_HH_ */
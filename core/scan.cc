@@ -0,0 +1,85 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#include "scan.hh"
+#include <immintrin.h>
+
+namespace scan {
+
+namespace generic {
+
+const char* find_first_of(const char* p, const char* pe, char a, char b) {
+    while (p != pe && *p != a && *p != b) {
+        ++p;
+    }
+    return p;
+}
+
+}
+
+static const char* find_first_of_sse2(const char* p, const char* pe, char a, char b) {
+    auto va = _mm_set1_epi8(a);
+    auto vb = _mm_set1_epi8(b);
+    while (pe - p >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto eq = _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb));
+        unsigned mask = _mm_movemask_epi8(eq);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return generic::find_first_of(p, pe, a, b);
+}
+
+[[gnu::target("avx2")]]
+static const char* find_first_of_avx2(const char* p, const char* pe, char a, char b) {
+    auto va = _mm256_set1_epi8(a);
+    auto vb = _mm256_set1_epi8(b);
+    while (pe - p >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto eq = _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb));
+        unsigned mask = _mm256_movemask_epi8(eq);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return find_first_of_sse2(p, pe, a, b);
+}
+
+using find_first_of_fn = const char* (*)(const char* p, const char* pe, char a, char b);
+
+static find_first_of_fn select_find_first_of() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return find_first_of_avx2;
+    }
+    return find_first_of_sse2;
+}
+
+static const find_first_of_fn find_first_of_impl = select_find_first_of();
+
+const char* find_first_of(const char* p, const char* pe, char a, char b) {
+    return find_first_of_impl(p, pe, a, b);
+}
+
+}
@@ -0,0 +1,61 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#ifndef SCAN_HH_
+#define SCAN_HH_
+
+#include <cstring>
+
+// Bulk delimiter scanning, for parsers that would otherwise examine long
+// runs of uninteresting bytes one at a time.
+namespace scan {
+
+// Returns the first byte in [p, pe) equal to c, or pe.
+inline
+const char* find(const char* p, const char* pe, char c) {
+    auto r = std::memchr(p, c, pe - p);
+    return r ? static_cast<const char*>(r) : pe;
+}
+
+// Returns the first byte in [p, pe) equal to a or b, or pe.  Uses AVX2
+// when the cpu has it, and SSE2 otherwise.
+const char* find_first_of(const char* p, const char* pe, char a, char b);
+
+inline
+char* find(char* p, char* pe, char c) {
+    return const_cast<char*>(find(const_cast<const char*>(p), pe, c));
+}
+
+inline
+char* find_first_of(char* p, char* pe, char a, char b) {
+    return const_cast<char*>(find_first_of(const_cast<const char*>(p), pe, a, b));
+}
+
+namespace generic {
+
+// Byte-at-a-time versions, for testing and benchmarking.
+const char* find_first_of(const char* p, const char* pe, char a, char b);
+
+}
+
+}
+
+#endif /* SCAN_HH_ */
@@ -24,7 +24,9 @@
 
 #include "future.hh"
 #include "circular_buffer.hh"
+#include "abort_source.hh"
 #include <stdexcept>
+#include <memory>
 
 class broken_semaphore : public std::exception {
 public:
@@ -35,8 +37,24 @@ public:
 
 class semaphore {
 private:
+    // A waiter that can be aborted lives on the heap, so that the abort
+    // callback can find it while the wait list moves entries around.
+    struct abortable_waiter {
+        promise<> pr;
+        bool aborted = false;
+        std::experimental::optional<abort_source::subscription> sub;
+    };
+    struct entry {
+        promise<> pr;
+        size_t nr;
+        std::unique_ptr<abortable_waiter> aw;
+        entry(promise<>&& pr, size_t nr) : pr(std::move(pr)), nr(nr) {}
+        entry(std::unique_ptr<abortable_waiter> aw, size_t nr) : nr(nr), aw(std::move(aw)) {}
+        bool aborted() const { return aw && aw->aborted; }
+        promise<>& get_promise() { return aw ? aw->pr : pr; }
+    };
     size_t _count;
-    circular_buffer<std::pair<promise<>, size_t>> _wait_list;
+    circular_buffer<entry> _wait_list;
 public:
     semaphore(size_t count = 1) : _count(count) {}
     future<> wait(size_t nr = 1) {
@@ -46,15 +64,45 @@ public:
         }
         promise<> pr;
         auto fut = pr.get_future();
-        _wait_list.push_back({ std::move(pr), nr });
+        _wait_list.push_back(entry(std::move(pr), nr));
+        return fut;
+    }
+    // Like wait(), but fails with abort_requested_exception if as is
+    // aborted before the units are available.  An aborted waiter consumes
+    // no units.
+    future<> wait(abort_source& as, size_t nr = 1) {
+        if (_count >= nr && _wait_list.empty()) {
+            _count -= nr;
+            return make_ready_future<>();
+        }
+        auto aw = std::make_unique<abortable_waiter>();
+        auto w = aw.get();
+        w->sub = as.subscribe([this, w] {
+            w->aborted = true;
+            w->pr.set_exception(abort_requested_exception());
+            // waiters behind us may be satisfiable now
+            signal(0);
+        });
+        if (!w->sub) {
+            return make_exception_future<>(abort_requested_exception());
+        }
+        auto fut = w->pr.get_future();
+        _wait_list.push_back(entry(std::move(aw), nr));
         return fut;
     }
     void signal(size_t nr = 1) {
         _count += nr;
-        while (!_wait_list.empty() && _wait_list.front().second <= _count) {
+        while (!_wait_list.empty()) {
             auto& x = _wait_list.front();
-            _count -= x.second;
-            x.first.set_value();
+            if (x.aborted()) {
+                _wait_list.pop_front();
+                continue;
+            }
+            if (x.nr > _count) {
+                break;
+            }
+            _count -= x.nr;
+            x.get_promise().set_value();
             _wait_list.pop_front();
         }
     }
@@ -73,7 +121,7 @@ public:
     //
     // This may only be used once per semaphore; after using it the
     // semaphore is in an indeterminite state and should not be waited on.
-    void broken() { broken(broken_semaphore()); }
+    void broken() { broken(static_exception_ptr<broken_semaphore>()); }
 
     // Signal to waiters that an error occured.  wait() will see
     // an exceptional future<> containing the provided exception parameter.
@@ -82,14 +130,24 @@ public:
     // semaphore is in an indeterminite state and should not be waited on.
     template <typename Exception>
     void broken(const Exception& ex);
+
+    // Like broken(const Exception&), for an exception that has already
+    // been captured (or preallocated, see static_exception_ptr()).
+    void broken(std::exception_ptr ex);
 };
 
 template <typename Exception>
 void semaphore::broken(const Exception& ex) {
-    auto xp = std::make_exception_ptr(ex);
+    broken(std::make_exception_ptr(ex));
+}
+
+inline
+void semaphore::broken(std::exception_ptr xp) {
     while (!_wait_list.empty()) {
         auto& x = _wait_list.front();
-        x.first.set_exception(xp);
+        if (!x.aborted()) {
+            x.get_promise().set_exception(xp);
+        }
         _wait_list.pop_front();
     }
 }
@@ -0,0 +1,138 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#ifndef CORE_THREAD_HH_
+#define CORE_THREAD_HH_
+
+#include "future.hh"
+#include "future-util.hh"
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <setjmp.h>
+#include <ucontext.h>
+
+// seastar::thread: a stackful, cooperatively scheduled thread of execution
+// running on the reactor's cpu.
+//
+// Code running in a seastar::thread may call future::get() on a future that
+// is not yet available; the thread is suspended and control returns to the
+// reactor until the future resolves.  This allows long chains of
+// continuations to be written as straight-line code, paying for one context
+// switch per actual wait instead of a task and a promise per step.
+//
+// A thread starts running immediately when constructed, and runs until it
+// blocks for the first time.  join() must be called, and the returned future
+// waited for, before the thread object is destroyed.
+//
+// Threads are not preempted; code that does not block holds the cpu.
+
+namespace seastar {
+
+namespace thread_impl {
+
+struct jmp_buf_link {
+    jmp_buf jmpbuf;
+    jmp_buf_link* link;
+    thread_context* thread;
+};
+
+}
+
+class thread_context {
+    static constexpr const size_t _stack_size = 128*1024;
+    std::unique_ptr<char[]> _stack{new char[_stack_size]};
+    std::function<void ()> _func;
+    thread_impl::jmp_buf_link _context;
+    promise<> _done;
+    bool _joined = false;
+private:
+    static void s_main(unsigned int lo, unsigned int hi);
+    void setup();
+    void main();
+public:
+    thread_context(std::function<void ()> func);
+    void switch_in();
+    void switch_out();
+    friend class thread;
+};
+
+class thread {
+    std::unique_ptr<thread_context> _context;
+public:
+    thread() = default;
+    // Starts func in a new thread; returns when the thread first blocks or
+    // completes.
+    template <typename Func,
+              typename = std::enable_if_t<!std::is_same<std::decay_t<Func>, thread>::value>>
+    thread(Func func);
+    thread(thread&& x) noexcept = default;
+    thread& operator=(thread&& x) noexcept = default;
+    ~thread() { assert(!_context || _context->_joined); }
+    // Returns a future that resolves when the thread completes, failing if
+    // the thread function threw.
+    future<> join();
+};
+
+template <typename Func, typename>
+inline
+thread::thread(Func func)
+        : _context(std::make_unique<thread_context>(std::move(func))) {
+}
+
+inline
+future<>
+thread::join() {
+    _context->_joined = true;
+    return _context->_done.get_future();
+}
+
+// Runs func(args...) in a seastar::thread, returning its result as a future.
+//
+// The thread, and the copies of func and args, live until the result is
+// available.
+template <typename Func, typename... Args>
+inline
+futurize_t<std::result_of_t<std::decay_t<Func>(std::decay_t<Args>...)>>
+async(Func&& func, Args&&... args) {
+    using return_type = std::result_of_t<std::decay_t<Func>(std::decay_t<Args>...)>;
+    struct work {
+        std::decay_t<Func> func;
+        std::tuple<std::decay_t<Args>...> args;
+        typename futurize<return_type>::promise_type pr;
+        thread th;
+        work(Func&& func, Args&&... args)
+            : func(std::forward<Func>(func)), args(std::forward<Args>(args)...) {}
+    };
+    auto w = std::make_unique<work>(std::forward<Func>(func), std::forward<Args>(args)...);
+    auto& wr = *w;
+    auto ret = wr.pr.get_future();
+    wr.th = thread([&wr] {
+        futurize<return_type>::apply(std::move(wr.func), std::move(wr.args)).forward_to(std::move(wr.pr));
+    });
+    return wr.th.join().then([w = std::move(w), ret = std::move(ret)] () mutable {
+        return std::move(ret);
+    });
+}
+
+}
+
+#endif /* CORE_THREAD_HH_ */
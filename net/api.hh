@@ -29,6 +29,7 @@
 #include "net/byteorder.hh"
 #include "net/packet.hh"
 #include "core/print.hh"
+#include "core/sstring.hh"
 #include "core/temporary_buffer.hh"
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -49,6 +50,9 @@ public:
 
 struct listen_options {
     bool reuse_address = false;
+    // Congestion control of accepted connections, by name ("reno", "cubic");
+    // empty for the stack's default
+    sstring congestion_control;
 };
 
 struct ipv4_addr {
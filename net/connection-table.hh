@@ -0,0 +1,172 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+#ifndef NET_CONNECTION_TABLE_HH
+#define NET_CONNECTION_TABLE_HH
+
+#include "core/prefetch.hh"
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+
+namespace net {
+
+// Maps connection identifiers to their state with open addressing: the
+// key, its hash and the value sit together in one flat array, so finding
+// a connection usually costs a single cache miss, which callers can
+// start early with prefetch().
+//
+// Collisions are resolved by linear probing, and erase() shifts the rest
+// of the probe sequence back instead of leaving tombstones.  Inserting or
+// erasing may move every entry, so pointers returned by find() only live
+// until the next modification, and for_each() must not modify the table.
+template <typename Key, typename Value, typename Hash>
+class connection_table {
+    struct slot {
+        // Zero marks a free slot
+        uint32_t hash = 0;
+        Key key;
+        Value value;
+    };
+    static constexpr size_t min_capacity = 64;
+    std::vector<slot> _slots;
+    size_t _mask;
+    size_t _size = 0;
+    Hash _hash_func;
+    // Probe statistics: lookups, slots they examined, and the longest
+    // distance of an entry from its home slot since the last resize (an
+    // upper bound, as erase() does not lower it)
+    uint64_t _lookups = 0;
+    uint64_t _probes = 0;
+    size_t _max_probe = 0;
+public:
+    connection_table() : _slots(min_capacity), _mask(min_capacity - 1) {}
+    size_t size() const { return _size; }
+    bool empty() const { return !_size; }
+    size_t capacity() const { return _slots.size(); }
+    uint64_t lookups() const { return _lookups; }
+    uint64_t probes() const { return _probes; }
+    size_t max_probe_length() const { return _max_probe + 1; }
+
+    Value* find(const Key& key) {
+        auto h = hash(key);
+        _lookups++;
+        for (auto i = h & _mask;; i = (i + 1) & _mask) {
+            _probes++;
+            auto& s = _slots[i];
+            if (!s.hash) {
+                return nullptr;
+            }
+            if (s.hash == h && s.key == key) {
+                return &s.value;
+            }
+        }
+    }
+    // Starts loading the slot a lookup of key will examine first
+    void prefetch(const Key& key) const {
+        ::prefetch(&_slots[hash(key) & _mask]);
+    }
+    // Does nothing and returns false if key is already present
+    bool insert(const Key& key, Value value) {
+        if ((_size + 1) * 2 > _slots.size()) {
+            resize(_slots.size() * 2);
+        }
+        auto h = hash(key);
+        size_t distance = 0;
+        auto i = h & _mask;
+        for (; _slots[i].hash; i = (i + 1) & _mask, ++distance) {
+            if (_slots[i].hash == h && _slots[i].key == key) {
+                return false;
+            }
+        }
+        place(i, h, key, std::move(value), distance);
+        return true;
+    }
+    bool erase(const Key& key) {
+        auto h = hash(key);
+        auto i = h & _mask;
+        for (; _slots[i].hash; i = (i + 1) & _mask) {
+            if (_slots[i].hash == h && _slots[i].key == key) {
+                break;
+            }
+        }
+        if (!_slots[i].hash) {
+            return false;
+        }
+        // Move back any later entry of the probe sequence whose home slot
+        // does not lie between the hole and itself
+        for (auto j = (i + 1) & _mask; _slots[j].hash; j = (j + 1) & _mask) {
+            auto home = _slots[j].hash & _mask;
+            if (((j - home) & _mask) >= ((j - i) & _mask)) {
+                _slots[i] = std::move(_slots[j]);
+                i = j;
+            }
+        }
+        _slots[i] = slot();
+        --_size;
+        if (_size * 8 < _slots.size() && _slots.size() > min_capacity) {
+            resize(_slots.size() / 2);
+        }
+        return true;
+    }
+    template <typename Func>
+    void for_each(Func func) {
+        for (auto&& s : _slots) {
+            if (s.hash) {
+                func(s.key, s.value);
+            }
+        }
+    }
+private:
+    uint32_t hash(const Key& key) const {
+        uint32_t h = _hash_func(key);
+        return h ? h : 1;
+    }
+    void place(size_t i, uint32_t h, const Key& key, Value value, size_t distance) {
+        auto& s = _slots[i];
+        s.hash = h;
+        s.key = key;
+        s.value = std::move(value);
+        ++_size;
+        _max_probe = std::max(_max_probe, distance);
+    }
+    void resize(size_t capacity) {
+        auto old = std::move(_slots);
+        _slots = std::vector<slot>(capacity);
+        _mask = capacity - 1;
+        _size = 0;
+        _max_probe = 0;
+        for (auto&& s : old) {
+            if (s.hash) {
+                size_t distance = 0;
+                auto i = s.hash & _mask;
+                for (; _slots[i].hash; i = (i + 1) & _mask) {
+                    ++distance;
+                }
+                place(i, s.hash, s.key, std::move(s.value), distance);
+            }
+        }
+    }
+};
+
+}
+
+#endif
@@ -1048,6 +1048,8 @@ private:
     uint8_t _qid;
     rte_mempool *_pktmbuf_pool_rx;
     std::vector<rte_mbuf*> _rx_free_pkts;
+    // Frames of the current rx poll, delivered together
+    std::vector<packet> _rx_burst;
     std::vector<rte_mbuf*> _rx_free_bufs;
     size_t _num_rx_free_segs = 0;
     reactor::poller _rx_gc_poller;
@@ -1545,8 +1547,9 @@ void dpdk_qp<HugetlbfsMemBackend>::process_packets(
             p.set_rss_hash(rte_mbuf_rss_hash(m));
         }
 
-        _dev->l2receive(std::move(p));
+        _rx_burst.push_back(std::move(p));
     }
+    _dev->l2receive(_rx_burst);
 }
 
 template <bool HugetlbfsMemBackend>
@@ -0,0 +1,252 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+#include "gro.hh"
+#include "ip.hh"
+#include "tcp.hh"
+#include "ip_checksum.hh"
+#include <algorithm>
+#include <cstring>
+
+namespace net {
+
+namespace {
+
+// The headers of a TCP/IPv4 segment
+struct gro_segment {
+    eth_hdr* eh;
+    ip_hdr* iph;
+    tcp_hdr* th;
+    size_t hdr_len;
+    size_t payload_len;
+};
+
+enum class gro_kind {
+    // Not TCP/IPv4, or nothing GRO understands
+    other,
+    // TCP that cannot be merged, such as a pure ACK or a FIN
+    control,
+    // Acknowledged data, maybe pushed
+    data,
+};
+
+// A segment, and those merged into it so far
+struct gro_flow {
+    // Index of the frame in the burst
+    size_t idx;
+    ipv4_address src_ip;
+    ipv4_address dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    tcp_seq next_seq;
+    // Payload of the first segment; a larger one ends the run, a smaller
+    // one is its last
+    size_t seg_size;
+    // Checksums of the first segment were checked
+    bool verified;
+};
+
+// Flows merged at the same time; older ones are flushed beyond that
+constexpr size_t max_gro_flows = 8;
+
+gro_kind parse_segment(packet& p, gro_segment& s) {
+    constexpr size_t min_hdr_len = sizeof(eth_hdr) + sizeof(ip_hdr) + sizeof(tcp_hdr);
+    auto hdr = p.get_header(0, min_hdr_len);
+    if (!hdr) {
+        return gro_kind::other;
+    }
+    auto eh = reinterpret_cast<eth_hdr*>(hdr);
+    auto iph = reinterpret_cast<ip_hdr*>(hdr + sizeof(eth_hdr));
+    auto th = reinterpret_cast<tcp_hdr*>(hdr + sizeof(eth_hdr) + sizeof(ip_hdr));
+    // Only IPv4 without options, and not fragmented
+    if (ntoh(eh->eth_proto) != uint16_t(eth_protocol_num::ipv4)
+            || iph->ver != 4 || iph->ihl != sizeof(ip_hdr) / 4
+            || iph->ip_proto != uint8_t(ip_protocol_num::tcp)) {
+        return gro_kind::other;
+    }
+    auto ip = ntoh(*iph);
+    size_t tcp_hdr_len = th->data_offset * 4;
+    if (ip.mf() || ip.offset()
+            || tcp_hdr_len < sizeof(tcp_hdr)
+            || ip.len < sizeof(ip_hdr) + tcp_hdr_len
+            || sizeof(eth_hdr) + ip.len > p.len()) {
+        return gro_kind::other;
+    }
+    s.hdr_len = sizeof(eth_hdr) + sizeof(ip_hdr) + tcp_hdr_len;
+    s.payload_len = ip.len - sizeof(ip_hdr) - tcp_hdr_len;
+    // The options have to be contiguous too
+    hdr = p.get_header(0, s.hdr_len);
+    s.eh = reinterpret_cast<eth_hdr*>(hdr);
+    s.iph = reinterpret_cast<ip_hdr*>(hdr + sizeof(eth_hdr));
+    s.th = reinterpret_cast<tcp_hdr*>(hdr + sizeof(eth_hdr) + sizeof(ip_hdr));
+    if (!s.payload_len || !s.th->f_ack
+            || s.th->f_syn || s.th->f_fin || s.th->f_rst || s.th->f_urg) {
+        return gro_kind::control;
+    }
+    return gro_kind::data;
+}
+
+bool in_flow(const gro_flow& f, const gro_segment& s) {
+    return f.src_ip == s.iph->src_ip && f.dst_ip == s.iph->dst_ip
+            && f.src_port == s.th->src_port && f.dst_port == s.th->dst_port;
+}
+
+// Whether b can follow a in one segment: everything but the sequence
+// number, lengths, checksums and PSH must be the same
+bool can_merge(const gro_segment& a, const gro_segment& b) {
+    auto options_len = a.hdr_len - sizeof(eth_hdr) - sizeof(ip_hdr) - sizeof(tcp_hdr);
+    return a.hdr_len == b.hdr_len
+            && !memcmp(a.eh, b.eh, sizeof(eth_hdr))
+            && a.iph->dscp == b.iph->dscp && a.iph->ecn == b.iph->ecn
+            && a.iph->frag == b.iph->frag && a.iph->ttl == b.iph->ttl
+            && a.th->ack == b.th->ack && a.th->window == b.th->window
+            && !memcmp(a.th + 1, b.th + 1, options_len);
+}
+
+void sum_range(checksummer& csum, packet& p, size_t off, size_t len) {
+    for (auto&& f : p.fragments()) {
+        if (!len) {
+            break;
+        }
+        if (off >= f.size) {
+            off -= f.size;
+            continue;
+        }
+        auto n = std::min(len, f.size - off);
+        csum.sum(f.base + off, n);
+        off = 0;
+        len -= n;
+    }
+}
+
+bool checksums_ok(packet& p, const gro_segment& s) {
+    checksummer ip_csum;
+    ip_csum.sum(reinterpret_cast<char*>(s.iph), sizeof(ip_hdr));
+    if (ip_csum.get() != 0) {
+        return false;
+    }
+    auto tcp_len = s.hdr_len - sizeof(eth_hdr) - sizeof(ip_hdr) + s.payload_len;
+    checksummer csum;
+    ipv4_traits::tcp_pseudo_header_checksum(csum, ntoh(s.iph->src_ip), ntoh(s.iph->dst_ip), tcp_len);
+    sum_range(csum, p, sizeof(eth_hdr) + sizeof(ip_hdr), tcp_len);
+    return csum.get() == 0;
+}
+
+// Appends the payload of p to the frame f started; false if it does not
+// belong there
+bool merge(gro_flow& f, packet& head, packet& p, const gro_segment& s, const hw_features& hw) {
+    gro_segment h;
+    parse_segment(head, h);
+    tcp_seq seq = s.th->seq;
+    if (ntoh(seq) != f.next_seq || s.payload_len > f.seg_size
+            || h.hdr_len - sizeof(eth_hdr) + h.payload_len + s.payload_len > ip_packet_len_max
+            || !can_merge(h, s)) {
+        return false;
+    }
+    if (!hw.rx_csum_offload) {
+        // The stack cannot check the merged segment; check its parts
+        if (!f.verified && !checksums_ok(head, h)) {
+            return false;
+        }
+        f.verified = true;
+        if (!checksums_ok(p, s)) {
+            return false;
+        }
+    }
+    bool push = s.th->f_psh;
+    auto len = s.payload_len;
+    // Drop Ethernet padding, then chain the payload
+    if (head.len() > h.hdr_len + h.payload_len) {
+        head.trim_back(head.len() - h.hdr_len - h.payload_len);
+    }
+    p.trim_front(s.hdr_len);
+    p.trim_back(p.len() - len);
+    head.append(std::move(p));
+    f.next_seq += len;
+
+    // Appending may have moved the headers
+    auto hdr = head.get_header(0, h.hdr_len);
+    auto iph = reinterpret_cast<ip_hdr*>(hdr + sizeof(eth_hdr));
+    auto th = reinterpret_cast<tcp_hdr*>(hdr + sizeof(eth_hdr) + sizeof(ip_hdr));
+    iph->len = hton(uint16_t(ntoh(iph->len) + len));
+    if (!hw.rx_csum_offload) {
+        iph->csum = 0;
+        checksummer ip_csum;
+        ip_csum.sum(reinterpret_cast<char*>(iph), sizeof(ip_hdr));
+        iph->csum = ip_csum.get();
+    }
+    th->f_psh |= push;
+    head.offload_info_ref().csum_verified = true;
+    return true;
+}
+
+}
+
+void tcp_gro_merge(std::vector<packet>& burst, const hw_features& hw) {
+    std::array<gro_flow, max_gro_flows> flows;
+    size_t nr_flows = 0;
+    auto close_flow = [&] (gro_flow* f) {
+        std::copy(f + 1, flows.begin() + nr_flows, f);
+        --nr_flows;
+    };
+    // Frames keep their place, or move forward over those merged into an
+    // earlier one
+    size_t out = 0;
+    for (size_t in = 0; in < burst.size(); ++in) {
+        auto& p = burst[in];
+        gro_segment s;
+        auto kind = parse_segment(p, s);
+        if (kind != gro_kind::other) {
+            auto f = std::find_if(flows.begin(), flows.begin() + nr_flows, [&s] (const gro_flow& f) {
+                return in_flow(f, s);
+            });
+            if (f != flows.begin() + nr_flows) {
+                if (kind == gro_kind::data) {
+                    bool last = s.th->f_psh || s.payload_len < f->seg_size;
+                    if (merge(*f, burst[f->idx], p, s, hw)) {
+                        if (last) {
+                            close_flow(f);
+                        }
+                        continue;
+                    }
+                }
+                // Nothing later in the flow may get ahead of this frame
+                close_flow(f);
+            }
+            if (kind == gro_kind::data && !s.th->f_psh) {
+                if (nr_flows == max_gro_flows) {
+                    close_flow(flows.begin());
+                }
+                flows[nr_flows++] = gro_flow{out, s.iph->src_ip, s.iph->dst_ip,
+                        s.th->src_port, s.th->dst_port,
+                        ntoh(tcp_seq(s.th->seq)) + int32_t(s.payload_len),
+                        s.payload_len, false};
+            }
+        }
+        if (out != in) {
+            burst[out] = std::move(p);
+        }
+        ++out;
+    }
+    burst.resize(out);
+}
+
+}
@@ -0,0 +1,45 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+// Generic receive offload: consecutive TCP segments of a flow merged in
+// software before the stack processes them.
+
+#ifndef NET_GRO_HH
+#define NET_GRO_HH
+
+#include "net.hh"
+#include "packet.hh"
+#include <vector>
+
+namespace net {
+
+// Merges in-order TCP/IPv4 segments of the same flow in a burst of
+// received Ethernet frames into the first of them, chaining their
+// payloads without copying.  A merged frame looks like one large segment
+// to the stack; its IP header is rewritten, its TCP checksum left stale
+// and offload_info::csum_verified set instead, as every segment's
+// checksum was checked here unless hw already did.  Frames that cannot
+// be merged keep their order relative to the rest of their flow.
+void tcp_gro_merge(std::vector<packet>& burst, const hw_features& hw);
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+#include "gso.hh"
+#include "ip.hh"
+#include "tcp.hh"
+#include "ip_checksum.hh"
+#include <algorithm>
+#include <cstring>
+
+namespace net {
+
+void tcp_gso_segment(packet p, const hw_features& hw, circular_buffer<packet>& out) {
+    auto oi = p.offload_info();
+    size_t l4_off = sizeof(eth_hdr) + oi.ip_hdr_len;
+    size_t hdr_len = l4_off + oi.tcp_hdr_len;
+    size_t mss = oi.tso_seg_size;
+    auto hdr = p.get_header(0, hdr_len);
+    if (!hdr) {
+        return;
+    }
+    // Kept aside, as sharing the packet may move its headers
+    char template_hdr[sizeof(eth_hdr) + 2 * 60];
+    std::copy(hdr, hdr + hdr_len, template_hdr);
+    auto ip = ntoh(*reinterpret_cast<ip_hdr*>(template_hdr + sizeof(eth_hdr)));
+    auto th = ntoh(*reinterpret_cast<tcp_hdr*>(template_hdr + l4_off));
+    size_t payload_len = p.len() - hdr_len;
+
+    auto seg_oi = oi;
+    seg_oi.tso_seg_size = 0;
+    seg_oi.needs_csum = hw.tx_csum_l4_offload;
+    uint16_t id = ip.id;
+    for (size_t off = 0; off < payload_len; off += mss, ++id) {
+        auto len = std::min(mss, payload_len - off);
+        bool last = off + len == payload_len;
+        auto seg = p.share(hdr_len + off, len);
+
+        // The replicated headers go in the headroom of the new packet
+        auto h = seg.prepend_uninitialized_header(hdr_len);
+        std::copy(template_hdr, template_hdr + hdr_len, h);
+
+        auto tcp_len = oi.tcp_hdr_len + len;
+        auto seg_th = th;
+        tcp_seq seq = th.seq;
+        seg_th.seq = seq + int32_t(off);
+        // Only the last segment finishes what the super-segment did
+        seg_th.f_fin &= last;
+        seg_th.f_psh &= last;
+        seg_th.checksum = 0;
+        auto seg_tcp = reinterpret_cast<tcp_hdr*>(h + l4_off);
+        *seg_tcp = hton(seg_th);
+        checksummer csum;
+        ipv4_traits::tcp_pseudo_header_checksum(csum, ip.src_ip, ip.dst_ip, tcp_len);
+        if (hw.tx_csum_l4_offload) {
+            seg_tcp->checksum = ~csum.get();
+        } else {
+            size_t skip = l4_off;
+            for (auto&& f : seg.fragments()) {
+                if (skip >= f.size) {
+                    skip -= f.size;
+                    continue;
+                }
+                csum.sum(f.base + skip, f.size - skip);
+                skip = 0;
+            }
+            seg_tcp->checksum = csum.get();
+        }
+
+        auto seg_ip = reinterpret_cast<ip_hdr*>(h + sizeof(eth_hdr));
+        seg_ip->len = hton(uint16_t(oi.ip_hdr_len + tcp_len));
+        // ipv4::send() reserved an id for each segment
+        seg_ip->id = hton(id);
+        seg_ip->csum = 0;
+        if (!hw.tx_csum_ip_offload) {
+            checksummer ip_csum;
+            ip_csum.sum(reinterpret_cast<char*>(seg_ip), oi.ip_hdr_len);
+            seg_ip->csum = ip_csum.get();
+        }
+        seg.set_offload_info(seg_oi);
+        out.push_back(std::move(seg));
+    }
+}
+
+}
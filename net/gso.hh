@@ -0,0 +1,44 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+// Generic segmentation offload: TCP segmentation done in software, for
+// devices that cannot do it themselves.
+
+#ifndef NET_GSO_HH
+#define NET_GSO_HH
+
+#include "net.hh"
+#include "packet.hh"
+#include "core/circular_buffer.hh"
+
+namespace net {
+
+// Splits an Ethernet frame carrying a TCP/IPv4 super-segment, marked by
+// a non zero offload_info::tso_seg_size, into frames carrying at most
+// that much payload each, as a NIC doing TSO would.  The payload is
+// shared, not copied; headers are replicated and their checksums
+// completed, unless hw can still offload them.  Segments take consecutive
+// IP ids, starting with the super-segment's.
+void tcp_gso_segment(packet p, const hw_features& hw, circular_buffer<packet>& out);
+
+}
+
+#endif
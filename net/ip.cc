@@ -52,7 +52,9 @@ ipv4::ipv4(interface* netif)
     , _rx_packets(_l3.receive([this] (packet p, ethernet_address ea) {
         return handle_received_packet(std::move(p), ea); },
       [this] (forward_hash& out_hash_data, packet& p, size_t off) {
-        return forward(out_hash_data, p, off);}))
+        return forward(out_hash_data, p, off);},
+      [this] (packet& p, size_t off) {
+        prefetch(p, off);}))
     , _tcp(*this)
     , _icmp(*this)
     , _udp(*this)
@@ -79,6 +81,20 @@ bool ipv4::forward(forward_hash& out_hash_data, packet& p, size_t off)
     return true;
 }
 
+void ipv4::prefetch(packet& p, size_t off)
+{
+    auto iph = p.get_header<ip_hdr>(off);
+    if (!iph) {
+        return;
+    }
+    auto h = ntoh(*iph);
+    auto l4 = _l4[h.ip_proto];
+    // Fragments are looked up once reassembled
+    if (l4 && h.mf() == false && h.offset() == 0) {
+        l4->prefetch(p, off + h.ihl * 4, h.src_ip, h.dst_ip);
+    }
+}
+
 bool ipv4::in_my_netmask(ipv4_address a) const {
     return !((a.ip ^ _host_address.ip) & _netmask.ip);
 }
@@ -225,15 +241,26 @@ future<ethernet_address> ipv4::get_l2_dst_address(ipv4_address to) {
 void ipv4::send(ipv4_address to, ip_protocol_num proto_num, packet p, ethernet_address e_dst) {
     auto needs_frag = this->needs_frag(p, proto_num, hw_features());
 
-    auto send_pkt = [this, to, proto_num, needs_frag, e_dst] (packet& pkt, uint16_t remaining, uint16_t offset) mutable  {
+    // Fragments share the id of their datagram; a TCP super-segment takes
+    // one id per segment it is cut into, which the segmenting NIC or
+    // tcp_gso_segment() hands out counting up from the first
+    auto id = _ip_id;
+    auto& oi = p.offload_info_ref();
+    if (oi.tso_seg_size) {
+        auto payload_len = p.len() - oi.tcp_hdr_len;
+        _ip_id += (payload_len + oi.tso_seg_size - 1) / oi.tso_seg_size;
+    } else {
+        _ip_id++;
+    }
+
+    auto send_pkt = [this, to, proto_num, needs_frag, e_dst, id] (packet& pkt, uint16_t remaining, uint16_t offset) mutable  {
         auto iph = pkt.prepend_header<ip_hdr>();
         iph->ihl = sizeof(*iph) / 4;
         iph->ver = 4;
         iph->dscp = 0;
         iph->ecn = 0;
         iph->len = pkt.len();
-        // FIXME: a proper id
-        iph->id = 0;
+        iph->id = id;
         if (needs_frag) {
             uint16_t mf = remaining > 0;
             // The fragment offset is measured in units of 8 octets (64 bits)
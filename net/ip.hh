@@ -125,6 +125,9 @@ public:
     virtual ~ip_protocol() {}
     virtual void received(packet p, ipv4_address from, ipv4_address to) = 0;
     virtual bool forward(forward_hash& out_hash_data, packet& p, size_t off) { return true; }
+    // Called on the next datagram of a receive burst, so the protocol can
+    // start loading the state it will need for it
+    virtual void prefetch(packet& p, size_t off, ipv4_address from, ipv4_address to) {}
 };
 
 template <typename InetTraits>
@@ -163,6 +166,7 @@ public:
     ~ipv4_tcp();
     virtual void received(packet p, ipv4_address from, ipv4_address to);
     virtual bool forward(forward_hash& out_hash_data, packet& p, size_t off) override;
+    virtual void prefetch(packet& p, size_t off, ipv4_address from, ipv4_address to) override;
     friend class ipv4;
 };
 
@@ -332,9 +336,12 @@ private:
     timer<lowres_clock> _frag_timer;
     circular_buffer<l3_protocol::l3packet> _packetq;
     unsigned _pkt_provider_idx = 0;
+    // Identification of the next datagram sent
+    uint16_t _ip_id = 0;
 private:
     future<> handle_received_packet(packet p, ethernet_address from);
     bool forward(forward_hash& out_hash_data, packet& p, size_t off);
+    void prefetch(packet& p, size_t off);
     std::experimental::optional<l3_protocol::l3packet> get_packet();
     bool in_my_netmask(ipv4_address a) const;
     void frag_limit_mem();
@@ -23,6 +23,7 @@
 #define NET_NATIVE_STACK_IMPL_HH_
 
 #include "core/reactor.hh"
+#include "net/tcp-congestion.hh"
 
 namespace net {
 
@@ -45,7 +46,9 @@ public:
 
 template <typename Protocol>
 native_server_socket_impl<Protocol>::native_server_socket_impl(Protocol& proto, uint16_t port, listen_options opt)
-    : _listener(proto.listen(port)) {
+    : _listener(opt.congestion_control.empty()
+            ? proto.listen(port)
+            : proto.listen(port, 100, tcp_congestion_algorithm_from_name(opt.congestion_control))) {
 }
 
 template <typename Protocol>
@@ -90,6 +90,8 @@ void create_native_net_device(boost::program_options::variables_map opts) {
 #endif
     dev = create_virtio_net_device(opts);
 
+    dev->set_gro(opts["gro"].as<std::string>() != "off");
+
     auto sem = std::make_shared<semaphore>(0);
     std::shared_ptr<device> sdev(dev.release());
     for (unsigned i = 0; i < smp::count; i++) {
@@ -186,6 +188,9 @@ native_network_stack::native_network_stack(boost::program_options::variables_map
     : _netif(std::move(dev))
     , _inet(&_netif) {
     _inet.get_udp().set_queue_size(opts["udpv4-queue-size"].as<int>());
+    tcpv4_set_rto_min(_inet.get_tcp(), std::chrono::microseconds(opts["tcp-rto-min"].as<unsigned>()));
+    tcpv4_set_congestion_control(_inet.get_tcp(),
+            tcp_congestion_algorithm_from_name(opts["tcp-congestion-control"].as<std::string>()));
     _dhcp = opts["host-ipv4-addr"].defaulted()
             && opts["gw-ipv4-addr"].defaulted()
             && opts["netmask-ipv4-addr"].defaulted() && opts["dhcp"].as<bool>();
@@ -316,6 +321,15 @@ boost::program_options::options_description nns_options() {
         ("udpv4-queue-size",
                 boost::program_options::value<int>()->default_value(ipv4_udp::default_queue_size),
                 "Default size of the UDPv4 per-channel packet queue")
+        ("tcp-rto-min",
+                boost::program_options::value<unsigned>()->default_value(1000000),
+                "Lower bound of the TCP retransmission timeout, in microseconds")
+        ("tcp-congestion-control",
+                boost::program_options::value<std::string>()->default_value("newreno"),
+                "TCP congestion control algorithm (newreno | cubic)")
+        ("gro",
+                boost::program_options::value<std::string>()->default_value("on"),
+                "Merge received TCP segments of a flow before processing them (on / off)")
         ("dhcp",
                 boost::program_options::value<bool>()->default_value(true),
                         "Use DHCP discovery")
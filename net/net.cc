@@ -23,6 +23,8 @@
 #include "net.hh"
 #include <utility>
 #include "toeplitz.hh"
+#include "gso.hh"
+#include "gro.hh"
 
 using std::move;
 
@@ -86,6 +88,13 @@ qp::qp()
                     , "total_operations", "rx-packets")
                     , scollectd::make_typed(scollectd::data_type::DERIVE, _packets_rcv)
             ),
+            // total_operations value:DERIVE:0:U
+            // Received frames merged into an earlier one by GRO.
+            scollectd::add_polled_metric(scollectd::type_instance_id("network"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "rx-packets-merged")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _packets_merged)
+            ),
     }) {
 }
 
@@ -128,8 +137,24 @@ void qp::build_sw_reta(const std::map<unsigned, float>& cpu_weights) {
     _sw_reta = reta;
 }
 
+void device::l2receive(std::vector<packet>& burst) {
+    if (_gro) {
+        auto nr = burst.size();
+        tcp_gro_merge(burst, hw_features());
+        _queues[engine().cpu_id()]->_packets_merged += nr - burst.size();
+    }
+    for (size_t i = 0; i < burst.size(); ++i) {
+        if (i + 1 < burst.size()) {
+            l2prefetch(burst[i + 1]);
+        }
+        l2receive(std::move(burst[i]));
+    }
+    burst.clear();
+}
+
 subscription<packet>
-device::receive(std::function<future<> (packet)> next_packet) {
+device::receive(std::function<future<> (packet)> next_packet, std::function<void (packet&)> prefetch) {
+    _queues[engine().cpu_id()]->_rx_prefetch = std::move(prefetch);
     auto sub = _queues[engine().cpu_id()]->_rx_stream.listen(std::move(next_packet));
     _queues[engine().cpu_id()]->rx_start();
     return std::move(sub);
@@ -149,17 +174,30 @@ l3_protocol::l3_protocol(interface* netif, eth_protocol_num proto_num, packet_pr
 
 subscription<packet, ethernet_address> l3_protocol::receive(
         std::function<future<> (packet p, ethernet_address from)> rx_fn,
-        std::function<bool (forward_hash&, packet&, size_t)> forward) {
-    return _netif->register_l3(_proto_num, std::move(rx_fn), std::move(forward));
+        std::function<bool (forward_hash&, packet&, size_t)> forward,
+        std::function<void (packet&, size_t)> prefetch) {
+    return _netif->register_l3(_proto_num, std::move(rx_fn), std::move(forward), std::move(prefetch));
 };
 
 interface::interface(std::shared_ptr<device> dev)
     : _dev(dev)
-    , _rx(_dev->receive([this] (packet p) { return dispatch_packet(std::move(p)); }))
+    , _rx(_dev->receive([this] (packet p) { return dispatch_packet(std::move(p)); },
+            [this] (packet& p) { prefetch_packet(p); }))
     , _hw_address(_dev->hw_address())
     , _hw_features(_dev->hw_features()) {
+    // Let TCP hand down super-segments regardless, and do the device's
+    // segmentation in software, in one pass, just before the queue
+    if (!_hw_features.tx_tso) {
+        _sw_gso = true;
+        _hw_features.tx_tso = true;
+    }
     dev->local_queue().register_packet_provider([this, idx = 0u] () mutable {
             std::experimental::optional<packet> p;
+            if (!_gso_segments.empty()) {
+                p = std::move(_gso_segments.front());
+                _gso_segments.pop_front();
+                return p;
+            }
             for (size_t i = 0; i < _pkt_providers.size(); i++) {
                 auto l3p = _pkt_providers[idx++]();
                 if (idx == _pkt_providers.size())
@@ -171,6 +209,14 @@ interface::interface(std::shared_ptr<device> dev)
                     eh->src_mac = _hw_address;
                     eh->eth_proto = uint16_t(l3pv.proto_num);
                     *eh = hton(*eh);
+                    if (_sw_gso && l3pv.p.offload_info().tso_seg_size) {
+                        tcp_gso_segment(std::move(l3pv.p), _hw_features, _gso_segments);
+                        if (!_gso_segments.empty()) {
+                            p = std::move(_gso_segments.front());
+                            _gso_segments.pop_front();
+                        }
+                        return p;
+                    }
                     p = std::move(l3pv.p);
                     return p;
                 }
@@ -182,8 +228,10 @@ interface::interface(std::shared_ptr<device> dev)
 subscription<packet, ethernet_address>
 interface::register_l3(eth_protocol_num proto_num,
         std::function<future<> (packet p, ethernet_address from)> next,
-        std::function<bool (forward_hash&, packet& p, size_t)> forward) {
-    auto i = _proto_map.emplace(std::piecewise_construct, std::make_tuple(uint16_t(proto_num)), std::forward_as_tuple(std::move(forward)));
+        std::function<bool (forward_hash&, packet& p, size_t)> forward,
+        std::function<void (packet&, size_t)> prefetch) {
+    auto i = _proto_map.emplace(std::piecewise_construct, std::make_tuple(uint16_t(proto_num)),
+            std::forward_as_tuple(std::move(forward), std::move(prefetch)));
     assert(i.second);
     l3_rx_stream& l3_rx = i.first->second;
     return l3_rx.packet_stream.listen(std::move(next));
@@ -207,6 +255,16 @@ void interface::forward(unsigned cpuid, packet p) {
     }
 }
 
+void interface::prefetch_packet(packet& p) {
+    auto eh = p.get_header<eth_hdr>();
+    if (eh) {
+        auto i = _proto_map.find(ntoh(eh->eth_proto));
+        if (i != _proto_map.end() && i->second.prefetch) {
+            i->second.prefetch(p, sizeof(eth_hdr));
+        }
+    }
+}
+
 future<> interface::dispatch_packet(packet p) {
     auto eh = p.get_header<eth_hdr>();
     if (eh) {
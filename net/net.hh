@@ -96,7 +96,8 @@ public:
     explicit l3_protocol(interface* netif, eth_protocol_num proto_num, packet_provider_type func);
     subscription<packet, ethernet_address> receive(
             std::function<future<> (packet, ethernet_address)> rx_fn,
-            std::function<bool (forward_hash&, packet&, size_t)> forward);
+            std::function<bool (forward_hash&, packet&, size_t)> forward,
+            std::function<void (packet&, size_t)> prefetch = {});
 private:
     friend class interface;
 };
@@ -106,7 +107,9 @@ class interface {
         stream<packet, ethernet_address> packet_stream;
         future<> ready;
         std::function<bool (forward_hash&, packet&, size_t)> forward;
-        l3_rx_stream(std::function<bool (forward_hash&, packet&, size_t)>&& fw) : ready(packet_stream.started()), forward(fw) {}
+        std::function<void (packet&, size_t)> prefetch;
+        l3_rx_stream(std::function<bool (forward_hash&, packet&, size_t)>&& fw, std::function<void (packet&, size_t)>&& pf)
+            : ready(packet_stream.started()), forward(fw), prefetch(pf) {}
     };
     std::unordered_map<uint16_t, l3_rx_stream> _proto_map;
     std::shared_ptr<device> _dev;
@@ -114,15 +117,20 @@ class interface {
     ethernet_address _hw_address;
     net::hw_features _hw_features;
     std::vector<l3_protocol::packet_provider_type> _pkt_providers;
+    // The device cannot do TSO, so TCP super-segments are split here
+    bool _sw_gso = false;
+    circular_buffer<packet> _gso_segments;
 private:
     future<> dispatch_packet(packet p);
+    void prefetch_packet(packet& p);
 public:
     explicit interface(std::shared_ptr<device> dev);
     ethernet_address hw_address() { return _hw_address; }
     const net::hw_features& hw_features() const { return _hw_features; }
     subscription<packet, ethernet_address> register_l3(eth_protocol_num proto_num,
             std::function<future<> (packet p, ethernet_address from)> next,
-            std::function<bool (forward_hash&, packet&, size_t)> forward);
+            std::function<bool (forward_hash&, packet&, size_t)> forward,
+            std::function<void (packet&, size_t)> prefetch);
     void forward(unsigned cpuid, packet p);
     unsigned hash2cpu(uint32_t hash);
     void register_packet_provider(l3_protocol::packet_provider_type func) {
@@ -137,10 +145,12 @@ class qp {
     std::experimental::optional<std::array<uint8_t, 128>> _sw_reta;
     circular_buffer<packet> _proxy_packetq;
     stream<packet> _rx_stream;
+    std::function<void (packet&)> _rx_prefetch;
     reactor::poller _tx_poller;
     circular_buffer<packet> _tx_packetq;
     uint64_t _packets_snt = 0;
     uint64_t _packets_rcv = 0;
+    uint64_t _packets_merged = 0;
     uint64_t _last_tx_bunch = 0;
     uint64_t _last_rx_bunch = 0;
     std::vector<scollectd::registration> _collectd_regs;
@@ -173,6 +183,7 @@ public:
         _pkt_providers.push_back(std::move(func));
     }
     bool poll_tx();
+    uint64_t packets_merged() const { return _packets_merged; }
     friend class device;
 };
 
@@ -180,6 +191,7 @@ class device {
 protected:
     std::unique_ptr<qp*[]> _queues;
     size_t _rss_table_bits = 0;
+    bool _gro = true;
 public:
     device() {
         _queues = std::make_unique<qp*[]>(smp::count);
@@ -188,7 +200,20 @@ public:
     qp& queue_for_cpu(unsigned cpu) { return *_queues[cpu]; }
     qp& local_queue() { return queue_for_cpu(engine().cpu_id()); }
     void l2receive(packet p) { _queues[engine().cpu_id()]->_rx_stream.produce(std::move(p)); }
-    subscription<packet> receive(std::function<future<> (packet)> next_packet);
+    // Delivers what one rx poll received: TCP segments of a flow are
+    // merged first (GRO, see tcp_gro_merge()), and the state each frame
+    // needs is prefetched while the previous one is processed.  Leaves
+    // the burst empty.
+    void l2receive(std::vector<packet>& burst);
+    void l2prefetch(packet& p) {
+        auto& q = *_queues[engine().cpu_id()];
+        if (q._rx_prefetch) {
+            q._rx_prefetch(p);
+        }
+    }
+    void set_gro(bool gro) { _gro = gro; }
+    subscription<packet> receive(std::function<future<> (packet)> next_packet,
+            std::function<void (packet&)> prefetch = {});
     virtual ethernet_address hw_address() = 0;
     virtual net::hw_features hw_features() = 0;
     virtual uint16_t hw_queues_count() { return 1; }
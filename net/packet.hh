@@ -46,6 +46,9 @@ struct offload_info {
     uint8_t udp_hdr_len = 8;
     bool needs_ip_csum = false;
     bool reassembled = false;
+    // Received segment whose L4 checksum was checked before it reached
+    // the stack, as GRO does for those it merges
+    bool csum_verified = false;
     uint16_t tso_seg_size = 0;
     // HW stripped VLAN header (CPU order)
     std::experimental::optional<uint16_t> vlan_tci;
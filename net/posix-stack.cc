@@ -23,16 +23,42 @@
 #include "net.hh"
 #include "packet.hh"
 #include "api.hh"
+#include "core/memory.hh"
+#include <linux/errqueue.h>
+
+// Not yet defined by older kernel and libc headers.
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
 
 namespace net {
 
+// Set from the posix stack's --zerocopy-threshold option.
+static thread_local size_t zerocopy_threshold = 0;
+
 class posix_connected_socket_impl final : public connected_socket_impl {
     pollable_fd _fd;
 private:
     explicit posix_connected_socket_impl(pollable_fd fd) : _fd(std::move(fd)) {}
 public:
     virtual input_stream<char> input() override { return input_stream<char>(posix_data_source(_fd)); }
-    virtual output_stream<char> output() override { return output_stream<char>(posix_data_sink(_fd), 8192); }
+    virtual output_stream<char> output() override {
+        return output_stream<char>(posix_data_sink(_fd, zerocopy_threshold), 8192);
+    }
+    virtual future<> transmit_file(output_stream<char>& out, file& f, uint64_t pos, size_t len) override {
+        return out.flush().then([this, &f, pos, len] {
+            return _fd.transmit_file(f, pos, len);
+        });
+    }
     friend class posix_server_socket_impl;
     friend class posix_ap_server_socket_impl;
     friend class posix_reuseport_server_socket_impl;
@@ -97,18 +123,57 @@ data_source posix_data_source(pollable_fd& fd) {
     return data_source(std::make_unique<posix_data_source_impl>(fd));
 }
 
+constexpr size_t posix_data_source_impl::min_buf_size;
+
+std::unique_ptr<char[], free_deleter>
+posix_data_source_impl::allocate_buffer(size_t size) {
+    auto buf = static_cast<char*>(::malloc(size));
+    if (!buf) {
+        throw std::bad_alloc();
+    }
+    return std::unique_ptr<char[], free_deleter>(buf);
+}
+
+// Hands the first size bytes of _buf to the caller.  If a page or more of
+// it went unused, the tail is returned to the allocator first; large
+// buffers shrink in place, small ones are copied.
+temporary_buffer<char>
+posix_data_source_impl::shrink_to_fit(size_t size) {
+    auto buf = _buf.release();
+    if (size && _buf_size - size >= memory::page_size) {
+        auto shrunk = static_cast<char*>(::realloc(buf, size));
+        if (shrunk) {
+            buf = shrunk;
+        }
+    }
+    return temporary_buffer<char>(buf, size, make_free_deleter(buf));
+}
+
 future<temporary_buffer<char>>
 posix_data_source_impl::get() {
-    return _fd.read_some(_buf.get_write(), _buf_size).then([this] (size_t size) {
-        _buf.trim(size);
-        auto ret = std::move(_buf);
-        _buf = temporary_buffer<char>(_buf_size);
+    return _fd.read_some(_buf.get(), _buf_size).then([this] (size_t size) {
+        auto ret = shrink_to_fit(size);
+        if (size == _buf_size) {
+            _buf_size = std::min(_buf_size * 2, _max_buf_size);
+        } else if (size < _buf_size / 2) {
+            _buf_size = std::max(_buf_size / 2, min_buf_size);
+        }
+        _buf = allocate_buffer(_buf_size);
         return make_ready_future<temporary_buffer<char>>(std::move(ret));
     });
 }
 
-data_sink posix_data_sink(pollable_fd& fd) {
-    return data_sink(std::make_unique<posix_data_sink_impl>(fd));
+void
+posix_data_source_impl::set_max_buffer_size(size_t size) {
+    _max_buf_size = std::max(size, min_buf_size);
+    if (_buf_size > _max_buf_size) {
+        _buf_size = _max_buf_size;
+        _buf = allocate_buffer(_buf_size);
+    }
+}
+
+data_sink posix_data_sink(pollable_fd& fd, size_t zerocopy_threshold) {
+    return data_sink(std::make_unique<posix_data_sink_impl>(fd, zerocopy_threshold));
 }
 
 std::vector<struct iovec> to_iovec(const packet& p) {
@@ -131,15 +196,195 @@ std::vector<iovec> to_iovec(std::vector<temporary_buffer<char>>& buf_vec) {
 
 future<>
 posix_data_sink_impl::put(temporary_buffer<char> buf) {
+    if (auto ex = pending_error()) {
+        return make_exception_future<>(std::move(ex));
+    }
     return _fd.write_all(buf.get(), buf.size()).then([d = buf.release()] {});
 }
 
 future<>
 posix_data_sink_impl::put(packet p) {
+    if (auto ex = pending_error()) {
+        return make_exception_future<>(std::move(ex));
+    }
     _p = std::move(p);
+    if (use_zerocopy(_p.len())) {
+        return send_zerocopy();
+    }
     return _fd.write_all(_p).then([this] { _p.reset(); });
 }
 
+// A socket error found while reaping completions, which would otherwise
+// be lost, as reading SO_ERROR clears it.
+std::exception_ptr
+posix_data_sink_impl::pending_error() {
+    if (!_zc || !_zc->error) {
+        return {};
+    }
+    return make_system_error_ptr(_zc->error);
+}
+
+bool
+posix_data_sink_impl::use_zerocopy(size_t len) {
+    if (!_zerocopy_threshold || len < _zerocopy_threshold) {
+        return false;
+    }
+    if (_zc && _zc->copied) {
+        // The kernel had to copy anyway (e.g. loopback); stop paying for
+        // page pinning and notifications.
+        _zerocopy_threshold = 0;
+        return false;
+    }
+    if (!_zc) {
+        try {
+            _fd.get_file_desc().setsockopt(SOL_SOCKET, SO_ZEROCOPY, 1);
+        } catch (std::system_error& e) {
+            // kernel too old, or not a TCP socket
+            _zerocopy_threshold = 0;
+            return false;
+        }
+        _zc = make_lw_shared<zerocopy_state>(pollable_fd(_fd.get_file_desc().dup()));
+    }
+    return true;
+}
+
+// Sends _p with MSG_ZEROCOPY.  The kernel numbers each successful zero-copy
+// sendmsg() call, so every call records the part of _p it sent under the
+// next id.
+future<>
+posix_data_sink_impl::send_zerocopy() {
+    auto iov = to_iovec(_p);
+    ::msghdr mh = {};
+    mh.msg_iov = iov.data();
+    mh.msg_iovlen = iov.size();
+    boost::optional<size_t> r;
+    try {
+        r = _fd.get_file_desc().sendmsg(&mh, MSG_ZEROCOPY);
+    } catch (std::system_error& e) {
+        if (e.code().value() != ENOBUFS) {
+            throw;
+        }
+        // Out of memory for pinning pages; copy this packet instead.
+        return _fd.write_all(_p).then([this] { _p.reset(); });
+    }
+    if (!r) {
+        return _fd.writeable().then([this] {
+            return send_zerocopy();
+        });
+    }
+    _zc->sends.push_back(zerocopy_send(_p.share(0, *r)));
+    if (!_zc->reaping) {
+        _zc->reaping = true;
+        wait_for_completions(_zc);
+    }
+    if (*r == _p.len()) {
+        _p.reset();
+        return make_ready_future<>();
+    }
+    _p.trim_front(*r);
+    return send_zerocopy();
+}
+
+void
+posix_data_sink_impl::wait_for_completions(lw_shared_ptr<zerocopy_state> zc) {
+    zc->fd.error_queue_readable().then([zc] {
+        reap_completions(*zc);
+        if (!zc->sends.empty()) {
+            wait_for_completions(zc);
+            return;
+        }
+        zc->reaping = false;
+        if (zc->drained) {
+            zc->drained->set_value();
+            zc->drained = {};
+        }
+    });
+}
+
+void
+posix_data_sink_impl::reap_completions(zerocopy_state& zc) {
+    bool reaped = false;
+    while (true) {
+        char control[CMSG_SPACE(sizeof(sock_extended_err))];
+        ::msghdr mh = {};
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        auto r = zc.fd.get_file_desc().recvmsg(&mh, MSG_ERRQUEUE);
+        if (!r) {
+            break;
+        }
+        for (auto cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            auto ee = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zc.copied = true;
+            }
+            complete_zerocopy_sends(zc, ee->ee_info, ee->ee_data);
+            reaped = true;
+        }
+    }
+    if (!reaped) {
+        // EPOLLERR without notifications means a pending socket error,
+        // which would keep waking us up.  Reading it clears it, so keep it
+        // for the next put() or close().
+        int err = 0;
+        zc.fd.get_file_desc().getsockopt(SOL_SOCKET, SO_ERROR, err);
+        if (err && !zc.error) {
+            zc.error = err;
+        }
+    }
+}
+
+void
+posix_data_sink_impl::complete_zerocopy_sends(zerocopy_state& zc, uint32_t first, uint32_t last) {
+    for (uint32_t id = first; id - first <= last - first; ++id) {
+        auto idx = id - zc.first_id;
+        if (idx < zc.sends.size()) {
+            zc.sends[idx].done = true;
+            zc.sends[idx].p = packet();
+        }
+    }
+    while (!zc.sends.empty() && zc.sends.front().done) {
+        zc.sends.pop_front();
+        ++zc.first_id;
+    }
+}
+
+future<>
+posix_data_sink_impl::close() {
+    // Does not touch the sink once the completions are drained, so the
+    // sink may be gone by then.
+    auto finish = [fd = &_fd, zc = _zc] {
+        fd->close();
+        if (!zc) {
+            return make_ready_future<>();
+        }
+        zc->fd.close();
+        if (zc->error) {
+            return make_exception_future<>(make_system_error_ptr(zc->error));
+        }
+        return make_ready_future<>();
+    };
+    if (!_zc || !_zc->reaping) {
+        return finish();
+    }
+    _zc->drained = promise<>();
+    return _zc->drained->get_future().then(std::move(finish));
+}
+
+posix_network_stack::posix_network_stack(boost::program_options::variables_map opts)
+        : _reuseport(engine().posix_reuseport_available()) {
+    if (opts.count("zerocopy-threshold")) {
+        zerocopy_threshold = opts["zerocopy-threshold"].as<size_t>();
+    }
+}
+
 server_socket
 posix_network_stack::listen(socket_address sa, listen_options opt) {
     if (_reuseport)
@@ -297,8 +542,19 @@ posix_udp_channel::receive() {
     });
 }
 
+boost::program_options::options_description
+posix_stack_options() {
+    boost::program_options::options_description opts("Posix network stack options");
+    opts.add_options()
+        ("zerocopy-threshold",
+                boost::program_options::value<size_t>()->default_value(0),
+                "send packets of at least this many bytes with MSG_ZEROCOPY (0 to disable)")
+        ;
+    return opts;
+}
+
 network_stack_registrator nsr_posix{"posix",
-    boost::program_options::options_description(),
+    posix_stack_options(),
     [](boost::program_options::variables_map ops) {
         return smp::main_thread() ? posix_network_stack::create(ops) : posix_ap_network_stack::create(ops);
     },
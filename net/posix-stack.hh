@@ -23,34 +23,79 @@
 #define POSIX_STACK_HH_
 
 #include "core/reactor.hh"
+#include "core/shared_ptr.hh"
 #include <boost/program_options.hpp>
 
 namespace net {
 
 data_source posix_data_source(pollable_fd& fd);
-data_sink posix_data_sink(pollable_fd& fd);
+// Packets of at least zerocopy_threshold bytes are sent with MSG_ZEROCOPY;
+// 0 disables zero-copy sends.
+data_sink posix_data_sink(pollable_fd& fd, size_t zerocopy_threshold = 0);
 
+// Sizes its receive buffer after recent reads: reads that fill the buffer
+// double it, up to the maximum set by the input_stream, and reads that use
+// less than half of it halve it, down to min_buf_size.
 class posix_data_source_impl final : public data_source_impl {
     pollable_fd& _fd;
-    temporary_buffer<char> _buf;
+    std::unique_ptr<char[], free_deleter> _buf;
     size_t _buf_size;
+    size_t _max_buf_size;
 public:
+    static constexpr size_t min_buf_size = 512;
     explicit posix_data_source_impl(pollable_fd& fd, size_t buf_size = 8192)
-        : _fd(fd), _buf(buf_size), _buf_size(buf_size) {}
+        : _fd(fd), _buf(allocate_buffer(buf_size)), _buf_size(buf_size), _max_buf_size(buf_size) {}
     virtual future<temporary_buffer<char>> get() override;
+    virtual void set_max_buffer_size(size_t size) override;
+private:
+    static std::unique_ptr<char[], free_deleter> allocate_buffer(size_t size);
+    temporary_buffer<char> shrink_to_fit(size_t size);
 };
 
+// With zero-copy sends the kernel transmits straight from the packet's
+// memory, so each sent part of a packet is kept alive until the completion
+// notification for it is read from the socket's error queue.  close()
+// waits for all outstanding completions; a sink destroyed before they
+// arrive leaves them to be reaped in the background.
 class posix_data_sink_impl : public data_sink_impl {
+    struct zerocopy_send {
+        packet p;
+        bool done = false;
+        explicit zerocopy_send(packet p) : p(std::move(p)) {}
+    };
+    // Outlives the sink while sends are outstanding.  It polls a duplicate
+    // of the socket, which keeps the socket, and with it the notifications,
+    // around even if the connection closes its descriptor first.
+    struct zerocopy_state {
+        pollable_fd fd;
+        // Sends not yet completed by the kernel, indexed by notification
+        // id starting at first_id.
+        circular_buffer<zerocopy_send> sends;
+        uint32_t first_id = 0;
+        bool reaping = false;
+        bool copied = false;
+        // pending socket error found while reaping
+        int error = 0;
+        std::experimental::optional<promise<>> drained;
+        explicit zerocopy_state(pollable_fd fd) : fd(std::move(fd)) {}
+    };
     pollable_fd& _fd;
     packet _p;
+    size_t _zerocopy_threshold;
+    lw_shared_ptr<zerocopy_state> _zc;
 public:
-    explicit posix_data_sink_impl(pollable_fd& fd) : _fd(fd) {}
+    explicit posix_data_sink_impl(pollable_fd& fd, size_t zerocopy_threshold = 0)
+        : _fd(fd), _zerocopy_threshold(zerocopy_threshold) {}
     future<> put(packet p) override;
     future<> put(temporary_buffer<char> buf) override;
-    future<> close() override {
-        _fd.close();
-        return make_ready_future<>();
-    }
+    future<> close() override;
+private:
+    bool use_zerocopy(size_t len);
+    future<> send_zerocopy();
+    std::exception_ptr pending_error();
+    static void wait_for_completions(lw_shared_ptr<zerocopy_state> zc);
+    static void reap_completions(zerocopy_state& zc);
+    static void complete_zerocopy_sends(zerocopy_state& zc, uint32_t first, uint32_t last);
 };
 
 class posix_ap_server_socket_impl : public server_socket_impl {
@@ -88,7 +133,7 @@ class posix_network_stack : public network_stack {
 private:
     const bool _reuseport;
 public:
-    explicit posix_network_stack(boost::program_options::variables_map opts) : _reuseport(engine().posix_reuseport_available()) {}
+    explicit posix_network_stack(boost::program_options::variables_map opts);
     virtual server_socket listen(socket_address sa, listen_options opts) override;
     virtual future<connected_socket> connect(socket_address sa) override;
     virtual net::udp_channel make_udp_channel(ipv4_addr addr) override;
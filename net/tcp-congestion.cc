@@ -0,0 +1,138 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+#include "tcp-congestion.hh"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace net {
+
+std::unique_ptr<tcp_congestion_control> make_tcp_congestion_control(tcp_congestion_algorithm algo) {
+    switch (algo) {
+    case tcp_congestion_algorithm::newreno:
+        return std::make_unique<tcp_newreno>();
+    case tcp_congestion_algorithm::cubic:
+        return std::make_unique<tcp_cubic>();
+    }
+    abort();
+}
+
+tcp_congestion_algorithm tcp_congestion_algorithm_from_name(const sstring& name) {
+    if (name == "newreno" || name == "reno") {
+        return tcp_congestion_algorithm::newreno;
+    } else if (name == "cubic") {
+        return tcp_congestion_algorithm::cubic;
+    }
+    throw std::invalid_argument("unknown TCP congestion control algorithm: " + name);
+}
+
+void tcp_newreno::on_ack(tcp_congestion_window w, uint32_t acked_bytes) {
+    if (w.cwnd < w.ssthresh) {
+        // In slow start phase
+        w.cwnd += std::min(acked_bytes, w.mss);
+    } else {
+        // In congestion avoidance phase
+        uint32_t round_up = 1;
+        w.cwnd += std::max(round_up, w.mss * w.mss / w.cwnd);
+    }
+}
+
+void tcp_newreno::on_loss(tcp_congestion_window w, uint32_t flight_size) {
+    // RFC5681 Step 3.2
+    w.ssthresh = std::max(flight_size / 2, 2 * w.mss);
+}
+
+void tcp_newreno::on_timeout(tcp_congestion_window w, uint32_t flight_size, bool first) {
+    // RFC5681: update ssthresh only for the first retransmit
+    if (first) {
+        w.ssthresh = std::max(flight_size / 2, 2 * w.mss);
+    }
+}
+
+void tcp_cubic::on_ack(tcp_congestion_window w, uint32_t acked_bytes) {
+    if (w.cwnd < w.ssthresh) {
+        // Standard slow start
+        w.cwnd += std::min(acked_bytes, w.mss);
+        return;
+    }
+    auto now = clock_type::now();
+    double cwnd = double(w.cwnd) / w.mss;
+    if (!_epoch_start) {
+        // First increase since the window was reduced
+        _epoch_start = now;
+        if (cwnd < _w_max) {
+            _k = std::cbrt((_w_max - cwnd) / c);
+        } else {
+            // No loss yet, or slow start overshot the old maximum
+            _k = 0;
+            _w_max = cwnd;
+        }
+        _w_est = cwnd;
+    }
+    // Aim for where the cubic function will be one round trip from now
+    std::chrono::duration<double> t = now - *_epoch_start + w.srtt;
+    double target = c * std::pow(t.count() - _k, 3) + _w_max;
+    // Never shrink the window, nor more than grow it by half in a round trip
+    target = std::min(std::max(target, cwnd), 1.5 * cwnd);
+    // Reno grows by alpha segments per round trip; alpha makes the average
+    // throughput match Reno's given cubic's gentler back off
+    double segs = double(acked_bytes) / w.mss;
+    _w_est += 3 * (1 - beta) / (1 + beta) * segs / cwnd;
+    if (_w_est > target) {
+        // Reno friendly region
+        _pending += (_w_est - cwnd) * w.mss;
+    } else {
+        _pending += (target - cwnd) / cwnd * acked_bytes;
+    }
+    auto grow = uint32_t(_pending);
+    w.cwnd += grow;
+    _pending -= grow;
+}
+
+void tcp_cubic::reduce(tcp_congestion_window w, uint32_t flight_size) {
+    double cwnd = double(w.cwnd) / w.mss;
+    // Fast convergence: a flow losing before it reaches its previous
+    // maximum releases bandwidth to newer flows
+    if (cwnd < _w_max) {
+        _w_max = cwnd * (1 + beta) / 2;
+    } else {
+        _w_max = cwnd;
+    }
+    w.ssthresh = std::max(uint32_t(flight_size * beta), 2 * w.mss);
+    _epoch_start = {};
+    _pending = 0;
+}
+
+void tcp_cubic::on_loss(tcp_congestion_window w, uint32_t flight_size) {
+    reduce(w, flight_size);
+}
+
+void tcp_cubic::on_timeout(tcp_congestion_window w, uint32_t flight_size, bool first) {
+    if (first) {
+        reduce(w, flight_size);
+    }
+    // Slow start runs up to ssthresh, the cubic epoch starts after that
+    _epoch_start = {};
+    _pending = 0;
+}
+
+}
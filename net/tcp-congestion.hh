@@ -0,0 +1,111 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+// TCP congestion control algorithms
+
+#ifndef NET_TCP_CONGESTION_HH
+#define NET_TCP_CONGESTION_HH
+
+#include "core/sstring.hh"
+#include <chrono>
+#include <memory>
+#include <experimental/optional>
+
+namespace net {
+
+// The congestion state of a connection.  The connection owns it and runs
+// loss recovery; the algorithm decides how the window grows and how far
+// it backs off.
+struct tcp_congestion_window {
+    uint32_t& cwnd;
+    uint32_t& ssthresh;
+    uint32_t mss;
+    // Smoothed round trip time, zero until the first sample
+    std::chrono::microseconds srtt;
+};
+
+class tcp_congestion_control {
+public:
+    virtual ~tcp_congestion_control() {}
+    virtual const char* name() const = 0;
+    // acked_bytes of new data were cumulatively acknowledged outside of
+    // fast recovery
+    virtual void on_ack(tcp_congestion_window w, uint32_t acked_bytes) = 0;
+    // Duplicate acknowledgments reported a loss; set ssthresh for the
+    // fast recovery that follows
+    virtual void on_loss(tcp_congestion_window w, uint32_t flight_size) = 0;
+    // The retransmission timer expired; first is false while backing off.
+    // The connection restarts from a one segment window afterwards.
+    virtual void on_timeout(tcp_congestion_window w, uint32_t flight_size, bool first) = 0;
+    // Every round trip time measurement, for algorithms that track delay
+    virtual void on_rtt_sample(std::chrono::microseconds rtt) {}
+};
+
+enum class tcp_congestion_algorithm {
+    newreno,
+    cubic,
+};
+
+std::unique_ptr<tcp_congestion_control> make_tcp_congestion_control(tcp_congestion_algorithm algo);
+
+// Looks an algorithm up by name: "newreno" (or "reno") and "cubic".
+// Throws std::invalid_argument for anything else.
+tcp_congestion_algorithm tcp_congestion_algorithm_from_name(const sstring& name);
+
+// RFC5681 slow start and congestion avoidance
+class tcp_newreno final : public tcp_congestion_control {
+public:
+    virtual const char* name() const override { return "newreno"; }
+    virtual void on_ack(tcp_congestion_window w, uint32_t acked_bytes) override;
+    virtual void on_loss(tcp_congestion_window w, uint32_t flight_size) override;
+    virtual void on_timeout(tcp_congestion_window w, uint32_t flight_size, bool first) override;
+};
+
+// RFC8312: the window follows a cubic function of the time since the last
+// reduction, centered on the window where that loss happened, so it
+// recovers quickly on long fat paths yet probes carefully near the old
+// maximum.  A Reno estimate keeps it no less aggressive than Reno on
+// short round trips.
+class tcp_cubic final : public tcp_congestion_control {
+    using clock_type = std::chrono::steady_clock;
+    static constexpr double beta = 0.7;
+    static constexpr double c = 0.4;
+    // Window, in segments, just before the last reduction
+    double _w_max = 0;
+    // Time, in seconds, the cubic function takes to climb back to _w_max
+    double _k = 0;
+    // Window, in segments, Reno would have by now
+    double _w_est = 0;
+    // Fraction of a byte of growth not yet added to cwnd
+    double _pending = 0;
+    std::experimental::optional<clock_type::time_point> _epoch_start;
+public:
+    virtual const char* name() const override { return "cubic"; }
+    virtual void on_ack(tcp_congestion_window w, uint32_t acked_bytes) override;
+    virtual void on_loss(tcp_congestion_window w, uint32_t flight_size) override;
+    virtual void on_timeout(tcp_congestion_window w, uint32_t flight_size, bool first) override;
+private:
+    void reduce(tcp_congestion_window w, uint32_t flight_size);
+};
+
+}
+
+#endif
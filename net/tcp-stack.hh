@@ -25,6 +25,8 @@
 #define NET_TCP_STACK_HH
 
 #include "core/future.hh"
+#include "tcp-congestion.hh"
+#include <chrono>
 
 class listen_options;
 class server_socket;
@@ -42,6 +44,12 @@ tcpv4_listen(tcp<ipv4_traits>& tcpv4, uint16_t port, listen_options opts);
 future<connected_socket>
 tcpv4_connect(tcp<ipv4_traits>& tcpv4, socket_address sa);
 
+void
+tcpv4_set_rto_min(tcp<ipv4_traits>& tcpv4, std::chrono::microseconds rto_min);
+
+void
+tcpv4_set_congestion_control(tcp<ipv4_traits>& tcpv4, tcp_congestion_algorithm cc);
+
 }
 
 #endif
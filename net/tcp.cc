@@ -28,7 +28,12 @@
 
 namespace net {
 
+constexpr unsigned tcp_option::max_sack_blocks;
+constexpr unsigned tcp_option::max_sack_blocks_with_timestamps;
+
 void tcp_option::parse(uint8_t* beg, uint8_t* end) {
+    _nr_remote_sack_blocks = 0;
+    _remote_ts_present = false;
     while (beg < end) {
         auto kind = option_kind(*beg);
         if (kind != option_kind::nop && kind != option_kind::eol) {
@@ -55,6 +60,30 @@ void tcp_option::parse(uint8_t* beg, uint8_t* end) {
             _sack_received = true;
             beg += option_len::sack;
             break;
+        case option_kind::timestamps: {
+            _timestamps_received = true;
+            auto ts = ntoh(*reinterpret_cast<timestamps*>(beg));
+            _remote_ts_present = true;
+            _remote_ts_val = ts.t1;
+            _remote_ts_ecr = ts.t2;
+            beg += option_len::timestamps;
+            break;
+        }
+        case option_kind::sack_blocks: {
+            auto len = *(beg + 1);
+            if (len < sizeof(sack_blocks)) {
+                return;
+            }
+            auto edges = reinterpret_cast<sack_edges*>(beg + sizeof(sack_blocks));
+            auto nr = std::min((len - sizeof(sack_blocks)) / sizeof(sack_edges), size_t(max_sack_blocks));
+            for (size_t i = 0; i < nr; i++) {
+                auto e = ntoh(edges[i]);
+                _remote_sack_blocks[i] = sack_block{e.left, e.right};
+            }
+            _nr_remote_sack_blocks = nr;
+            beg += len;
+            break;
+        }
         case option_kind::nop:
             beg += option_len::nop;
             break;
@@ -94,6 +123,32 @@ uint8_t tcp_option::fill(tcp_hdr* th, uint8_t options_size) {
             off += win_scale->len;
             size += win_scale->len;
         }
+        if (_sack_received || !ack_on) {
+            auto sack = new (off) tcp_option::sack;
+            off += sack->len;
+            size += sack->len;
+        }
+    }
+    if (_timestamps_received || (syn_on && !ack_on)) {
+        auto ts = new (off) tcp_option::timestamps;
+        ts->t1 = _local_ts_val;
+        ts->t2 = _local_ts_ecr;
+        off += ts->len;
+        size += ts->len;
+        *ts = hton(*ts);
+    }
+    if (_nr_local_sack_blocks) {
+        auto blocks = new (off) tcp_option::sack_blocks;
+        blocks->len = sizeof(sack_blocks) + _nr_local_sack_blocks * sizeof(sack_edges);
+        off += sizeof(sack_blocks);
+        for (unsigned i = 0; i < _nr_local_sack_blocks; i++) {
+            auto edges = new (off) tcp_option::sack_edges;
+            edges->left = _local_sack_blocks[i].left;
+            edges->right = _local_sack_blocks[i].right;
+            *edges = hton(*edges);
+            off += sizeof(sack_edges);
+        }
+        size += blocks->len;
     }
     if (size > 0) {
         // Insert NOP option
@@ -120,6 +175,15 @@ uint8_t tcp_option::get_size(bool syn_on, bool ack_on) {
         if (_win_scale_received || !ack_on) {
             size += option_len::win_scale;
         }
+        if (_sack_received || !ack_on) {
+            size += option_len::sack;
+        }
+    }
+    if (_timestamps_received || (syn_on && !ack_on)) {
+        size += option_len::timestamps;
+    }
+    if (_nr_local_sack_blocks) {
+        size += sizeof(sack_blocks) + _nr_local_sack_blocks * sizeof(sack_edges);
     }
     if (size > 0) {
         size += option_len::eol;
@@ -145,6 +209,10 @@ bool ipv4_tcp::forward(forward_hash& out_hash_data, packet& p, size_t off) {
     return _tcp->forward(out_hash_data, p, off);
 }
 
+void ipv4_tcp::prefetch(packet& p, size_t off, ipv4_address from, ipv4_address to) {
+    _tcp->prefetch(p, off, from, to);
+}
+
 server_socket
 tcpv4_listen(tcp<ipv4_traits>& tcpv4, uint16_t port, listen_options opts) {
 	return server_socket(std::make_unique<native_server_socket_impl<tcp<ipv4_traits>>>(
@@ -159,5 +227,15 @@ tcpv4_connect(tcp<ipv4_traits>& tcpv4, socket_address sa) {
     });
 }
 
+void
+tcpv4_set_rto_min(tcp<ipv4_traits>& tcpv4, std::chrono::microseconds rto_min) {
+    tcpv4.set_rto_min(rto_min);
+}
+
+void
+tcpv4_set_congestion_control(tcp<ipv4_traits>& tcpv4, tcp_congestion_algorithm cc) {
+    tcpv4.set_congestion_control(cc);
+}
+
 }
 
@@ -26,15 +26,22 @@
 #include "core/queue.hh"
 #include "core/semaphore.hh"
 #include "core/print.hh"
+#include "core/align.hh"
+#include "core/memory.hh"
+#include "core/scollectd.hh"
 #include "net.hh"
 #include "ip_checksum.hh"
 #include "ip.hh"
 #include "const.hh"
 #include "packet-util.hh"
+#include "tcp-congestion.hh"
+#include "connection-table.hh"
 #include <unordered_map>
 #include <map>
 #include <functional>
 #include <deque>
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <experimental/optional>
 #include <random>
@@ -64,6 +71,11 @@ public:
     tcp_connect_error() : tcp_error("fail to connect") {}
 };
 
+class tcp_ports_exhausted_error : public tcp_error {
+public:
+    tcp_ports_exhausted_error() : tcp_error("no local port available") {}
+};
+
 class tcp_refused_error : public tcp_error {
 public:
     tcp_refused_error() : tcp_error("connection refused") {}
@@ -94,9 +106,39 @@ void tcp_debug(const char* fmt, Args&&... args) {
 #endif
 }
 
+struct tcp_seq {
+    uint32_t raw;
+};
+
+inline tcp_seq ntoh(tcp_seq s) {
+    return tcp_seq { ntoh(s.raw) };
+}
+
+inline tcp_seq hton(tcp_seq s) {
+    return tcp_seq { hton(s.raw) };
+}
+
+inline
+std::ostream& operator<<(std::ostream& os, tcp_seq s) {
+    return os << s.raw;
+}
+
+inline tcp_seq make_seq(uint32_t raw) { return tcp_seq{raw}; }
+inline tcp_seq& operator+=(tcp_seq& s, int32_t n) { s.raw += n; return s; }
+inline tcp_seq& operator-=(tcp_seq& s, int32_t n) { s.raw -= n; return s; }
+inline tcp_seq operator+(tcp_seq s, int32_t n) { return s += n; }
+inline tcp_seq operator-(tcp_seq s, int32_t n) { return s -= n; }
+inline int32_t operator-(tcp_seq s, tcp_seq q) { return s.raw - q.raw; }
+inline bool operator==(tcp_seq s, tcp_seq q)  { return s.raw == q.raw; }
+inline bool operator!=(tcp_seq s, tcp_seq q) { return !(s == q); }
+inline bool operator<(tcp_seq s, tcp_seq q) { return s - q < 0; }
+inline bool operator>(tcp_seq s, tcp_seq q) { return q < s; }
+inline bool operator<=(tcp_seq s, tcp_seq q) { return !(s > q); }
+inline bool operator>=(tcp_seq s, tcp_seq q) { return !(s < q); }
+
 struct tcp_option {
     // The kind and len field are fixed and defined in TCP protocol
-    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, timestamps = 8,  nop = 1, eol = 0 };
+    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, sack_blocks = 5, timestamps = 8,  nop = 1, eol = 0 };
     enum class option_len:  uint8_t { mss = 4, win_scale = 3, sack = 2, timestamps = 10, nop = 1, eol = 1 };
     struct mss {
         option_kind kind = option_kind::mss;
@@ -114,6 +156,17 @@ struct tcp_option {
         option_kind kind = option_kind::sack;
         option_len len = option_len::sack;
     } __attribute__((packed));
+    // Followed by (len - 2) / 8 sack_edges
+    struct sack_blocks {
+        option_kind kind = option_kind::sack_blocks;
+        uint8_t len;
+    } __attribute__((packed));
+    struct sack_edges {
+        packed<tcp_seq> left;
+        packed<tcp_seq> right;
+        template <typename Adjuster>
+        void adjust_endianness(Adjuster a) { a(left, right); }
+    } __attribute__((packed));
     struct timestamps {
         option_kind kind = option_kind::timestamps;
         option_len len = option_len::timestamps;
@@ -145,40 +198,33 @@ struct tcp_option {
     uint16_t _local_mss;
     uint8_t _remote_win_scale = 0;
     uint8_t _local_win_scale = 0;
+
+    // SACK blocks (RFC2018): [left, right) ranges of data received out of
+    // order.  Remote blocks come from the last parsed segment, local blocks
+    // are sent with the next outgoing segment.
+    static constexpr unsigned max_sack_blocks = 4;
+    struct sack_block {
+        tcp_seq left;
+        tcp_seq right;
+    };
+    std::array<sack_block, max_sack_blocks> _remote_sack_blocks;
+    uint8_t _nr_remote_sack_blocks = 0;
+    std::array<sack_block, max_sack_blocks> _local_sack_blocks;
+    uint8_t _nr_local_sack_blocks = 0;
+    // With timestamps on, only this many SACK blocks fit in 40 bytes
+    static constexpr unsigned max_sack_blocks_with_timestamps = 3;
+
+    // Timestamps (RFC7323).  Remote values come from the last parsed
+    // segment, local values are sent with the next outgoing segment.
+    bool _remote_ts_present = false;
+    uint32_t _remote_ts_val = 0;
+    uint32_t _remote_ts_ecr = 0;
+    uint32_t _local_ts_val = 0;
+    uint32_t _local_ts_ecr = 0;
 };
 inline uint8_t*& operator+=(uint8_t*& x, tcp_option::option_len len) { x += uint8_t(len); return x; }
 inline uint8_t& operator+=(uint8_t& x, tcp_option::option_len len) { x += uint8_t(len); return x; }
 
-struct tcp_seq {
-    uint32_t raw;
-};
-
-inline tcp_seq ntoh(tcp_seq s) {
-    return tcp_seq { ntoh(s.raw) };
-}
-
-inline tcp_seq hton(tcp_seq s) {
-    return tcp_seq { hton(s.raw) };
-}
-
-inline
-std::ostream& operator<<(std::ostream& os, tcp_seq s) {
-    return os << s.raw;
-}
-
-inline tcp_seq make_seq(uint32_t raw) { return tcp_seq{raw}; }
-inline tcp_seq& operator+=(tcp_seq& s, int32_t n) { s.raw += n; return s; }
-inline tcp_seq& operator-=(tcp_seq& s, int32_t n) { s.raw -= n; return s; }
-inline tcp_seq operator+(tcp_seq s, int32_t n) { return s += n; }
-inline tcp_seq operator-(tcp_seq s, int32_t n) { return s -= n; }
-inline int32_t operator-(tcp_seq s, tcp_seq q) { return s.raw - q.raw; }
-inline bool operator==(tcp_seq s, tcp_seq q)  { return s.raw == q.raw; }
-inline bool operator!=(tcp_seq s, tcp_seq q) { return !(s == q); }
-inline bool operator<(tcp_seq s, tcp_seq q) { return s - q < 0; }
-inline bool operator>(tcp_seq s, tcp_seq q) { return q < s; }
-inline bool operator<=(tcp_seq s, tcp_seq q) { return !(s > q); }
-inline bool operator>=(tcp_seq s, tcp_seq q) { return !(s < q); }
-
 struct tcp_hdr {
     packed<uint16_t> src_port;
     packed<uint16_t> dst_port;
@@ -212,9 +258,27 @@ public:
     class listener;
 private:
     class tcb;
+    // Spreads every field of the 4-tuple over the whole hash, as the
+    // connection table indexes by its low bits
+    struct connid_table_hash {
+        uint32_t operator()(const connid& id) const {
+            uint64_t x = (uint64_t(id.foreign_ip.ip) << 32)
+                    | (uint32_t(id.foreign_port) << 16) | id.local_port;
+            x ^= uint64_t(id.local_ip.ip) * 0x9e3779b97f4a7c15ull;
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdull;
+            x ^= x >> 33;
+            x *= 0xc4ceb9fe1a85ec53ull;
+            x ^= x >> 33;
+            return x;
+        }
+    };
 
     class tcb : public enable_lw_shared_from_this<tcb> {
-        using clock_type = lowres_clock;
+        // RTT is measured in microseconds, too finely for lowres_clock's
+        // 10ms ticks, and on a clock that does not jump with the wall clock
+        // as the reactor's high resolution clock can
+        using clock_type = std::chrono::steady_clock;
         static constexpr const tcp_state CLOSED         = tcp_state::CLOSED;
         static constexpr const tcp_state LISTEN         = tcp_state::LISTEN;
         static constexpr const tcp_state SYN_SENT       = tcp_state::SYN_SENT;
@@ -229,6 +293,10 @@ private:
         tcp_state _state = CLOSED;
         tcp& _tcp;
         connection* _conn = nullptr;
+        // Opened by a listener; queued for accept() once established
+        bool _passive = false;
+        // Counted in tcp::_half_open
+        bool _half_open = false;
         promise<> _connect_done;
         ipaddr _local_ip;
         ipaddr _foreign_ip;
@@ -240,6 +308,9 @@ private:
             uint16_t data_remaining;
             unsigned nr_transmits;
             clock_type::time_point tx_time;
+            // SACK scoreboard (RFC6675)
+            bool sacked;
+            bool lost;
         };
         struct send {
             tcp_seq unacknowledged;
@@ -262,9 +333,9 @@ private:
             // Limit number of data queued into send queue
             semaphore user_queue_space = {212992};
             // Round-trip time variation
-            std::chrono::milliseconds rttvar;
+            std::chrono::microseconds rttvar{0};
             // Smoothed round-trip time
-            std::chrono::milliseconds srtt;
+            std::chrono::microseconds srtt{0};
             bool first_rto_sample = true;
             clock_type::time_point syn_tx_time;
             // Congestion window
@@ -278,7 +349,11 @@ private:
             uint32_t limited_transfer = 0;
             uint32_t partial_ack = 0;
             tcp_seq recover;
+            // Highest sequence number retransmitted during SACK based loss recovery
+            tcp_seq high_rxt;
             bool window_probe = false;
+            // Random per-connection offset of our timestamp clock (RFC7323 5.4)
+            uint32_t ts_offset = 0;
         } _snd;
         struct receive {
             tcp_seq next;
@@ -289,20 +364,42 @@ private:
             tcp_seq initial;
             std::deque<packet> data;
             packet_merger<tcp_seq> out_of_order;
+            // Most recently received out-of-order segment, reported first in SACK blocks
+            tcp_seq last_out_of_order;
+            // Timestamp to echo (TS.Recent) and the ACK it belongs to (RFC7323 4.3)
+            uint32_t ts_recent = 0;
+            tcp_seq last_ack_sent;
+            // The advertised window is what unread data leaves of buf_size.
+            // buf_size follows how much the application reads per round
+            // trip (dynamic right sizing) and shrinks under memory pressure.
+            uint32_t buf_size;
+            uint32_t data_size = 0;
+            // Right edge of the last advertised window, which must not move back
+            tcp_seq window_edge;
+            // Bytes read in the current round trip, and the most read in one
+            uint32_t copied = 0;
+            uint32_t space = 0;
+            clock_type::time_point space_time;
             std::experimental::optional<promise<>> _data_received_promise;
         } _rcv;
         tcp_option _option;
+        std::unique_ptr<tcp_congestion_control> _cc;
         timer<lowres_clock> _delayed_ack;
         // Retransmission timeout
-        std::chrono::milliseconds _rto{1000};
-        std::chrono::milliseconds _persist_time_out{1000};
-        static constexpr std::chrono::milliseconds _rto_min{1000};
-        static constexpr std::chrono::milliseconds _rto_max{60000};
-        // Clock granularity
-        static constexpr std::chrono::milliseconds _rto_clk_granularity{1};
+        std::chrono::microseconds _rto{std::chrono::seconds(1)};
+        std::chrono::microseconds _persist_time_out{std::chrono::seconds(1)};
+        static constexpr std::chrono::microseconds _rto_max{std::chrono::seconds(60)};
+        // Clock granularity; timestamp RTT samples have 1ms ticks
+        static constexpr std::chrono::microseconds _rto_clk_granularity{std::chrono::milliseconds(1)};
         static constexpr uint16_t _max_nr_retransmit{5};
-        timer<lowres_clock> _retransmit;
-        timer<lowres_clock> _persist;
+        // Duplicate ACKs (or SACKed segments above a hole) indicating loss
+        static constexpr uint16_t _dupthresh{3};
+        // Receive buffer limits
+        static constexpr uint32_t _rcv_buf_min{16384};
+        static constexpr uint32_t _rcv_buf_initial{65536};
+        static constexpr uint32_t _rcv_buf_max{4 * 1024 * 1024};
+        timer<> _retransmit;
+        timer<> _persist;
         uint16_t _nr_full_seg_received = 0;
         struct isn_secret {
             // 512 bits secretkey for ISN generating
@@ -317,12 +414,16 @@ private:
             }
         };
         static isn_secret _isn_secret;
+        // RFC6528's F(): a keyed hash of the 4-tuple
+        static void hash_4tuple(uint32_t (&hash)[4], connid id, uint32_t salt);
+        static uint32_t ts_offset(connid id);
         tcp_seq get_isn();
         circular_buffer<typename InetTraits::l4packet> _packetq;
         bool _poll_active = false;
     public:
-        tcb(tcp& t, connid id);
+        tcb(tcp& t, connid id, tcp_congestion_algorithm cc);
         void input_handle_listen_state(tcp_hdr* th, packet p);
+        void input_handle_syn_cookie(tcp_hdr* th, uint16_t mss, packet p);
         void input_handle_syn_sent_state(tcp_hdr* th, packet p);
         void input_handle_other_state(tcp_hdr* th, packet p);
         void output_one();
@@ -363,6 +464,12 @@ private:
         tcp_state& state() {
             return _state;
         }
+        uint32_t receive_buffer_size() const {
+            return _rcv.buf_size;
+        }
+        uint32_t receive_window() const {
+            return _rcv.window;
+        }
     private:
         void respond_with_reset(tcp_hdr* th);
         bool merge_out_of_order();
@@ -371,23 +478,17 @@ private:
         bool should_send_ack(uint16_t seg_len);
         void clear_delayed_ack();
         packet get_transmit_packet();
+        void prepend_header(packet& p, tcp_seq seq, bool syn_on, bool fin_on);
+        void retransmit_segment(unacked_segment& seg, tcp_seq seq);
         void start_retransmit_timer() {
-            auto now = clock_type::now();
-            start_retransmit_timer(now);
-        };
-        void start_retransmit_timer(clock_type::time_point now) {
-            auto tp = now + _rto;
+            auto tp = timer<>::clock::now() + _rto;
             _retransmit.rearm(tp);
         };
         void stop_retransmit_timer() {
             _retransmit.cancel();
         };
         void start_persist_timer() {
-            auto now = clock_type::now();
-            start_persist_timer(now);
-        };
-        void start_persist_timer(clock_type::time_point now) {
-            auto tp = now + _persist_time_out;
+            auto tp = timer<>::clock::now() + _persist_time_out;
             _persist.rearm(tp);
         };
         void stop_persist_timer() {
@@ -396,7 +497,15 @@ private:
         void persist();
         void retransmit();
         void fast_retransmit();
-        void update_rto(clock_type::time_point tx_time);
+        void update_sack_scoreboard();
+        uint32_t sack_pipe();
+        void sack_retransmit();
+        void set_sack_blocks();
+        uint32_t receive_space();
+        void update_receive_window();
+        void update_receive_buffer(uint32_t read_bytes);
+        void shrink_receive_buffer();
+        void update_rto(std::chrono::microseconds R);
         void update_cwnd(uint32_t acked_bytes);
         void cleanup();
         uint32_t can_send() {
@@ -414,6 +523,10 @@ private:
                 auto max = _snd.cwnd + 2 * _snd.mss;
                 x = flight <= max ? std::min(x, max - flight) : 0;
                 _snd.limited_transfer += x;
+            } else if (_snd.dupacks >= 3 && sack_enabled()) {
+                // RFC6675: send new data only while the pipe is below cwnd
+                auto pipe = sack_pipe();
+                x = pipe < _snd.cwnd ? std::min(x, _snd.cwnd - pipe) : 0;
             } else if (_snd.dupacks >= 3) {
                 // RFC5681 Step 3.5
                 // Sent 1 full-sized segment at most
@@ -427,7 +540,7 @@ private:
             return size;
         }
         uint16_t local_mss() {
-            return _tcp.hw_features().mtu - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min;
+            return _tcp.local_mss();
         }
         void queue_packet(packet p) {
             _packetq.emplace_back(typename InetTraits::l4packet{_foreign_ip, std::move(p)});
@@ -452,30 +565,49 @@ private:
         }
         void do_syn_received() {
             _state = SYN_RECEIVED;
+            _half_open = true;
+            _tcp._half_open++;
             _snd.syn_tx_time = clock_type::now();
             // Send <SYN,ACK> to remote
             output();
         }
         void do_established() {
             _state = ESTABLISHED;
-            update_rto(_snd.syn_tx_time);
+            leave_half_open();
+            // A SYN cookie handshake without timestamps cannot tell when
+            // its SYN-ACK was sent
+            if (_snd.syn_tx_time != clock_type::time_point()) {
+                update_rto(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - _snd.syn_tx_time));
+            }
             _connect_done.set_value();
         }
+        void leave_half_open() {
+            if (_half_open) {
+                _half_open = false;
+                _tcp._half_open--;
+            }
+        }
         void do_reset() {
             _state = CLOSED;
             // Free packets to be sent which are waiting for _snd.user_queue_space
-            _snd.user_queue_space.broken(tcp_reset_error());
+            // Resets can arrive in storms; fail everything with one preallocated exception
+            auto ex = static_exception_ptr<tcp_reset_error>();
+            _snd.user_queue_space.broken(ex);
             cleanup();
             if (_rcv._data_received_promise) {
-                _rcv._data_received_promise->set_exception(tcp_reset_error());
+                _rcv._data_received_promise->set_exception(ex);
             }
             if (_snd._all_data_acked_promise) {
-                _snd._all_data_acked_promise->set_exception(tcp_reset_error());
+                _snd._all_data_acked_promise->set_exception(ex);
             }
         }
         void do_time_wait() {
-            // FIXME: Implement TIME_WAIT state timer
             _state = TIME_WAIT;
+            // Waiting out 2MSL does not need the tcb, only what it takes to
+            // answer a retransmitted FIN and to vet a new incarnation
+            auto id = connid{_local_ip, _foreign_ip, _local_port, _foreign_port};
+            _tcp.enter_time_wait(id, time_wait_entry{_snd.next, _rcv.next,
+                    _snd.ts_offset, _rcv.ts_recent, timestamps_enabled()});
             cleanup();
         }
         void do_closed() {
@@ -487,6 +619,7 @@ private:
             _snd.unacknowledged = _snd.initial;
             _snd.next = _snd.initial + 1;
             _snd.recover = _snd.initial;
+            _snd.high_rxt = _snd.initial;
         }
         void do_local_fin_acked() {
             _snd.unacknowledged += 1;
@@ -508,26 +641,95 @@ private:
         bool in_state(tcp_state state) {
             return uint16_t(_state) & uint16_t(state);
         }
+        bool sack_enabled() {
+            // We always offer SACK, so it is on once the peer offered it too
+            return _option._sack_received;
+        }
+        bool timestamps_enabled() {
+            // Likewise for timestamps
+            return _option._timestamps_received;
+        }
+        uint32_t ts_now() {
+            return ts_clock() + _snd.ts_offset;
+        }
+        tcp_congestion_window cc_window() {
+            return tcp_congestion_window{_snd.cwnd, _snd.ssthresh, _snd.mss, _snd.srtt};
+        }
         void exit_fast_recovery() {
             _snd.dupacks = 0;
             _snd.limited_transfer = 0;
             _snd.partial_ack = 0;
+            _snd.high_rxt = _snd.unacknowledged;
         }
         uint32_t data_segment_acked(tcp_seq seg_ack);
         bool segment_acceptable(tcp_seq seg_seq, unsigned seg_len);
         void init_from_options(tcp_hdr* th, uint8_t* opt_start, uint8_t* opt_end);
+        void init_from_negotiated_options(tcp_hdr* th);
         friend class connection;
+        friend class tcp;
     };
     inet_type& _inet;
-    std::unordered_map<connid, lw_shared_ptr<tcb>, connid_hash> _tcbs;
+    connection_table<connid, lw_shared_ptr<tcb>, connid_table_hash> _tcbs;
     std::unordered_map<uint16_t, listener*> _listening;
     std::random_device _rd;
     std::default_random_engine _e;
     std::uniform_int_distribution<uint16_t> _port_dist{41952, 65535};
+    // RSS hash contributions of the high and low byte of a local port.
+    // The Toeplitz hash is linear over xor, so xoring them into the hash
+    // of a 4-tuple with port 0 gives its hash without rehashing it.
+    std::array<uint32_t, 256> _port_rss_hash_hi;
+    std::array<uint32_t, 256> _port_rss_hash_lo;
     circular_buffer<std::pair<lw_shared_ptr<tcb>, ethernet_address>> _poll_tcbs;
     // queue for packets that do not belong to any tcb
     circular_buffer<ipv4_traits::l4packet> _packetq;
     semaphore _queue_space = {212992};
+    // Lower bound of the retransmission timeout; RFC6298 asks for 1s, but
+    // datacenter round trips are orders of magnitude shorter
+    std::chrono::microseconds _rto_min{std::chrono::seconds(1)};
+    // Connections in TIME_WAIT, reduced to what outlives the tcb
+    struct time_wait_entry {
+        tcp_seq snd_next;
+        tcp_seq rcv_next;
+        uint32_t ts_offset;
+        uint32_t ts_recent;
+        bool timestamps;
+        // Ticks of the wheel when it entered TIME_WAIT and when it leaves
+        uint32_t entered;
+        uint32_t expires;
+        // Tick of the one wheel slot that schedules it; a restarted 2MSL
+        // moves it to a later slot when that tick comes
+        uint32_t scheduled;
+    };
+    // 2MSL, counted on a wheel with one second slots
+    static constexpr uint32_t _time_wait_ticks = 60;
+    static constexpr uint32_t _time_wait_slots = 64;
+    static constexpr size_t _max_time_wait = 262144;
+    std::unordered_map<connid, time_wait_entry, connid_hash> _time_wait;
+    std::array<std::vector<connid>, _time_wait_slots> _time_wait_wheel;
+    uint32_t _time_wait_tick = 0;
+    timer<lowres_clock> _time_wait_timer;
+    uint64_t _time_wait_reused = 0;
+    // Handshakes not yet complete, and how many of them the shard keeps
+    // state for before answering SYNs with cookies instead (RFC4987)
+    size_t _half_open = 0;
+    size_t _syn_backlog = 1024;
+    uint64_t _syn_cookies_sent = 0;
+    uint64_t _syn_cookies_validated = 0;
+    uint64_t _syn_cookies_failed = 0;
+    // When the last cookie went out.  No ACK carries a valid cookie for
+    // long after that, so until the next overflow stray ACKs to a listening
+    // port are reset without hashing them, as Linux does.
+    std::experimental::optional<std::chrono::steady_clock::time_point> _last_syn_cookie_sent;
+    // Bits of a cookie's timestamp that carry the SYN's window scale
+    // (0xf for none) and SACK-permitted (0x10)
+    static constexpr uint32_t syn_cookie_ts_mask = 0x3f;
+    // Congestion control of connections that do not pick one
+    tcp_congestion_algorithm _congestion_control = tcp_congestion_algorithm::newreno;
+    // Receive buffer autotuning
+    uint64_t _rcv_buf_grown = 0;
+    uint64_t _rcv_buf_shrunk = 0;
+    memory::reclaimer _reclaimer;
+    std::vector<scollectd::registration> _collectd_regs;
 public:
     class connection {
         lw_shared_ptr<tcb> _tcb;
@@ -555,6 +757,13 @@ public:
         packet read() {
             return _tcb->read();
         }
+        // Receive buffer autotuning state
+        uint32_t receive_buffer_size() const {
+            return _tcb->receive_buffer_size();
+        }
+        uint32_t receive_window() const {
+            return _tcb->receive_window();
+        }
         void close_read();
         void close_write();
     };
@@ -562,14 +771,15 @@ public:
         tcp& _tcp;
         uint16_t _port;
         queue<connection> _q;
+        tcp_congestion_algorithm _congestion_control;
     private:
-        listener(tcp& t, uint16_t port, size_t queue_length)
-            : _tcp(t), _port(port), _q(queue_length) {
+        listener(tcp& t, uint16_t port, size_t queue_length, tcp_congestion_algorithm cc)
+            : _tcp(t), _port(port), _q(queue_length), _congestion_control(cc) {
             _tcp._listening.emplace(_port, this);
         }
     public:
         listener(listener&& x)
-            : _tcp(x._tcp), _port(x._port), _q(std::move(x._q)) {
+            : _tcp(x._tcp), _port(x._port), _q(std::move(x._q)), _congestion_control(x._congestion_control) {
             _tcp._listening[_port] = this;
             x._port = 0;
         }
@@ -588,19 +798,161 @@ public:
 public:
     explicit tcp(inet_type& inet);
     void received(packet p, ipaddr from, ipaddr to);
+    // Starts loading the connection the segment at off belongs to, while
+    // the segment before it is processed
+    void prefetch(packet& p, size_t off, ipaddr from, ipaddr to);
     bool forward(forward_hash& out_hash_data, packet& p, size_t off);
     listener listen(uint16_t port, size_t queue_length = 100);
+    // Accepted connections use the given congestion control
+    listener listen(uint16_t port, size_t queue_length, tcp_congestion_algorithm cc);
     future<connection> connect(socket_address sa);
+    future<connection> connect(socket_address sa, tcp_congestion_algorithm cc);
+    void set_rto_min(std::chrono::microseconds rto_min) { _rto_min = rto_min; }
+    void set_congestion_control(tcp_congestion_algorithm cc) { _congestion_control = cc; }
+    size_t time_wait_connections() const { return _time_wait.size(); }
+    // Half open connections beyond which SYNs are answered with cookies
+    void set_syn_backlog(size_t syn_backlog) { _syn_backlog = syn_backlog; }
+    uint64_t syn_cookies_sent() const { return _syn_cookies_sent; }
+    uint64_t syn_cookies_validated() const { return _syn_cookies_validated; }
     const net::hw_features& hw_features() const { return _inet._inet.hw_features(); }
     future<> poll_tcb(ipaddr to, lw_shared_ptr<tcb> tcb);
 private:
+    // Our timestamp clock, before the per-connection offset: 1ms ticks,
+    // the fastest PAWS allows (RFC7323 5.4), and monotonic, as PAWS and
+    // RTT samples taken from echoed timestamps require
+    static uint32_t ts_clock() {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch());
+        return ms.count();
+    }
+    uint16_t local_mss() {
+        return hw_features().mtu - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min;
+    }
+    static uint16_t syn_cookie_mss(unsigned idx) {
+        // Common MSS values, coarsely covering what peers announce
+        static const uint16_t mss[] = { 216, 536, 1200, 1360, 1440, 1460, 4312, 8960 };
+        return idx < sizeof(mss) / sizeof(mss[0]) ? mss[idx] : 0;
+    }
+    tcp_seq make_syn_cookie(connid id, tcp_seq their_isn, unsigned mss_idx);
+    std::experimental::optional<uint16_t> check_syn_cookie(connid id, const tcp_hdr& h);
+    void send_syn_cookie(connid id, const tcp_hdr& h, packet& p);
+    void send_segment_without_tcb(connid id, packet p, uint8_t tcp_hdr_len);
+    void enter_time_wait(connid id, time_wait_entry e);
+    void time_wait_tick();
+    bool time_wait_accepts_syn(const time_wait_entry& e, const tcp_hdr& h, const tcp_option& opt);
+    bool reuse_time_wait(connid id);
+    void respond_from_time_wait(connid id, const time_wait_entry& e);
+    void shrink_receive_buffers();
+    template <typename Func>
+    uint64_t sum_over_tcbs(Func func) {
+        uint64_t sum = 0;
+        _tcbs.for_each([&] (const connid&, lw_shared_ptr<tcb>& t) {
+            sum += func(*t);
+        });
+        return sum;
+    }
     void send_packet_without_tcb(ipaddr from, ipaddr to, packet p);
     void respond_with_reset(tcp_hdr* rth, ipaddr local_ip, ipaddr foreign_ip);
     friend class listener;
 };
 
 template <typename InetTraits>
-tcp<InetTraits>::tcp(inet_type& inet) : _inet(inet), _e(_rd()) {
+tcp<InetTraits>::tcp(inet_type& inet)
+        : _inet(inet)
+        , _e(_rd())
+        , _reclaimer([this] { shrink_receive_buffers(); })
+        , _collectd_regs({
+            // Sum of the receive buffers and windows of all connections
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "bytes", "rcv-buffer")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                            , [this] { return sum_over_tcbs([] (tcb& t) { return t._rcv.buf_size; }); })
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "bytes", "rcv-window")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                            , [this] { return sum_over_tcbs([] (tcb& t) { return t._rcv.window; }); })
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "bytes", "rcv-unread")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                            , [this] { return sum_over_tcbs([] (tcb& t) { return t._rcv.data_size; }); })
+            ),
+            // Number of times a receive buffer was grown or shrunk
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "rcv-buffer-grow")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _rcv_buf_grown)
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "rcv-buffer-shrink")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _rcv_buf_shrunk)
+            ),
+            // Connections waiting out 2MSL, and new connections that did not
+            // have to wait for their 4-tuple
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "connections", "time-wait")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                            , [this] { return uint64_t(_time_wait.size()); })
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "time-wait-reuse")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _time_wait_reused)
+            ),
+            // Stateless handshakes under SYN pressure
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "syn-cookies-sent")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _syn_cookies_sent)
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "syn-cookies-validated")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _syn_cookies_validated)
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "syn-cookies-failed")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _syn_cookies_failed)
+            ),
+            // Connection table occupancy and probing; slots probed per
+            // lookup is the ratio of the two counters
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "connections", "tcbs")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                            , [this] { return uint64_t(_tcbs.size()); })
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "tcb-lookups")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE
+                            , [this] { return _tcbs.lookups(); })
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "tcb-probes")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE
+                            , [this] { return _tcbs.probes(); })
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp"
+                    , scollectd::per_cpu_plugin_instance
+                    , "gauge", "tcb-max-probe")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                            , [this] { return uint64_t(_tcbs.max_probe_length()); })
+            ),
+        }) {
+    _time_wait_timer.set_callback([this] { time_wait_tick(); });
+    for (unsigned b = 0; b < 256; ++b) {
+        _port_rss_hash_hi[b] = connid{ipaddr(), ipaddr(), uint16_t(b << 8), 0}.hash();
+        _port_rss_hash_lo[b] = connid{ipaddr(), ipaddr(), uint16_t(b), 0}.hash();
+    }
     _inet.register_packet_provider([this, tcb_polled = 0u] () mutable {
         std::experimental::optional<typename InetTraits::l4packet> l4p;
         auto c = _poll_tcbs.size();
@@ -635,25 +987,51 @@ future<> tcp<InetTraits>::poll_tcb(ipaddr to, lw_shared_ptr<tcb> tcb) {
 
 template <typename InetTraits>
 auto tcp<InetTraits>::listen(uint16_t port, size_t queue_length) -> listener {
-    return listener(*this, port, queue_length);
+    return listen(port, queue_length, _congestion_control);
+}
+
+template <typename InetTraits>
+auto tcp<InetTraits>::listen(uint16_t port, size_t queue_length, tcp_congestion_algorithm cc) -> listener {
+    return listener(*this, port, queue_length, cc);
 }
 
 template <typename InetTraits>
 future<typename tcp<InetTraits>::connection> tcp<InetTraits>::connect(socket_address sa) {
-    uint16_t src_port;
-    connid id;
+    return connect(sa, _congestion_control);
+}
+
+template <typename InetTraits>
+future<typename tcp<InetTraits>::connection> tcp<InetTraits>::connect(socket_address sa, tcp_congestion_algorithm cc) {
     auto src_ip = _inet._inet.host_address();
     auto dst_ip = ipv4_address(sa);
     auto dst_port = net::ntoh(sa.u.in.sin_port);
 
-    do {
-        src_port = _port_dist(_e);
-        id = connid{src_ip, dst_ip, src_port, dst_port};
-    } while (_inet._inet.netif()->hash2cpu(id.hash()) != engine().cpu_id()
-            || _tcbs.find(id) != _tcbs.end());
+    // Only take a port whose replies RSS steers to this shard, so the
+    // connection is never forwarded.  Scan the ephemeral range from a
+    // random port, so every free one is found in a single pass.
+    auto base_hash = connid{src_ip, dst_ip, 0, dst_port}.hash();
+    unsigned min_port = _port_dist.min();
+    unsigned nr_ports = _port_dist.max() - min_port + 1;
+    unsigned start = _port_dist(_e) - min_port;
+    auto netif = _inet._inet.netif();
+    std::experimental::optional<connid> id;
+    for (unsigned i = 0; i < nr_ports && !id; ++i) {
+        uint16_t src_port = min_port + (start + i) % nr_ports;
+        auto hash = base_hash ^ _port_rss_hash_hi[src_port >> 8] ^ _port_rss_hash_lo[src_port & 0xff];
+        if (netif->hash2cpu(hash) != engine().cpu_id()) {
+            continue;
+        }
+        connid candidate{src_ip, dst_ip, src_port, dst_port};
+        if (!_tcbs.find(candidate) && reuse_time_wait(candidate)) {
+            id = candidate;
+        }
+    }
+    if (!id) {
+        return make_exception_future<connection>(std::make_exception_ptr(tcp_ports_exhausted_error()));
+    }
 
-    auto tcbp = make_lw_shared<tcb>(*this, id);
-    _tcbs.insert({id, tcbp});
+    auto tcbp = make_lw_shared<tcb>(*this, *id, cc);
+    _tcbs.insert(*id, tcbp);
     tcbp->connect();
 
     return tcbp->connect_done().then([tcbp] {
@@ -671,6 +1049,14 @@ bool tcp<InetTraits>::forward(forward_hash& out_hash_data, packet& p, size_t off
     return true;
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::prefetch(packet& p, size_t off, ipaddr from, ipaddr to) {
+    auto th = p.get_header<tcp_hdr>(off);
+    if (th) {
+        _tcbs.prefetch(connid{to, from, net::ntoh(th->dst_port), net::ntoh(th->src_port)});
+    }
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
     auto th = p.get_header<tcp_hdr>(0);
@@ -682,7 +1068,7 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
         return;
     }
 
-    if (!hw_features().rx_csum_offload) {
+    if (!hw_features().rx_csum_offload && !p.offload_info_ref().csum_verified) {
         checksummer csum;
         InetTraits::tcp_pseudo_header_checksum(csum, from, to, p.len());
         csum.sum(p);
@@ -694,9 +1080,45 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
     auto id = connid{to, from, h.dst_port, h.src_port};
     auto tcbi = _tcbs.find(id);
     lw_shared_ptr<tcb> tcbp;
-    if (tcbi == _tcbs.end()) {
+    if (!tcbi) {
+        auto twi = _time_wait.find(id);
+        if (twi != _time_wait.end()) {
+            // 0) In TIME_WAIT state
+            auto& e = twi->second;
+            // RFC1337: an RST must not cut TIME_WAIT short
+            if (h.f_rst) {
+                return;
+            }
+            tcp_option opt;
+            auto opt_len = h.data_offset * 4 - sizeof(tcp_hdr);
+            auto opt_start = reinterpret_cast<uint8_t*>(p.get_header(sizeof(tcp_hdr), opt_len));
+            if (opt_start) {
+                opt.parse(opt_start, opt_start + opt_len);
+            }
+            if (h.f_syn && !h.f_ack && time_wait_accepts_syn(e, h, opt)) {
+                // A new incarnation of the connection; handle the SYN as
+                // if it arrived in LISTEN
+                _time_wait.erase(twi);
+                _time_wait_reused++;
+            } else {
+                auto seg_len = p.len() - h.data_offset * 4;
+                if (h.f_fin && tcp_seq(h.seq) + int32_t(seg_len) == e.rcv_next - 1) {
+                    // The only thing that can arrive in this state is a
+                    // retransmission of the remote FIN. Acknowledge it, and
+                    // restart the 2 MSL timeout.
+                    if (opt._remote_ts_present) {
+                        e.ts_recent = opt._remote_ts_val;
+                    }
+                    e.expires = _time_wait_tick + _time_wait_ticks;
+                }
+                if (h.f_fin || h.f_syn || seg_len) {
+                    respond_from_time_wait(id, e);
+                }
+                return;
+            }
+        }
         auto listener = _listening.find(id.local_port);
-        if (listener == _listening.end() || listener->second->_q.full()) {
+        if (listener == _listening.end()) {
             // 1) In CLOSE state
             // 1.1 all data in the incoming segment is discarded.  An incoming
             // segment containing a RST is discarded. An incoming segment not
@@ -714,6 +1136,19 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
             }
             // 2.2 second check for an ACK
             if (h.f_ack) {
+                // The final ACK of a SYN cookie handshake is the first
+                // segment of the connection we see
+                auto mss = h.f_syn ? std::experimental::optional<uint16_t>() : check_syn_cookie(id, h);
+                if (mss) {
+                    if (listener->second->_q.full()) {
+                        // The peer retransmits until accept() makes room
+                        return;
+                    }
+                    _syn_cookies_validated++;
+                    tcbp = make_lw_shared<tcb>(*this, id, listener->second->_congestion_control);
+                    _tcbs.insert(id, tcbp);
+                    return tcbp->input_handle_syn_cookie(&h, *mss, std::move(p));
+                }
                 // Any acknowledgment is bad if it arrives on a connection
                 // still in the LISTEN state.
                 // <SEQ=SEG.ACK><CTL=RST>
@@ -723,9 +1158,12 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
             if (h.f_syn) {
                 // check the security
                 // NOTE: Ignored for now
-                tcbp = make_lw_shared<tcb>(*this, id);
-                listener->second->_q.push(connection(tcbp));
-                _tcbs.insert({id, tcbp});
+                if (_half_open >= _syn_backlog || listener->second->_q.full()) {
+                    // Keep no state until the peer proves it can receive
+                    return send_syn_cookie(id, h, p);
+                }
+                tcbp = make_lw_shared<tcb>(*this, id, listener->second->_congestion_control);
+                _tcbs.insert(id, tcbp);
                 return tcbp->input_handle_listen_state(&h, std::move(p));
             }
             // 2.4 fourth other text or control
@@ -734,7 +1172,7 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
             return;
         }
     } else {
-        tcbp = tcbi->second;
+        tcbp = *tcbi;
         if (tcbp->state() == tcp_state::SYN_SENT) {
             // 3) In SYN_SENT State
             return tcbp->input_handle_syn_sent_state(&h, std::move(p));
@@ -748,6 +1186,219 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
 }
 
 // Send packet does not belong to any tcb
+template <typename InetTraits>
+void tcp<InetTraits>::enter_time_wait(connid id, time_wait_entry e) {
+    if (_time_wait.size() >= _max_time_wait) {
+        // Too many to remember; close right away like before TIME_WAIT
+        // was implemented
+        return;
+    }
+    e.entered = _time_wait_tick;
+    e.expires = _time_wait_tick + _time_wait_ticks;
+    e.scheduled = e.expires;
+    _time_wait[id] = e;
+    _time_wait_wheel[e.expires % _time_wait_slots].push_back(id);
+    if (!_time_wait_timer.armed()) {
+        _time_wait_timer.arm_periodic(std::chrono::seconds(1));
+    }
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::time_wait_tick() {
+    auto& slot = _time_wait_wheel[++_time_wait_tick % _time_wait_slots];
+    auto due = std::move(slot);
+    slot.clear();
+    for (auto& id : due) {
+        auto i = _time_wait.find(id);
+        // Skip entries gone, or of a later incarnation queued elsewhere
+        if (i == _time_wait.end() || i->second.scheduled != _time_wait_tick) {
+            continue;
+        }
+        auto& e = i->second;
+        if (e.expires == _time_wait_tick) {
+            _time_wait.erase(i);
+        } else {
+            e.scheduled = e.expires;
+            _time_wait_wheel[e.scheduled % _time_wait_slots].push_back(id);
+        }
+    }
+    if (_time_wait.empty()) {
+        _time_wait_timer.cancel();
+    }
+}
+
+template <typename InetTraits>
+bool tcp<InetTraits>::time_wait_accepts_syn(const time_wait_entry& e, const tcp_hdr& h, const tcp_option& opt) {
+    // RFC6191: with timestamps on both incarnations, a larger timestamp
+    // marks a new connection rather than an old duplicate
+    if (e.timestamps && opt._remote_ts_present) {
+        return int32_t(opt._remote_ts_val - e.ts_recent) > 0;
+    }
+    // Otherwise RFC1122 4.2.2.13: its sequence numbers must start above
+    // the old connection's
+    return tcp_seq(h.seq) > e.rcv_next;
+}
+
+template <typename InetTraits>
+bool tcp<InetTraits>::reuse_time_wait(connid id) {
+    auto i = _time_wait.find(id);
+    if (i == _time_wait.end()) {
+        return true;
+    }
+    // An outgoing connection may take over a 4-tuple in TIME_WAIT when the
+    // old one used timestamps.  The timestamp clock offset derives from the
+    // 4-tuple, so the new segments carry larger timestamps, and PAWS at the
+    // peer tells them from old duplicates.  Leave a tick for the last
+    // segments of the old connection to drain.
+    if (!i->second.timestamps || _time_wait_tick - i->second.entered < 1) {
+        return false;
+    }
+    _time_wait.erase(i);
+    _time_wait_reused++;
+    return true;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::respond_from_time_wait(connid id, const time_wait_entry& e) {
+    // <SEQ=SND.NXT><ACK=RCV.NXT><CTL=ACK>
+    tcp_option opt;
+    opt._timestamps_received = e.timestamps;
+    opt._local_ts_val = ts_clock() + e.ts_offset;
+    opt._local_ts_ecr = e.ts_recent;
+    auto options_size = opt.get_size(false, true);
+    packet p;
+    auto th = p.prepend_header<tcp_hdr>(options_size);
+    th->src_port = id.local_port;
+    th->dst_port = id.foreign_port;
+    th->seq = e.snd_next;
+    th->ack = e.rcv_next;
+    th->f_ack = true;
+    th->data_offset = (sizeof(*th) + options_size) / 4;
+    th->checksum = 0;
+    opt.fill(th, options_size);
+    *th = hton(*th);
+    send_segment_without_tcb(id, std::move(p), sizeof(tcp_hdr) + options_size);
+}
+
+template <typename InetTraits>
+tcp_seq tcp<InetTraits>::make_syn_cookie(connid id, tcp_seq their_isn, unsigned mss_idx) {
+    // RFC4987 3.6, as Linux does it: the top 8 bits count 64 second
+    // periods, the low 24 bits hash the 4-tuple with that count and add
+    // the MSS index.  The peer's ISN makes the cookie differ between
+    // connection attempts.
+    auto count = uint32_t(std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() / 64);
+    uint32_t h1[4], h2[4];
+    tcb::hash_4tuple(h1, id, tcb::_isn_secret.key[14]);
+    tcb::hash_4tuple(h2, id, tcb::_isn_secret.key[13] + count);
+    return make_seq(h1[0] + their_isn.raw + (count << 24) + ((h2[0] + mss_idx) & 0xffffff));
+}
+
+template <typename InetTraits>
+std::experimental::optional<uint16_t> tcp<InetTraits>::check_syn_cookie(connid id, const tcp_hdr& h) {
+    auto now = std::chrono::steady_clock::now();
+    // Cookies live for two 64 second periods at most
+    if (!_last_syn_cookie_sent || now - *_last_syn_cookie_sent > std::chrono::seconds(2 * 64)) {
+        return {};
+    }
+    auto count = uint32_t(std::chrono::duration_cast<std::chrono::seconds>(
+            now.time_since_epoch()).count() / 64);
+    tcp_seq seg_seq = h.seq;
+    tcp_seq seg_ack = h.ack;
+    uint32_t h1[4], h2[4];
+    tcb::hash_4tuple(h1, id, tcb::_isn_secret.key[14]);
+    auto cookie = (seg_ack - 1).raw - h1[0] - (seg_seq - 1).raw;
+    // Accept cookies from this period and the previous one
+    auto age = (count - (cookie >> 24)) & 0xff;
+    if (age <= 1) {
+        tcb::hash_4tuple(h2, id, tcb::_isn_secret.key[13] + count - age);
+        auto mss = syn_cookie_mss((cookie - h2[0]) & 0xffffff);
+        if (mss) {
+            return mss;
+        }
+    }
+    _syn_cookies_failed++;
+    return {};
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::send_syn_cookie(connid id, const tcp_hdr& h, packet& p) {
+    tcp_option syn;
+    auto opt_len = h.data_offset * 4 - sizeof(tcp_hdr);
+    auto opt_start = reinterpret_cast<uint8_t*>(p.get_header(sizeof(tcp_hdr), opt_len));
+    if (opt_start) {
+        syn.parse(opt_start, opt_start + opt_len);
+    }
+    unsigned mss_idx = 0;
+    while (syn_cookie_mss(mss_idx + 1) && syn_cookie_mss(mss_idx + 1) <= syn._remote_mss) {
+        mss_idx++;
+    }
+    tcp_seq their_isn = h.seq;
+
+    // <SEQ=cookie><ACK=SEG.SEQ+1><CTL=SYN,ACK>
+    tcp_option opt;
+    opt._mss_received = true;
+    opt._local_mss = local_mss();
+    if (syn._timestamps_received) {
+        // Only the timestamp comes back in the ACK, so it carries the
+        // other options the SYN offered.  Round it down so it does not run
+        // ahead of the clock.
+        uint32_t bits = syn._win_scale_received ? std::min(syn._remote_win_scale, uint8_t(14)) : 0xf;
+        if (syn._sack_received) {
+            bits |= 0x10;
+        }
+        auto now = ts_clock() + tcb::ts_offset(id);
+        auto ts = (now & ~syn_cookie_ts_mask) | bits;
+        if (int32_t(ts - now) > 0) {
+            ts -= syn_cookie_ts_mask + 1;
+        }
+        opt._timestamps_received = true;
+        opt._win_scale_received = syn._win_scale_received;
+        opt._local_win_scale = 7;
+        opt._sack_received = syn._sack_received;
+        opt._local_ts_val = ts;
+        opt._local_ts_ecr = syn._remote_ts_val;
+    }
+    auto options_size = opt.get_size(true, true);
+    packet synack;
+    auto th = synack.prepend_header<tcp_hdr>(options_size);
+    th->src_port = id.local_port;
+    th->dst_port = id.foreign_port;
+    th->seq = make_syn_cookie(id, their_isn, mss_idx);
+    th->ack = their_isn + 1;
+    th->f_syn = true;
+    th->f_ack = true;
+    // The window in a SYN is never scaled
+    th->window = 0xffff;
+    th->data_offset = (sizeof(*th) + options_size) / 4;
+    th->checksum = 0;
+    opt.fill(th, options_size);
+    *th = hton(*th);
+    _syn_cookies_sent++;
+    _last_syn_cookie_sent = std::chrono::steady_clock::now();
+    send_segment_without_tcb(id, std::move(synack), sizeof(tcp_hdr) + options_size);
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::send_segment_without_tcb(connid id, packet p, uint8_t tcp_hdr_len) {
+    auto th = p.get_header<tcp_hdr>(0);
+    checksummer csum;
+    InetTraits::tcp_pseudo_header_checksum(csum, id.local_ip, id.foreign_ip, p.len());
+    if (hw_features().tx_csum_l4_offload) {
+        th->checksum = ~csum.get();
+    } else {
+        csum.sum(p);
+        th->checksum = csum.get();
+    }
+
+    offload_info oi;
+    oi.protocol = ip_protocol_num::tcp;
+    oi.tcp_hdr_len = tcp_hdr_len;
+    p.set_offload_info(oi);
+
+    send_packet_without_tcb(id.local_ip, id.foreign_ip, std::move(p));
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::send_packet_without_tcb(ipaddr from, ipaddr to, packet p) {
     if (_queue_space.try_wait(p.len())) { // drop packets that do not fit the queue
@@ -767,12 +1418,13 @@ tcp<InetTraits>::connection::~connection() {
 }
 
 template <typename InetTraits>
-tcp<InetTraits>::tcb::tcb(tcp& t, connid id)
+tcp<InetTraits>::tcb::tcb(tcp& t, connid id, tcp_congestion_algorithm cc)
     : _tcp(t)
     , _local_ip(id.local_ip)
     , _foreign_ip(id.foreign_ip)
     , _local_port(id.local_port)
     , _foreign_port(id.foreign_port)
+    , _cc(make_tcp_congestion_control(cc))
     , _delayed_ack([this] { _nr_full_seg_received = 0; output(); })
     , _retransmit([this] { retransmit(); })
     , _persist([this] { persist(); }) {
@@ -825,14 +1477,17 @@ void tcp<InetTraits>::respond_with_reset(tcp_hdr* rth, ipaddr local_ip, ipaddr f
 template <typename InetTraits>
 uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack) {
     uint32_t total_acked_bytes = 0;
+    std::experimental::optional<clock_type::time_point> tx_time;
+    bool retransmitted = false;
     // Full ACK of segment
     while (!_snd.data.empty()
             && (_snd.unacknowledged + _snd.data.front().data_remaining <= seg_ack)) {
         auto acked_bytes = _snd.data.front().data_remaining;
         _snd.unacknowledged += acked_bytes;
-        // Ignore retransmitted segments when setting the RTO
         if (_snd.data.front().nr_transmits == 0) {
-            update_rto(_snd.data.front().tx_time);
+            tx_time = _snd.data.front().tx_time;
+        } else {
+            retransmitted = true;
         }
         update_cwnd(acked_bytes);
         total_acked_bytes += acked_bytes;
@@ -852,6 +1507,16 @@ uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack) {
         update_cwnd(acked_bytes);
         total_acked_bytes += acked_bytes;
     }
+    // Take one RTT sample per ACK.  The send time of the newest segment it
+    // covers is precise, but Karn's algorithm rules it out when anything
+    // acked was retransmitted.  The echoed timestamp identifies the
+    // transmission, so it works then too, with 1ms resolution (RFC7323 4.1).
+    if (tx_time && !retransmitted) {
+        update_rto(std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - *tx_time));
+    } else if (total_acked_bytes && _option._remote_ts_present && _option._remote_ts_ecr
+            && int32_t(ts_now() - _option._remote_ts_ecr) >= 0) {
+        update_rto(std::chrono::milliseconds(int32_t(ts_now() - _option._remote_ts_ecr)));
+    }
     return total_acked_bytes;
 }
 
@@ -880,20 +1545,33 @@ template <typename InetTraits>
 void tcp<InetTraits>::tcb::init_from_options(tcp_hdr* th, uint8_t* opt_start, uint8_t* opt_end) {
     // Handle tcp options
     _option.parse(opt_start, opt_end);
+    init_from_negotiated_options(th);
+}
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::init_from_negotiated_options(tcp_hdr* th) {
     // Remote receive window scale factor
     _snd.window_scale = _option._remote_win_scale;
     // Local receive window scale factor
     _rcv.window_scale = _option._local_win_scale;
 
-    // Maximum segment size remote can receive
-    _snd.mss = _option._remote_mss;
+    // Maximum segment size remote can receive.  It leaves no room for
+    // options (RFC6691), so the ones every segment carries come out of it.
+    _snd.mss = _option._remote_mss - _option.get_size(false, true);
     // Maximum segment size local can receive
     _rcv.mss = _option._local_mss = local_mss();
 
-    // Linux's default window size
-    _rcv.window = 29200 << _rcv.window_scale;
-    _snd.window = th->window << _snd.window_scale;
+    // The SYN's timestamp is the first one to echo
+    _rcv.ts_recent = _option._remote_ts_val;
+    _rcv.last_ack_sent = _rcv.next;
+
+    _rcv.buf_size = _rcv_buf_initial;
+    _rcv.window = receive_space();
+    _rcv.window_edge = _rcv.next + _rcv.window;
+    _rcv.space_time = clock_type::now();
+    // The window in a SYN is never scaled; the final ACK of a SYN cookie
+    // handshake is the first segment that gets here with a scaled one
+    _snd.window = th->f_syn ? uint32_t(th->window) : uint32_t(th->window) << _snd.window_scale;
 
     // Segment sequence number used for last window update
     _snd.wl1 = th->seq;
@@ -916,7 +1594,7 @@ void tcp<InetTraits>::tcb::init_from_options(tcp_hdr* th, uint8_t* opt_start, ui
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_listen_state(tcp_hdr* th, packet p) {
     auto opt_start = p.get_header<uint8_t>(sizeof(tcp_hdr));
-    auto opt_end = opt_start + th->data_offset * 4;
+    auto opt_end = opt_start + th->data_offset * 4 - sizeof(tcp_hdr);
     p.trim_front(th->data_offset * 4);
     tcp_seq seg_seq = th->seq;
 
@@ -938,13 +1616,55 @@ void tcp<InetTraits>::tcb::input_handle_listen_state(tcp_hdr* th, packet p) {
 
     tcp_debug("listen: LISTEN -> SYN_RECEIVED\n");
     init_from_options(th, opt_start, opt_end);
+    _passive = true;
     do_syn_received();
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::input_handle_syn_cookie(tcp_hdr* th, uint16_t mss, packet p) {
+    // Rebuild what the SYN would have left behind: both ISNs are one below
+    // the sequence and acknowledgment numbers of the ACK
+    tcp_seq seg_seq = th->seq;
+    tcp_seq seg_ack = th->ack;
+    _rcv.initial = seg_seq - 1;
+    _rcv.next = seg_seq;
+    _rcv.urgent = _rcv.next;
+    _snd.initial = seg_ack - 1;
+    _snd.unacknowledged = _snd.initial;
+    _snd.next = seg_ack;
+    _snd.recover = _snd.initial;
+    _snd.high_rxt = _snd.initial;
+    _snd.ts_offset = ts_offset(connid{_local_ip, _foreign_ip, _local_port, _foreign_port});
+
+    auto opt_start = p.get_header<uint8_t>(sizeof(tcp_hdr));
+    auto opt_end = opt_start + th->data_offset * 4 - sizeof(tcp_hdr);
+    _option.parse(opt_start, opt_end);
+    _option._mss_received = true;
+    _option._remote_mss = mss;
+    if (_option._timestamps_received) {
+        // The SYN's other options came back in the echoed timestamp
+        auto bits = _option._remote_ts_ecr & tcp::syn_cookie_ts_mask;
+        if ((bits & 0xf) != 0xf) {
+            _option._win_scale_received = true;
+            _option._remote_win_scale = bits & 0xf;
+            _option._local_win_scale = 7;
+        }
+        _option._sack_received = bits & 0x10;
+        auto rtt = std::max(int32_t(ts_now() - _option._remote_ts_ecr), 0);
+        _snd.syn_tx_time = clock_type::now() - std::chrono::milliseconds(rtt);
+    }
+    init_from_negotiated_options(th);
+    _passive = true;
+
+    tcp_debug("listen: LISTEN -> SYN_RECEIVED (syn cookie)\n");
+    _state = SYN_RECEIVED;
+    input_handle_other_state(th, std::move(p));
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_syn_sent_state(tcp_hdr* th, packet p) {
     auto opt_start = p.get_header<uint8_t>(sizeof(tcp_hdr));
-    auto opt_end = opt_start + th->data_offset * 4;
+    auto opt_end = opt_start + th->data_offset * 4 - sizeof(tcp_hdr);
     p.trim_front(th->data_offset * 4);
     tcp_seq seg_seq = th->seq;
     auto seg_ack = th->ack;
@@ -1012,6 +1732,20 @@ void tcp<InetTraits>::tcb::input_handle_syn_sent_state(tcp_hdr* th, packet p) {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
+    // Only SACK blocks and timestamps are of interest after the handshake
+    _option._nr_remote_sack_blocks = 0;
+    _option._remote_ts_present = false;
+    auto opt_len = th->data_offset * 4 - sizeof(tcp_hdr);
+    if (opt_len && (sack_enabled() || timestamps_enabled())) {
+        auto opt_start = reinterpret_cast<uint8_t*>(p.get_header(sizeof(tcp_hdr), opt_len));
+        if (opt_start) {
+            auto ts_negotiated = timestamps_enabled();
+            _option.parse(opt_start, opt_start + opt_len);
+            // Timestamps not agreed on in the handshake are ignored
+            _option._timestamps_received = ts_negotiated;
+            _option._remote_ts_present &= ts_negotiated;
+        }
+    }
     p.trim_front(th->data_offset * 4);
     bool do_output = false;
     bool do_output_data = false;
@@ -1019,12 +1753,25 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
     auto seg_ack = th->ack;
     auto seg_len = p.len();
 
+    if (_option._remote_ts_present && !th->f_rst
+            && int32_t(_option._remote_ts_val - _rcv.ts_recent) < 0) {
+        // RFC7323 5.3 PAWS: an old duplicate from a previous wrap of the
+        // sequence space, acknowledge and drop it
+        return output();
+    }
+
     // 4.1 first check sequence number
     if (!segment_acceptable(seg_seq, seg_len)) {
         //<SEQ=SND.NXT><ACK=RCV.NXT><CTL=ACK>
         return output();
     }
 
+    if (_option._remote_ts_present && seg_seq <= _rcv.last_ack_sent
+            && _rcv.last_ack_sent <= seg_seq + seg_len + th->f_fin) {
+        // RFC7323 4.3: remember the timestamp to echo
+        _rcv.ts_recent = _option._remote_ts_val;
+    }
+
     // In the following it is assumed that the segment is the idealized
     // segment that begins at RCV.NXT and does not exceed the window.
     if (seg_seq < _rcv.next) {
@@ -1104,6 +1851,19 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
             // If SND.UNA =< SEG.ACK =< SND.NXT then enter ESTABLISHED state
             // and continue processing.
             if (_snd.unacknowledged <= seg_ack && seg_ack <= _snd.next) {
+                if (_passive) {
+                    auto l = _tcp._listening.find(_local_port);
+                    if (l == _tcp._listening.end()) {
+                        respond_with_reset(th);
+                        return do_reset();
+                    }
+                    if (l->second->_q.full()) {
+                        // Stay half open until accept() makes room; the
+                        // peer retransmits
+                        return;
+                    }
+                    l->second->_q.push(connection(this->shared_from_this()));
+                }
                 tcp_debug("SYN_RECEIVED -> ESTABLISHED\n");
                 do_established();
             } else {
@@ -1127,6 +1887,9 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
         // ESTABLISHED STATE or
         // CLOSE_WAIT STATE: Do the same processing as for the ESTABLISHED state.
         if (in_state(ESTABLISHED | CLOSE_WAIT)){
+            if (_option._nr_remote_sack_blocks) {
+                update_sack_scoreboard();
+            }
             // If SND.UNA < SEG.ACK =< SND.NXT then, set SND.UNA <- SEG.ACK.
             if (_snd.unacknowledged < seg_ack && seg_ack <= _snd.next) {
                 // Remote ACKed data we sent
@@ -1162,6 +1925,14 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                         // Exit the fast recovery procedure
                         exit_fast_recovery();
                         set_retransmit_timer();
+                    } else if (sack_enabled()) {
+                        tcp_debug("ack: partial_ack (sack)\n");
+                        // The scoreboard knows which holes remain; cwnd
+                        // stays at ssthresh until recovery ends (RFC6675)
+                        sack_retransmit();
+                        if (++_snd.partial_ack == 1) {
+                            start_retransmit_timer();
+                        }
                     } else {
                         tcp_debug("ack: partial_ack\n");
                         // Retransmit the first unacknowledged segment
@@ -1206,6 +1977,11 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                 // Here, We follow RFC5681.
                 _snd.dupacks++;
                 uint32_t smss = _snd.mss;
+                if (_snd.dupacks < _dupthresh && sack_enabled() && _snd.data.front().lost) {
+                    // RFC6675: the scoreboard already shows the first
+                    // segment lost, no need to wait for more duplicates
+                    _snd.dupacks = _dupthresh;
+                }
                 // 3 duplicated ACKs trigger a fast retransmit
                 if (_snd.dupacks == 1 || _snd.dupacks == 2) {
                     // RFC5681 Step 3.1
@@ -1216,13 +1992,32 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                     if (seg_ack - 1 > _snd.recover) {
                         _snd.recover = _snd.next - 1;
                         // RFC5681 Step 3.2
-                        _snd.ssthresh = std::max((flight_size() - _snd.limited_transfer) / 2, 2 * smss);
+                        _cc->on_loss(cc_window(), flight_size() - _snd.limited_transfer);
+                        if (sack_enabled()) {
+                            // RFC6675 Step 4.3: the first hole is
+                            // retransmitted regardless of the pipe
+                            auto& front = _snd.data.front();
+                            front.lost = true;
+                            _snd.high_rxt = _snd.unacknowledged + front.data_remaining;
+                        }
                         fast_retransmit();
                     } else {
                         // Do not enter fast retransmit and do not reset ssthresh
                     }
-                    // RFC5681 Step 3.3
-                    _snd.cwnd = _snd.ssthresh + 3 * smss;
+                    if (sack_enabled()) {
+                        // RFC6675 Step 4.2, then fill the pipe
+                        _snd.cwnd = _snd.ssthresh;
+                        sack_retransmit();
+                        do_output_data = true;
+                    } else {
+                        // RFC5681 Step 3.3
+                        _snd.cwnd = _snd.ssthresh + 3 * smss;
+                    }
+                } else if (_snd.dupacks > 3 && sack_enabled()) {
+                    // Each duplicate may have SACKed more data, which drains
+                    // the pipe and may prove more holes lost
+                    sack_retransmit();
+                    do_output_data = true;
                 } else if (_snd.dupacks > 3) {
                     // RFC5681 Step 3.4
                     _snd.cwnd += smss;
@@ -1275,12 +2070,8 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
             }
         }
         // TIME_WAIT STATE
-        if (in_state(TIME_WAIT)) {
-            // The only thing that can arrive in this state is a
-            // retransmission of the remote FIN. Acknowledge it, and restart
-            // the 2 MSL timeout.
-            // TODO
-        }
+        // The tcb leaves _tcbs on entering TIME_WAIT; tcp::received()
+        // answers retransmitted FINs from the time wait table
     }
 
     // 4.6 sixth, check the URG bit
@@ -1295,6 +2086,7 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
             // RCV.NXT over the data accepted, and adjusts RCV.WND as
             // apporopriate to the current buffer availability.  The total of
             // RCV.NXT and RCV.WND should not be reduced.
+            _rcv.data_size += p.len();
             _rcv.data.push_back(std::move(p));
             _rcv.next += seg_len;
             auto merged = merge_out_of_order();
@@ -1421,8 +2213,53 @@ void tcp<InetTraits>::tcb::output_one() {
     packet p = get_transmit_packet();
     uint16_t len = p.len();
     bool syn_on = syn_needs_on();
+    tcp_seq seq = syn_on ? _snd.initial : _snd.next;
+    _snd.next += len;
+
+    // FIXME: does the FIN have to fit in the window?
+    bool fin_on = fin_needs_on();
+
+    if (len || syn_on || fin_on) {
+        auto now = clock_type::now();
+        // A segment the NIC or the interface will cut up is acknowledged,
+        // SACKed and retransmitted MSS by MSS, like the ones it is cut into
+        for (unsigned off = 0; off < len; off += _snd.mss) {
+            uint16_t seg_len = std::min(unsigned(len - off), unsigned(_snd.mss));
+            unsigned nr_transmits = 0;
+            _snd.data.emplace_back(unacked_segment{p.share(off, seg_len), seg_len, seg_len, nr_transmits, now, false, false});
+        }
+        if (!_retransmit.armed()) {
+            start_retransmit_timer();
+        }
+    }
+
+    prepend_header(p, seq, syn_on, fin_on);
+    queue_packet(std::move(p));
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::retransmit_segment(unacked_segment& seg, tcp_seq seq) {
+    // Only what the peer has not acknowledged yet goes again, under a
+    // fresh header
+    auto p = seg.p.share(seg.data_len - seg.data_remaining, seg.data_remaining);
+    bool fin_on = fin_needs_on() && seq + seg.data_remaining == _snd.next;
+    seg.nr_transmits++;
+    prepend_header(p, seq, false, fin_on);
+    queue_packet(std::move(p));
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::prepend_header(packet& p, tcp_seq seq, bool syn_on, bool fin_on) {
+    uint16_t len = p.len();
     bool ack_on = ack_needs_on();
 
+    if (ack_on && sack_enabled()) {
+        set_sack_blocks();
+    }
+    if (timestamps_enabled() || (syn_on && !ack_on)) {
+        _option._local_ts_val = ts_now();
+        _option._local_ts_ecr = ack_on ? _rcv.ts_recent : 0;
+    }
     auto options_size = _option.get_size(syn_on, ack_on);
     auto th = p.prepend_header<tcp_hdr>(options_size);
 
@@ -1437,16 +2274,22 @@ void tcp<InetTraits>::tcb::output_one() {
     th->f_urg = false;
     th->f_psh = false;
 
-    th->seq = syn_on ? _snd.initial : _snd.next;
+    th->seq = seq;
     th->ack = _rcv.next;
+    if (ack_on) {
+        _rcv.last_ack_sent = _rcv.next;
+    }
     th->data_offset = (sizeof(*th) + options_size) / 4;
-    th->window = _rcv.window >> _rcv.window_scale;
+    if (syn_on) {
+        // The window in a SYN is never scaled
+        th->window = std::min(_rcv.window, uint32_t(0xffff));
+        _rcv.window_edge = _rcv.next + uint32_t(th->window);
+    } else {
+        update_receive_window();
+        th->window = _rcv.window >> _rcv.window_scale;
+        _rcv.window_edge = _rcv.next + (uint32_t(th->window) << _rcv.window_scale);
+    }
     th->checksum = 0;
-
-    _snd.next += len;
-
-    // FIXME: does the FIN have to fit in the window?
-    bool fin_on = fin_needs_on();
     th->f_fin = fin_on;
 
     // Add tcp options
@@ -1459,25 +2302,23 @@ void tcp<InetTraits>::tcb::output_one() {
 
     oi.tcp_hdr_len = sizeof(tcp_hdr) + options_size;
 
-    if (_tcp.hw_features().tx_csum_l4_offload) {
+    //
+    // tx checksum offloading: both virtio-net's VIRTIO_NET_F_CSUM dpdk's
+    // PKT_TX_TCP_CKSUM - requires th->checksum to be initialized to ones'
+    // complement sum of the pseudo header.
+    //
+    // For TSO the csum should be calculated for a pseudo header with
+    // segment length set to 0. All the rest is the same as for a TCP Tx
+    // CSUM offload case.  Segmentation done in software by the interface
+    // (see tcp_gso_segment()) completes the checksum of each segment
+    // instead, so a super-segment is never summed here.
+    //
+    if (_tcp.hw_features().tx_tso && len > _snd.mss) {
         oi.needs_csum = true;
-
-        //
-        // tx checksum offloading: both virtio-net's VIRTIO_NET_F_CSUM dpdk's
-        // PKT_TX_TCP_CKSUM - requires th->checksum to be initialized to ones'
-        // complement sum of the pseudo header.
-        //
-        // For TSO the csum should be calculated for a pseudo header with
-        // segment length set to 0. All the rest is the same as for a TCP Tx
-        // CSUM offload case.
-        //
-        if (_tcp.hw_features().tx_tso &&
-            p.len() > _snd.mss + sizeof(eth_hdr) + oi.ip_hdr_len +
-                      oi.tcp_hdr_len) {
-            oi.tso_seg_size = _snd.mss;
-        } else {
-            pseudo_hdr_seg_len = sizeof(*th) + options_size + len;
-        }
+        oi.tso_seg_size = _snd.mss;
+    } else if (_tcp.hw_features().tx_csum_l4_offload) {
+        oi.needs_csum = true;
+        pseudo_hdr_seg_len = sizeof(*th) + options_size + len;
     } else {
         pseudo_hdr_seg_len = sizeof(*th) + options_size + len;
         oi.needs_csum = false;
@@ -1486,7 +2327,7 @@ void tcp<InetTraits>::tcb::output_one() {
     InetTraits::tcp_pseudo_header_checksum(csum, _local_ip, _foreign_ip,
                                            pseudo_hdr_seg_len);
 
-    if (_tcp.hw_features().tx_csum_l4_offload) {
+    if (oi.needs_csum) {
         th->checksum = ~csum.get();
     } else {
         csum.sum(p);
@@ -1496,19 +2337,6 @@ void tcp<InetTraits>::tcb::output_one() {
     oi.protocol = ip_protocol_num::tcp;
 
     p.set_offload_info(oi);
-
-    if (len || syn_on || fin_on) {
-        auto now = clock_type::now();
-        if (len) {
-            unsigned nr_transmits = 0;
-            _snd.data.emplace_back(unacked_segment{p.share(), len, len, nr_transmits, now});
-        }
-        if (!_retransmit.armed()) {
-            start_retransmit_timer(now);
-        }
-    }
-
-    queue_packet(std::move(p));
 }
 
 template <typename InetTraits>
@@ -1540,8 +2368,8 @@ void tcp<InetTraits>::tcb::connect() {
     _rcv.window_scale = _option._local_win_scale = 7;
     // Maximum segment size local can receive
     _rcv.mss = _option._local_mss = local_mss();
-    // Linux's default window size
-    _rcv.window = 29200 << _rcv.window_scale;
+    _rcv.buf_size = _rcv_buf_initial;
+    _rcv.window = _rcv.buf_size;
 
     do_syn_sent();
 }
@@ -1553,6 +2381,10 @@ packet tcp<InetTraits>::tcb::read() {
         p.append(std::move(q));
     }
     _rcv.data.clear();
+    _rcv.data_size = 0;
+    if (p.len()) {
+        update_receive_buffer(p.len());
+    }
     return p;
 }
 
@@ -1562,7 +2394,7 @@ future<> tcp<InetTraits>::tcb::send(packet p) {
     assert(!_snd.closed);
 
     if (in_state(CLOSED)) {
-        return make_exception_future<>(tcp_reset_error());
+        return make_exception_future<>(static_exception_ptr<tcp_reset_error>());
     }
 
     // TODO: Handle p.len() > max user_queue_space case
@@ -1660,6 +2492,7 @@ bool tcp<InetTraits>::tcb::merge_out_of_order() {
                 seg_len -= trim;
             }
             _rcv.next += seg_len;
+            _rcv.data_size += p.len();
             _rcv.data.push_back(std::move(p));
             // Since c++11, erase() always returns the value of the following element
             it = _rcv.out_of_order.map.erase(it);
@@ -1679,9 +2512,112 @@ bool tcp<InetTraits>::tcb::merge_out_of_order() {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::insert_out_of_order(tcp_seq seg, packet p) {
+    _rcv.last_out_of_order = seg;
     _rcv.out_of_order.merge(seg, std::move(p));
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::set_sack_blocks() {
+    auto& blocks = _option._local_sack_blocks;
+    auto& map = _rcv.out_of_order.map;
+    unsigned n = 0;
+    // RFC2018: the first block must contain the most recently received
+    // segment; the others repeat older blocks, so a lost ACK loses nothing
+    auto recent = map.end();
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        auto end = it->first + it->second.len();
+        if (it->first <= _rcv.last_out_of_order && _rcv.last_out_of_order < end) {
+            blocks[n++] = {it->first, end};
+            recent = it;
+            break;
+        }
+    }
+    auto max = timestamps_enabled() ? tcp_option::max_sack_blocks_with_timestamps : tcp_option::max_sack_blocks;
+    for (auto it = map.begin(); it != map.end() && n < max; ++it) {
+        if (it != recent) {
+            blocks[n++] = {it->first, it->first + it->second.len()};
+        }
+    }
+    _option._nr_local_sack_blocks = n;
+}
+
+template <typename InetTraits>
+uint32_t tcp<InetTraits>::tcb::receive_space() {
+    // What is left of the receive buffer, limited to what the window field
+    // can express
+    auto space = _rcv.buf_size > _rcv.data_size ? _rcv.buf_size - _rcv.data_size : 0;
+    return std::min(space, uint32_t(0xffff) << _rcv.window_scale);
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_receive_window() {
+    auto window = receive_space();
+    // Shrinking the window must not move its right edge back (RFC7323 2.4)
+    if (_rcv.next + window < _rcv.window_edge) {
+        window = align_up(uint32_t(_rcv.window_edge - _rcv.next), uint32_t(1) << _rcv.window_scale);
+    }
+    // Open the window in steps of at least min(buffer / 2, MSS), to avoid
+    // silly window syndrome (RFC1122 4.2.3.3)
+    auto current = _rcv.window_edge > _rcv.next ? uint32_t(_rcv.window_edge - _rcv.next) : 0;
+    if (window > current && window - current < std::min(_rcv.buf_size / 2, uint32_t(_rcv.mss))) {
+        // Scaling must not round the edge we keep back either
+        window = align_up(current, uint32_t(1) << _rcv.window_scale);
+    }
+    _rcv.window = window;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_receive_buffer(uint32_t read_bytes) {
+    // Once per round trip, compare what the application read with the most
+    // it ever read in one.  If it read more, the sender is likely window
+    // limited: allow twice that, so the window keeps ahead of the sender
+    // while its congestion window grows.
+    _rcv.copied += read_bytes;
+    auto now = clock_type::now();
+    if (!_snd.first_rto_sample && now - _rcv.space_time >= _snd.srtt) {
+        if (_rcv.copied > _rcv.space) {
+            _rcv.space = _rcv.copied;
+            auto buf_size = std::min(2 * _rcv.space, _rcv_buf_max);
+            if (buf_size > _rcv.buf_size) {
+                _rcv.buf_size = buf_size;
+                _tcp._rcv_buf_grown++;
+            }
+        }
+        _rcv.copied = 0;
+        _rcv.space_time = now;
+    }
+    // Tell the peer about the space the read freed up, if it is worth it
+    auto current = _rcv.window_edge > _rcv.next ? uint32_t(_rcv.window_edge - _rcv.next) : 0;
+    if (in_state(ESTABLISHED | FIN_WAIT_1 | FIN_WAIT_2)
+            && receive_space() >= current + std::min(_rcv.buf_size / 2, uint32_t(_rcv.mss))) {
+        output();
+    }
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::shrink_receive_buffer() {
+    // Data beyond a hole is the only memory we can give back right away;
+    // the peer keeps its copy until it is acknowledged (RFC2018 8)
+    _rcv.out_of_order.map.clear();
+    // The window already advertised stays open, so the buffer must keep
+    // room for it on top of what waits to be read
+    auto promised = _rcv.window_edge > _rcv.next ? uint32_t(_rcv.window_edge - _rcv.next) : 0;
+    auto buf_size = std::max({_rcv.buf_size / 2, _rcv_buf_min, _rcv.data_size + promised});
+    if (buf_size < _rcv.buf_size) {
+        _rcv.buf_size = buf_size;
+        // Growing back needs reads beyond what made the buffer this large
+        _rcv.space = buf_size;
+        _tcp._rcv_buf_shrunk++;
+    }
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::shrink_receive_buffers() {
+    _tcbs.for_each([] (const connid&, lw_shared_ptr<tcb>& t) {
+        t->shrink_receive_buffer();
+    });
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::trim_receive_data_after_window() {
     abort();
@@ -1742,25 +2678,26 @@ void tcp<InetTraits>::tcb::retransmit() {
     // According to RFC5681
     // Update ssthresh only for the first retransmit
     uint32_t smss = _snd.mss;
-    if (unacked_seg.nr_transmits == 0) {
-        _snd.ssthresh = std::max(flight_size() / 2, 2 * smss);
-    }
+    _cc->on_timeout(cc_window(), flight_size(), unacked_seg.nr_transmits == 0);
     // RFC6582 Step 4
     _snd.recover = _snd.next - 1;
+    // RFC2018: the receiver may have discarded SACKed data, so forget the scoreboard
+    for (auto& seg : _snd.data) {
+        seg.sacked = false;
+        seg.lost = false;
+    }
     // Start the slow start process
     _snd.cwnd = smss;
     // End fast recovery
     exit_fast_recovery();
 
-    if (unacked_seg.nr_transmits < _max_nr_retransmit) {
-        unacked_seg.nr_transmits++;
-    } else {
+    if (unacked_seg.nr_transmits >= _max_nr_retransmit) {
         // Delete connection when max num of retransmission is reached
         cleanup();
         return;
     }
     // TODO: If the Path MTU changes, we need to split the segment if it is larger than current MSS
-    queue_packet(unacked_seg.p.share());
+    retransmit_segment(unacked_seg, _snd.unacknowledged);
 
     output_update_rto();
 }
@@ -1768,17 +2705,93 @@ void tcp<InetTraits>::tcb::retransmit() {
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::fast_retransmit() {
     if (!_snd.data.empty()) {
-        auto& unacked_seg = _snd.data.front();
-        unacked_seg.nr_transmits++;
-        queue_packet(unacked_seg.p.share());
+        retransmit_segment(_snd.data.front(), _snd.unacknowledged);
+        output();
+    }
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_sack_scoreboard() {
+    // RFC6675 Update(): mark the segments covered by the received blocks
+    for (unsigned i = 0; i < _option._nr_remote_sack_blocks; ++i) {
+        auto& b = _option._remote_sack_blocks[i];
+        // Ignore D-SACK blocks (below SND.UNA) and bogus ones
+        if (b.right <= b.left || b.left < _snd.unacknowledged || b.right > _snd.next) {
+            continue;
+        }
+        auto seq = _snd.unacknowledged;
+        for (auto& seg : _snd.data) {
+            auto end = seq + seg.data_remaining;
+            if (end > b.right) {
+                break;
+            }
+            if (b.left <= seq) {
+                seg.sacked = true;
+            }
+            seq = end;
+        }
+    }
+    // RFC6675 IsLost(): a hole is lost once DupThresh segments, or more
+    // than (DupThresh - 1) * SMSS bytes, have been SACKed above it
+    uint32_t sacked_bytes = 0;
+    unsigned sacked_segs = 0;
+    for (auto it = _snd.data.rbegin(); it != _snd.data.rend(); ++it) {
+        if (it->sacked) {
+            sacked_bytes += it->data_remaining;
+            sacked_segs++;
+        } else if (sacked_segs >= _dupthresh || sacked_bytes > (_dupthresh - 1) * uint32_t(_snd.mss)) {
+            it->lost = true;
+        }
+    }
+}
+
+template <typename InetTraits>
+uint32_t tcp<InetTraits>::tcb::sack_pipe() {
+    // RFC6675 SetPipe(): an estimate of the bytes still in the network
+    uint32_t pipe = 0;
+    auto seq = _snd.unacknowledged;
+    for (auto& seg : _snd.data) {
+        if (!seg.sacked) {
+            if (!seg.lost) {
+                pipe += seg.data_remaining;
+            }
+            if (seq < _snd.high_rxt) {
+                pipe += seg.data_remaining;
+            }
+        }
+        seq += seg.data_remaining;
+    }
+    return pipe;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::sack_retransmit() {
+    // RFC6675 NextSeg() rule 1: retransmit the lost holes above HighRxt,
+    // as long as cwnd leaves room in the pipe
+    auto pipe = sack_pipe();
+    auto seq = _snd.unacknowledged;
+    bool queued = false;
+    for (auto& seg : _snd.data) {
+        if (pipe >= _snd.cwnd) {
+            break;
+        }
+        if (!seg.sacked && seg.lost && seq >= _snd.high_rxt) {
+            retransmit_segment(seg, seq);
+            _snd.high_rxt = seq + seg.data_remaining;
+            pipe += seg.data_remaining;
+            queued = true;
+        }
+        seq += seg.data_remaining;
+    }
+    if (queued) {
         output();
     }
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
+void tcp<InetTraits>::tcb::update_rto(std::chrono::microseconds R) {
+    _cc->on_rtt_sample(R);
     // Update RTO according to RFC6298
-    auto R = std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - tx_time);
     if (_snd.first_rto_sample) {
         _snd.first_rto_sample = false;
         // RTTVAR <- R/2
@@ -1796,22 +2809,19 @@ void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
     // RTO <- SRTT + max(G, K * RTTVAR)
     _rto =  _snd.srtt + std::max(_rto_clk_granularity, 4 * _snd.rttvar);
 
-    // Make sure 1 sec << _rto << 60 sec
-    _rto = std::max(_rto, _rto_min);
+    // Make sure rto_min << _rto << 60 sec
+    _rto = std::max(_rto, _tcp._rto_min);
     _rto = std::min(_rto, _rto_max);
 }
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::update_cwnd(uint32_t acked_bytes) {
-    uint32_t smss = _snd.mss;
-    if (_snd.cwnd < _snd.ssthresh) {
-        // In slow start phase
-        _snd.cwnd += std::min(acked_bytes, smss);
-    } else {
-        // In congestion avoidance phase
-        uint32_t round_up = 1;
-        _snd.cwnd += std::max(round_up, smss * smss / _snd.cwnd);
+    // During fast recovery the window follows the recovery procedure
+    // (RFC6582, RFC6675) instead
+    if (_snd.dupacks >= _dupthresh) {
+        return;
     }
+    _cc->on_ack(cc_window(), acked_bytes);
 }
 
 template <typename InetTraits>
@@ -1820,11 +2830,30 @@ void tcp<InetTraits>::tcb::cleanup() {
     _snd.data.clear();
     _rcv.out_of_order.map.clear();
     _rcv.data.clear();
+    _rcv.data_size = 0;
     stop_retransmit_timer();
     clear_delayed_ack();
+    leave_half_open();
     remove_from_tcbs();
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::hash_4tuple(uint32_t (&hash)[4], connid id, uint32_t salt) {
+    hash[0] = id.local_ip.ip;
+    hash[1] = id.foreign_ip.ip;
+    hash[2] = (id.local_port << 16) + id.foreign_port;
+    hash[3] = salt;
+    CryptoPP::Weak::MD5::Transform(hash, _isn_secret.key);
+}
+
+template <typename InetTraits>
+uint32_t tcp<InetTraits>::tcb::ts_offset(connid id) {
+    // Same as get_isn() leaves in _snd.ts_offset
+    uint32_t hash[4];
+    hash_4tuple(hash, id, _isn_secret.key[15]);
+    return hash[1];
+}
+
 template <typename InetTraits>
 tcp_seq tcp<InetTraits>::tcb::get_isn() {
     // Per RFC6528, TCP SHOULD generate its Initial Sequence Numbers
@@ -1833,14 +2862,13 @@ tcp_seq tcp<InetTraits>::tcb::get_isn() {
     //   M is the 4 microsecond timer
     using namespace std::chrono;
     uint32_t hash[4];
-    hash[0] = _local_ip.ip;
-    hash[1] = _foreign_ip.ip;
-    hash[2] = (_local_port << 16) + _foreign_port;
-    hash[3] = _isn_secret.key[15];
-    CryptoPP::Weak::MD5::Transform(hash, _isn_secret.key);
+    hash_4tuple(hash, connid{_local_ip, _foreign_ip, _local_port, _foreign_port}, _isn_secret.key[15]);
     auto seq = hash[0];
     auto m = duration_cast<microseconds>(clock_type::now().time_since_epoch());
     seq += m.count() / 4;
+    // RFC7323 5.4 offsets the timestamp clock the same way, so a new
+    // incarnation of the connection continues where the last one left off
+    _snd.ts_offset = hash[1];
     return make_seq(seq);
 }
 
@@ -1859,10 +2887,11 @@ std::experimental::optional<typename InetTraits::l4packet> tcp<InetTraits>::tcb:
 
     auto p = std::move(_packetq.front());
     _packetq.pop_front();
-    if (!_packetq.empty() || (_snd.dupacks < 3 && can_send() > 0)) {
+    if (!_packetq.empty() || ((_snd.dupacks < 3 || sack_enabled()) && can_send() > 0)) {
         // If there are packets to send in the queue or tcb is allowed to send
         // more add tcp back to polling set to keep sending. In addition, dupacks >= 3
-        // is an indication that an segment is lost, stop sending more in this case.
+        // is an indication that an segment is lost, stop sending more in this case,
+        // unless SACK tells us how much data has left the network.
         output();
     }
     return std::move(p);
@@ -1881,13 +2910,22 @@ template <typename InetTraits>
 constexpr uint16_t tcp<InetTraits>::tcb::_max_nr_retransmit;
 
 template <typename InetTraits>
-constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_min;
+constexpr uint16_t tcp<InetTraits>::tcb::_dupthresh;
+
+template <typename InetTraits>
+constexpr uint32_t tcp<InetTraits>::tcb::_rcv_buf_min;
+
+template <typename InetTraits>
+constexpr uint32_t tcp<InetTraits>::tcb::_rcv_buf_initial;
+
+template <typename InetTraits>
+constexpr uint32_t tcp<InetTraits>::tcb::_rcv_buf_max;
 
 template <typename InetTraits>
-constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_max;
+constexpr std::chrono::microseconds tcp<InetTraits>::tcb::_rto_max;
 
 template <typename InetTraits>
-constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_clk_granularity;
+constexpr std::chrono::microseconds tcp<InetTraits>::tcb::_rto_clk_granularity;
 
 template <typename InetTraits>
 typename tcp<InetTraits>::tcb::isn_secret tcp<InetTraits>::tcb::_isn_secret;
@@ -455,6 +455,7 @@ bool vring<BufferChain, Completion>::do_complete() {
         }
         _free_last = id;
     }
+    _complete.bunch_done();
     return count;
 }
 
@@ -498,6 +499,7 @@ protected:
                 q._ring.available_descriptors().signal(p.nr_frags());
             }
             void bunch(uint64_t c) {}
+            void bunch_done() {}
         };
         qp& _dev;
         vring<packet_as_buffer_chain, complete> _ring;
@@ -528,12 +530,19 @@ protected:
             void bunch(uint64_t c) {
                 q.update_rx_count(c);
             }
+            void bunch_done() {
+                if (!q._burst.empty()) {
+                    q._dev._dev->l2receive(q._burst);
+                }
+            }
         };
         qp& _dev;
         vring<single_buffer, complete> _ring;
         unsigned _remaining_buffers = 0;
         std::vector<fragment> _fragments;
         std::vector<std::unique_ptr<char[], free_deleter>> _buffers;
+        // Frames completed by the current poll, delivered together
+        std::vector<packet> _burst;
     public:
         rxq(qp& _if, ring_config config);
         void set_notifier(std::unique_ptr<notifier> notifier) {
@@ -698,7 +707,7 @@ qp::rxq::complete_buffer(single_buffer&& bc, size_t len) {
             del = make_object_deleter(std::move(_buffers));
         }
         packet p(_fragments.begin(), _fragments.end(), std::move(del));
-        _dev._dev->l2receive(std::move(p));
+        _burst.push_back(std::move(p));
         _ring.available_descriptors().signal(_fragments.size());
     }
 }
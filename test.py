@@ -27,6 +27,18 @@ all_tests = [
     'memcached/test_ascii_parser',
     'sstring_test',
     'output_stream_test',
+    'lsa_test',
+    'thread_test',
+    'posix_zero_copy_test',
+    'sendfile_test',
+    'tcp_sack_test',
+    'tcp_syn_cookie_test',
+    'tcp_gro_test',
+    'tcp_rto_test',
+    'tcp_receive_window_test',
+    'tcp_time_wait_test',
+    'connection_table_test',
+    'gso_test',
 ]
 
 last_len = 0
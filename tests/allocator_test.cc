@@ -20,6 +20,7 @@
  */
 
 #include "core/memory.hh"
+#include "core/object_pool.hh"
 #include <random>
 #include <cmath>
 #include <iostream>
@@ -41,6 +42,108 @@ void test_aligned_allocator() {
     }
 }
 
+// Grows nr_buffers buffers side by side with realloc(), multiplying their
+// size by growth_factor each step, and reports how many of the reallocations
+// had to move (and copy) the data compared to a copy-always realloc().
+void test_realloc_growth(unsigned nr_buffers, double growth_factor, size_t max_size) {
+    struct buffer {
+        char* data = nullptr;
+        size_t size = 0;
+        char poison;
+    };
+    std::vector<buffer> buffers(nr_buffers);
+    for (unsigned i = 0; i < nr_buffers; ++i) {
+        buffers[i].poison = 'a' + i;
+    }
+    size_t reallocs = 0, moves = 0, copied = 0, naive_copied = 0;
+    size_t size = 16;
+    while (size <= max_size) {
+        for (auto&& b : buffers) {
+            auto p = static_cast<char*>(::realloc(b.data, size));
+            assert(p);
+            ++reallocs;
+            naive_copied += b.size;
+            if (b.data && p != b.data) {
+                ++moves;
+                copied += b.size;
+            }
+            assert(std::all_of(p, p + b.size, [&b] (char c) { return c == b.poison; }));
+            std::fill(p + b.size, p + size, b.poison);
+            b.data = p;
+            b.size = size;
+        }
+        size = std::max<size_t>(size + 1, size * growth_factor);
+    }
+    // shrink back in place and make sure the data survived
+    for (auto&& b : buffers) {
+        auto p = static_cast<char*>(::realloc(b.data, b.size / 2));
+        assert(p);
+        b.size /= 2;
+        assert(std::all_of(p, p + b.size, [&b] (char c) { return c == b.poison; }));
+        ::free(p);
+    }
+    std::cout << "realloc growth x" << growth_factor << ", " << nr_buffers << " buffer(s): "
+            << reallocs << " reallocs, " << moves << " moves, "
+            << copied << " bytes copied (" << naive_copied << " when copying always)\n";
+}
+
+// Compares new/delete with object_pool for a fixed-size object allocated
+// and freed in small bursts, as I/O completions and cache items are.
+template <size_t Size>
+void test_object_pool(unsigned rounds) {
+    struct object {
+        char data[Size];
+    };
+    using clock = std::chrono::high_resolution_clock;
+    constexpr unsigned burst = 16;
+    object* objs[burst];
+    auto run = [&] (auto alloc, auto free) {
+        auto start = clock::now();
+        for (unsigned r = 0; r < rounds; ++r) {
+            for (auto&& o : objs) {
+                o = alloc();
+                o->data[0] = r;
+            }
+            for (auto&& o : objs) {
+                assert(o->data[0] == char(r));
+                free(o);
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        return double(elapsed.count()) / (rounds * burst);
+    };
+    auto plain = run([] { return new object(); }, [] (object* o) { delete o; });
+    auto& pool = object_pool<object>::local();
+    auto pooled = run([&pool] { return pool.construct(); }, [&pool] (object* o) { pool.destroy(o); });
+    auto st = pool.get_stats();
+    assert(st.allocations == st.deallocations);
+    std::cout << "object_pool " << Size << " byte objects: " << std::setprecision(3)
+            << plain << " ns/op with new/delete, " << pooled << " ns/op pooled ("
+            << st.refills << " refills)\n";
+}
+
+// Batches may come back short, but each object must be usable and aligned
+void test_allocate_batch(size_t size, size_t align) {
+    std::vector<void*> objs;
+    void* batch[64];
+    while (objs.size() < 1000) {
+        auto n = memory::allocate_batch(size, align, batch, 64);
+        assert(n >= 1 && n <= 64);
+        objs.insert(objs.end(), batch, batch + n);
+    }
+    for (auto p : objs) {
+        assert(reinterpret_cast<uintptr_t>(p) % align == 0);
+        std::fill_n(static_cast<char*>(p), size, 0x5a);
+    }
+    std::sort(objs.begin(), objs.end());
+    for (size_t i = 1; i < objs.size(); ++i) {
+        assert(static_cast<char*>(objs[i - 1]) + size <= objs[i]);
+    }
+    for (auto p : objs) {
+        ::operator delete(p);
+    }
+}
+
 struct allocation {
     size_t n;
     std::unique_ptr<char[]> data;
@@ -84,6 +187,14 @@ int main(int ac, char** av) {
     test_aligned_allocator<1>();
     test_aligned_allocator<4>();
     test_aligned_allocator<80>();
+    test_realloc_growth(1, 2, 8 << 20);
+    test_realloc_growth(1, 1.5, 8 << 20);
+    test_realloc_growth(4, 2, 2 << 20);
+    test_allocate_batch(48, 8);
+    test_allocate_batch(48, 64);
+    test_allocate_batch(20000, 8);
+    test_object_pool<64>(100000);
+    test_object_pool<200>(100000);
     std::default_random_engine random_engine;
     std::exponential_distribution<> distr(0.2);
     std::uniform_int_distribution<> type(0, 1);
@@ -0,0 +1,112 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "net/connection-table.hh"
+#include <map>
+#include <random>
+
+// Few distinct hashes, so that probe sequences run into each other
+struct colliding_hash {
+    uint32_t operator()(unsigned key) const {
+        return key % 7;
+    }
+};
+
+struct spreading_hash {
+    uint32_t operator()(unsigned key) const {
+        return key * 2654435761u;
+    }
+};
+
+using colliding_table = net::connection_table<unsigned, unsigned, colliding_hash>;
+
+BOOST_AUTO_TEST_CASE(test_insert_find_erase) {
+    colliding_table t;
+    BOOST_REQUIRE(t.insert(1, 10));
+    BOOST_REQUIRE(t.insert(8, 80));
+    BOOST_REQUIRE(!t.insert(1, 11));
+    BOOST_REQUIRE_EQUAL(t.size(), 2u);
+    BOOST_REQUIRE_EQUAL(*t.find(1), 10u);
+    BOOST_REQUIRE_EQUAL(*t.find(8), 80u);
+    BOOST_REQUIRE(!t.find(15));
+    BOOST_REQUIRE(t.erase(1));
+    BOOST_REQUIRE(!t.erase(1));
+    BOOST_REQUIRE(!t.find(1));
+    // 8 shares its home slot with 1, and must be found after 1 is gone
+    BOOST_REQUIRE_EQUAL(*t.find(8), 80u);
+    BOOST_REQUIRE_EQUAL(t.size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_matches_map) {
+    colliding_table t;
+    std::map<unsigned, unsigned> ref;
+    std::default_random_engine rng;
+    std::uniform_int_distribution<unsigned> key(0, 499);
+    for (unsigned i = 0; i < 20000; ++i) {
+        auto k = key(rng);
+        if (i % 3) {
+            BOOST_REQUIRE_EQUAL(t.insert(k, i), ref.emplace(k, i).second);
+        } else {
+            BOOST_REQUIRE_EQUAL(t.erase(k), bool(ref.erase(k)));
+        }
+        BOOST_REQUIRE_EQUAL(t.size(), ref.size());
+    }
+    for (unsigned k = 0; k < 500; ++k) {
+        auto v = t.find(k);
+        auto i = ref.find(k);
+        BOOST_REQUIRE_EQUAL(bool(v), i != ref.end());
+        if (v) {
+            BOOST_REQUIRE_EQUAL(*v, i->second);
+        }
+    }
+    size_t seen = 0;
+    t.for_each([&] (unsigned k, unsigned v) {
+        BOOST_REQUIRE_EQUAL(ref.at(k), v);
+        ++seen;
+    });
+    BOOST_REQUIRE_EQUAL(seen, ref.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_grow_and_shrink) {
+    net::connection_table<unsigned, unsigned, spreading_hash> t;
+    auto initial = t.capacity();
+    for (unsigned k = 0; k < 100000; ++k) {
+        t.insert(k, k);
+    }
+    // Half full at most, so probe sequences stay short
+    BOOST_REQUIRE(t.capacity() >= 2 * t.size());
+    BOOST_REQUIRE(t.max_probe_length() < 64);
+    auto lookups = t.lookups();
+    for (unsigned k = 0; k < 100000; ++k) {
+        BOOST_REQUIRE_EQUAL(*t.find(k), k);
+    }
+    BOOST_REQUIRE_EQUAL(t.lookups(), lookups + 100000);
+    BOOST_REQUIRE(t.probes() < 2 * t.lookups());
+    for (unsigned k = 0; k < 100000; ++k) {
+        BOOST_REQUIRE(t.erase(k));
+    }
+    BOOST_REQUIRE(t.empty());
+    BOOST_REQUIRE_EQUAL(t.capacity(), initial);
+}
@@ -24,6 +24,9 @@
 #include "core/semaphore.hh"
 #include "test-utils.hh"
 #include "core/future-util.hh"
+#include "core/queue.hh"
+#include "core/abort_source.hh"
+#include "core/memory.hh"
 
 class expected_exception : std::runtime_error {
 public:
@@ -232,3 +235,230 @@ SEASTAR_TEST_CASE(test_broken_semaphore) {
     sem->broken(oops());
     return ret;
 }
+
+SEASTAR_TEST_CASE(test_static_exception_skips_continuations) {
+    BOOST_REQUIRE(static_exception_ptr<expected_exception>() == static_exception_ptr<expected_exception>());
+    auto pr = make_lw_shared<promise<int>>();
+    auto f = pr->get_future().then([] (int) {
+        BOOST_FAIL("continuation called on failed future");
+    }).then([] {
+        BOOST_FAIL("continuation called on failed future");
+        return make_ready_future<int>(0);
+    }).then_wrapped([] (future<int> f) {
+        BOOST_REQUIRE(f.failed());
+        return std::move(f).rescue([] (auto get) {
+            try {
+                get();
+                BOOST_FAIL("expecting exception");
+            } catch (expected_exception&) {
+                // ok
+            }
+        });
+    });
+    pr->set_exception(static_exception_ptr<expected_exception>());
+    return f;
+}
+
+SEASTAR_TEST_CASE(test_with_timeout_when_it_times_out) {
+    auto pr = make_lw_shared<promise<int>>();
+    return with_timeout(lowres_clock::now() + std::chrono::milliseconds(20), pr->get_future()).then_wrapped([pr] (future<int> f) mutable {
+        try {
+            f.get();
+            BOOST_FAIL("expecting timed_out_error");
+        } catch (timed_out_error&) {
+            // ok
+        }
+        // a late result is dropped
+        pr->set_value(1);
+        return make_ready_future<>();
+    });
+}
+
+SEASTAR_TEST_CASE(test_with_timeout_when_it_does_not_time_out) {
+    auto pr = make_lw_shared<promise<int>>();
+    auto f = with_timeout(lowres_clock::now() + std::chrono::seconds(60), pr->get_future());
+    pr->set_value(42);
+    return f.then([pr] (int v) {
+        BOOST_REQUIRE_EQUAL(v, 42);
+    });
+}
+
+SEASTAR_TEST_CASE(test_with_timeout_requests_abort) {
+    auto as = make_lw_shared<abort_source>();
+    auto sem = make_lw_shared<semaphore>(0);
+    auto f = sem->wait(*as);
+    return with_timeout(lowres_clock::now() + std::chrono::milliseconds(20), std::move(f), *as).then_wrapped([as, sem] (future<> f) mutable {
+        BOOST_REQUIRE(f.failed());
+        BOOST_REQUIRE(as->abort_requested());
+        // the aborted waiter must not consume units
+        sem->signal(1);
+        BOOST_REQUIRE(sem->try_wait(1));
+        return make_ready_future<>();
+    });
+}
+
+SEASTAR_TEST_CASE(test_semaphore_abort_unblocks_later_waiters) {
+    auto sem = make_lw_shared<semaphore>(1);
+    auto as = make_lw_shared<abort_source>();
+    auto f1 = sem->wait(*as, 2);
+    auto f2 = sem->wait(1);
+    BOOST_REQUIRE(!f1.available());
+    BOOST_REQUIRE(!f2.available());
+    as->request_abort();
+    return std::move(f1).then_wrapped([sem, as, f2 = std::move(f2)] (future<> f1) mutable {
+        try {
+            f1.get();
+            BOOST_FAIL("expecting abort_requested_exception");
+        } catch (abort_requested_exception&) {
+            // ok
+        }
+        return std::move(f2);
+    }).then([sem, as] {
+        // already-aborted sources fail immediately
+        return sem->wait(*as).then_wrapped([] (future<> f) mutable {
+            try {
+                f.get();
+                BOOST_FAIL("expecting abort_requested_exception");
+            } catch (abort_requested_exception&) {
+                // ok
+            }
+            return make_ready_future<>();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_queue_pop_eventually_abort) {
+    auto q = make_lw_shared<queue<int>>(10);
+    auto as = make_lw_shared<abort_source>();
+    auto f = q->pop_eventually(*as);
+    as->request_abort();
+    return std::move(f).then_wrapped([q, as] (future<int> f) mutable {
+        try {
+            f.get();
+            BOOST_FAIL("expecting abort_requested_exception");
+        } catch (abort_requested_exception&) {
+            // ok
+        }
+        // the queue is still usable
+        q->push(7);
+        abort_source as2;
+        return q->pop_eventually(as2).then([] (int v) {
+            BOOST_REQUIRE_EQUAL(v, 7);
+        });
+    });
+}
+
+// Returns a future that resolves from a later task.
+static future<> later() {
+    promise<> p;
+    auto f = p.get_future();
+    schedule(make_task([p = std::move(p)] () mutable {
+        p.set_value();
+    }));
+    return f;
+}
+
+SEASTAR_TEST_CASE(test_do_with_keeps_object_alive) {
+    auto pr = make_lw_shared<promise<>>();
+    auto f = do_with(std::vector<int>{1, 2, 3}, [pr] (std::vector<int>& v) {
+        return pr->get_future().then([&v] {
+            BOOST_REQUIRE_EQUAL(v.size(), 3u);
+            v.push_back(4);
+            return make_ready_future<size_t>(v.size());
+        });
+    });
+    pr->set_value();
+    return f.then([] (size_t n) {
+        BOOST_REQUIRE_EQUAL(n, 4u);
+    });
+}
+
+SEASTAR_TEST_CASE(test_do_with_multiple_objects) {
+    return do_with(sstring("abc"), 3, [] (sstring& s, int& n) {
+        return later().then([&s, &n] {
+            BOOST_REQUIRE_EQUAL(s, "abc");
+            BOOST_REQUIRE_EQUAL(n, 3);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_when_all_range) {
+    auto prs = make_lw_shared<std::vector<promise<int>>>(3);
+    std::vector<future<int>> futures;
+    futures.push_back(make_ready_future<int>(0));
+    for (auto& pr : *prs) {
+        futures.push_back(pr.get_future());
+    }
+    futures.push_back(make_exception_future<int>(expected_exception()));
+    auto f = when_all(futures.begin(), futures.end());
+    // complete out of order
+    (*prs)[2].set_value(3);
+    (*prs)[0].set_value(1);
+    (*prs)[1].set_value(2);
+    return f.then([prs] (std::vector<future<int>> results) {
+        BOOST_REQUIRE_EQUAL(results.size(), 5u);
+        for (int i = 0; i < 4; ++i) {
+            BOOST_REQUIRE_EQUAL(std::get<0>(results[i].get()), i);
+        }
+        BOOST_REQUIRE(results[4].failed());
+        try {
+            results[4].get();
+        } catch (expected_exception&) {
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_map_reduce_with_initial_value) {
+    std::vector<int> v{1, 2, 3, 4};
+    return map_reduce(v.begin(), v.end(), [] (int x) {
+        return later().then([x] {
+            return make_ready_future<int>(x * 10);
+        });
+    }, sstring(), [] (sstring acc, int x) {
+        return acc + to_sstring(x) + ",";
+    }).then([] (sstring result) {
+        BOOST_REQUIRE_EQUAL(result, "10,20,30,40,");
+    });
+}
+
+SEASTAR_TEST_CASE(test_parallel_for_each_propagates_failure) {
+    std::vector<int> v{1, 2, 3};
+    return parallel_for_each(v.begin(), v.end(), [] (int x) {
+        return later().then([x] {
+            if (x == 2) {
+                throw expected_exception();
+            }
+        });
+    }).then_wrapped([] (future<> f) {
+        try {
+            f.get();
+            BOOST_FAIL("expecting expected_exception");
+        } catch (expected_exception&) {
+            // ok
+        }
+        return make_ready_future<>();
+    });
+}
+
+// Gathering the results of many operations that resolve together should not
+// allocate per element.
+SEASTAR_TEST_CASE(test_when_all_range_allocations) {
+    static constexpr unsigned n = 1000;
+    auto prs = make_lw_shared<std::vector<promise<int>>>(n);
+    auto mallocs = memory::stats().mallocs();
+    std::vector<future<int>> futures;
+    futures.reserve(n);
+    for (auto& pr : *prs) {
+        futures.push_back(pr.get_future());
+    }
+    auto f = when_all(futures.begin(), futures.end());
+    for (auto& pr : *prs) {
+        pr.set_value(1);
+    }
+    return f.then([prs, mallocs] (std::vector<future<int>> results) {
+        auto when_all_mallocs = memory::stats().mallocs() - mallocs;
+        BOOST_TEST_MESSAGE("when_all() of " << n << " futures: " << when_all_mallocs << " allocations");
+        // a handful for the vectors and continuations, independent of n
+        BOOST_REQUIRE_LE(when_all_mallocs, 10u);
+    });
+}
@@ -0,0 +1,177 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "net/gso.hh"
+#include "net/ip.hh"
+#include "net/tcp.hh"
+#include "net/ip_checksum.hh"
+#include <string>
+
+using namespace net;
+
+static const ipv4_address src_ip("10.0.0.1");
+static const ipv4_address dst_ip("10.0.0.2");
+static constexpr uint32_t first_seq = 0xfffff000;
+static constexpr uint16_t first_id = 0xfffe;
+
+static std::string make_payload(size_t len) {
+    std::string s(len, 0);
+    for (size_t i = 0; i < len; ++i) {
+        s[i] = char(i % 251);
+    }
+    return s;
+}
+
+// An Ethernet frame carrying a TCP super-segment, as the interface sees
+// it when TCP hands it down for segmentation
+static packet make_super_segment(const std::string& payload, uint16_t mss, bool fin) {
+    packet p(payload.data(), payload.size());
+    auto th = p.prepend_header<tcp_hdr>();
+    th->src_port = 10000;
+    th->dst_port = 20000;
+    th->seq = make_seq(first_seq);
+    th->ack = make_seq(1);
+    th->rsvd1 = 0;
+    th->data_offset = sizeof(tcp_hdr) / 4;
+    th->f_fin = fin;
+    th->f_syn = false;
+    th->f_rst = false;
+    th->f_psh = true;
+    th->f_ack = true;
+    th->f_urg = false;
+    th->rsvd2 = 0;
+    th->window = 1000;
+    th->checksum = 0;
+    th->urgent = 0;
+    *th = hton(*th);
+    auto iph = p.prepend_header<ip_hdr>();
+    iph->ihl = sizeof(ip_hdr) / 4;
+    iph->ver = 4;
+    iph->dscp = 0;
+    iph->ecn = 0;
+    iph->len = p.len();
+    iph->id = first_id;
+    iph->frag = 0;
+    iph->ttl = 64;
+    iph->ip_proto = uint8_t(ip_protocol_num::tcp);
+    iph->csum = 0;
+    iph->src_ip = src_ip;
+    iph->dst_ip = dst_ip;
+    *iph = hton(*iph);
+    auto eh = p.prepend_header<eth_hdr>();
+    eh->dst_mac = ethernet_address{0x02, 0, 0, 0, 0, 2};
+    eh->src_mac = ethernet_address{0x02, 0, 0, 0, 0, 1};
+    eh->eth_proto = uint16_t(eth_protocol_num::ipv4);
+    *eh = hton(*eh);
+    offload_info oi;
+    oi.protocol = ip_protocol_num::tcp;
+    oi.needs_csum = true;
+    oi.tso_seg_size = mss;
+    p.set_offload_info(oi);
+    return p;
+}
+
+// Checks every segment as a receiver would, and returns their payload
+static std::string check_segments(circular_buffer<packet>& segs, const hw_features& hw,
+        uint16_t mss, bool fin) {
+    std::string payload;
+    uint16_t id = first_id;
+    for (size_t i = 0; i < segs.size(); ++i) {
+        auto& seg = segs[i];
+        bool last = i == segs.size() - 1;
+        seg.linearize();
+        auto data = seg.get_header(0, seg.len());
+        auto ip_data = data + sizeof(eth_hdr);
+        auto tcp_data = ip_data + sizeof(ip_hdr);
+        auto iph = ntoh(*reinterpret_cast<ip_hdr*>(ip_data));
+        auto th = ntoh(*reinterpret_cast<tcp_hdr*>(tcp_data));
+        size_t len = seg.len() - sizeof(eth_hdr) - sizeof(ip_hdr) - sizeof(tcp_hdr);
+
+        BOOST_REQUIRE(len > 0);
+        if (last) {
+            BOOST_REQUIRE(len <= mss);
+        } else {
+            BOOST_REQUIRE_EQUAL(len, mss);
+        }
+        BOOST_REQUIRE_EQUAL(iph.len, seg.len() - sizeof(eth_hdr));
+        BOOST_REQUIRE_EQUAL(iph.id, id++);
+        BOOST_REQUIRE_EQUAL(th.seq - make_seq(first_seq), int32_t(payload.size()));
+        BOOST_REQUIRE_EQUAL(bool(th.f_psh), last);
+        BOOST_REQUIRE_EQUAL(bool(th.f_fin), fin && last);
+        BOOST_REQUIRE(th.f_ack);
+        BOOST_REQUIRE_EQUAL(seg.offload_info().tso_seg_size, 0);
+
+        if (!hw.tx_csum_ip_offload) {
+            checksummer csum;
+            csum.sum(ip_data, sizeof(ip_hdr));
+            BOOST_REQUIRE_EQUAL(csum.get(), 0);
+        }
+        checksummer csum;
+        ipv4_traits::tcp_pseudo_header_checksum(csum, src_ip, dst_ip, sizeof(tcp_hdr) + len);
+        if (hw.tx_csum_l4_offload) {
+            // Left for the device, which expects the pseudo header sum
+            BOOST_REQUIRE(seg.offload_info().needs_csum);
+            auto raw_csum = reinterpret_cast<tcp_hdr*>(tcp_data)->checksum;
+            BOOST_REQUIRE_EQUAL(uint16_t(raw_csum), uint16_t(~csum.get()));
+        } else {
+            BOOST_REQUIRE(!seg.offload_info().needs_csum);
+            csum.sum(tcp_data, sizeof(tcp_hdr) + len);
+            BOOST_REQUIRE_EQUAL(csum.get(), 0);
+        }
+        payload.append(tcp_data + sizeof(tcp_hdr), len);
+    }
+    return payload;
+}
+
+static void test_segmentation(size_t payload_len, uint16_t mss, bool fin, hw_features hw) {
+    auto payload = make_payload(payload_len);
+    circular_buffer<packet> segs;
+    tcp_gso_segment(make_super_segment(payload, mss, fin), hw, segs);
+    BOOST_REQUIRE_EQUAL(segs.size(), (payload_len + mss - 1) / mss);
+    BOOST_REQUIRE(check_segments(segs, hw, mss, fin) == payload);
+}
+
+BOOST_AUTO_TEST_CASE(test_software_checksums) {
+    test_segmentation(5000, 1460, false, hw_features());
+}
+
+BOOST_AUTO_TEST_CASE(test_offloaded_checksums) {
+    hw_features hw;
+    hw.tx_csum_ip_offload = true;
+    hw.tx_csum_l4_offload = true;
+    test_segmentation(5000, 1460, false, hw);
+}
+
+BOOST_AUTO_TEST_CASE(test_fin_on_last_segment) {
+    test_segmentation(4000, 1000, true, hw_features());
+}
+
+BOOST_AUTO_TEST_CASE(test_odd_sizes) {
+    // Odd segment sizes put the payload of every other segment at an odd
+    // offset of the super-segment
+    test_segmentation(1, 1447, false, hw_features());
+    test_segmentation(1447 * 3 + 1, 1447, true, hw_features());
+    test_segmentation(60000, 1447, false, hw_features());
+}
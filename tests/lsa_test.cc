@@ -0,0 +1,168 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/lsa.hh"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Objects start with a pointer to the handle that refers to them, so the
+// migrator can find and update it.
+struct handle {
+    void* obj = nullptr;
+    size_t size = 0;
+    char fill = 0;
+    bool pinned = false;
+};
+
+class handle_migrator : public lsa::migrator {
+public:
+    virtual bool migrate(void* src, void* dst, size_t size) noexcept override {
+        auto h = *reinterpret_cast<handle**>(src);
+        if (h->pinned) {
+            return false;
+        }
+        std::memcpy(dst, src, size);
+        h->obj = dst;
+        return true;
+    }
+};
+
+static handle_migrator migrator;
+
+static void make_object(lsa::region& r, handle& h, size_t size, char fill) {
+    h.obj = r.allocate(size, migrator);
+    h.size = size;
+    h.fill = fill;
+    *reinterpret_cast<handle**>(h.obj) = &h;
+    std::fill_n(static_cast<char*>(h.obj) + sizeof(handle*), size - sizeof(handle*), fill);
+}
+
+static void verify_object(handle& h) {
+    BOOST_REQUIRE(*reinterpret_cast<handle**>(h.obj) == &h);
+    auto p = static_cast<char*>(h.obj) + sizeof(handle*);
+    BOOST_REQUIRE(std::all_of(p, p + h.size - sizeof(handle*), [&h] (char c) { return c == h.fill; }));
+}
+
+BOOST_AUTO_TEST_CASE(test_compaction_preserves_live_objects) {
+    lsa::region r;
+    std::vector<handle> handles(20000);
+    std::default_random_engine re;
+    std::uniform_int_distribution<size_t> sizes(16, 2000);
+    for (size_t i = 0; i < handles.size(); ++i) {
+        make_object(r, handles[i], sizes(re), char(i));
+    }
+    auto segments_before = r.stats().segments;
+    for (size_t i = 0; i < handles.size(); i += 2) {
+        lsa::region::free(handles[i].obj);
+        handles[i].obj = nullptr;
+    }
+    BOOST_REQUIRE(r.stats().occupancy() < 0.6);
+    auto released = r.compact(std::numeric_limits<size_t>::max());
+    BOOST_REQUIRE(released > 0);
+    BOOST_REQUIRE(r.stats().segments < segments_before * 3 / 4);
+    BOOST_REQUIRE(r.stats().occupancy() > 0.8);
+    for (auto&& h : handles) {
+        if (h.obj) {
+            verify_object(h);
+            lsa::region::free(h.obj);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(r.stats().live_bytes, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_pinned_objects_stay) {
+    lsa::region r;
+    std::vector<handle> handles(1000);
+    for (size_t i = 0; i < handles.size(); ++i) {
+        make_object(r, handles[i], 1000, char(i));
+    }
+    for (size_t i = 0; i < handles.size(); ++i) {
+        if (i % 10) {
+            lsa::region::free(handles[i].obj);
+            handles[i].obj = nullptr;
+        } else {
+            handles[i].pinned = true;
+        }
+    }
+    std::vector<void*> where;
+    for (auto&& h : handles) {
+        where.push_back(h.obj);
+    }
+    r.compact(std::numeric_limits<size_t>::max());
+    BOOST_REQUIRE(r.stats().refused_migrations > 0);
+    for (size_t i = 0; i < handles.size(); ++i) {
+        BOOST_REQUIRE(handles[i].obj == where[i]);
+        if (handles[i].obj) {
+            verify_object(handles[i]);
+            lsa::region::free(handles[i].obj);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_large_objects) {
+    lsa::region r;
+    handle h;
+    make_object(r, h, lsa::region::max_managed_object_size + 1, 'x');
+    BOOST_REQUIRE_EQUAL(r.stats().segments, 0);
+    BOOST_REQUIRE_EQUAL(r.stats().large_bytes, lsa::region::max_managed_object_size + 1);
+    BOOST_REQUIRE(lsa::region::of(h.obj) == &r);
+    verify_object(h);
+    lsa::region::free(h.obj);
+    BOOST_REQUIRE_EQUAL(r.stats().large_bytes, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_shrink) {
+    lsa::region r;
+    handle a, b;
+    make_object(r, a, 1000, 'a');
+    make_object(r, b, 100, 'b');
+    auto live = r.stats().live_bytes;
+    lsa::region::shrink(a.obj, 100);
+    a.size = 100;
+    BOOST_REQUIRE_EQUAL(lsa::region::object_size(a.obj), 100);
+    BOOST_REQUIRE(r.stats().live_bytes < live - 800);
+    verify_object(a);
+    verify_object(b);
+    lsa::region::free(a.obj);
+    lsa::region::free(b.obj);
+    BOOST_REQUIRE_EQUAL(r.stats().live_bytes, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_objects_outliving_region) {
+    handle h1, h2;
+    {
+        lsa::region r;
+        make_object(r, h1, 100, '1');
+        make_object(r, h2, lsa::region::max_managed_object_size * 2, '2');
+    }
+    verify_object(h1);
+    verify_object(h2);
+    BOOST_REQUIRE(!lsa::region::of(h1.obj));
+    BOOST_REQUIRE(!lsa::region::of(h2.obj));
+    lsa::region::free(h1.obj);
+    lsa::region::free(h2.obj);
+}
@@ -127,3 +127,153 @@ SEASTAR_TEST_CASE(test_flush_on_empty_buffer_does_not_push_empty_packet_down_str
         BOOST_REQUIRE(v->empty());
     });
 }
+
+// Runs @writes against a fresh stream, flushes, and returns what reached the sink.
+template <typename Writes>
+future<std::vector<sstring>> collect_puts(stream_maker maker, Writes writes) {
+    auto v = make_shared<std::vector<packet>>();
+    auto out = maker(data_sink(std::make_unique<vector_data_sink>(*v)));
+    return writes(*out).then([out] {
+        return out->flush();
+    }).then([out, v] {
+        std::vector<sstring> ret;
+        for (auto& p : *v) {
+            ret.push_back(to_sstring(p));
+        }
+        return make_ready_future<std::vector<sstring>>(std::move(ret));
+    });
+}
+
+SEASTAR_TEST_CASE(test_mixing_buffered_and_zero_copy_writes) {
+    auto ctor = stream_maker().trim(false).size(8);
+    return collect_puts(ctor, [] (output_stream<char>& out) {
+        return out.write("ab").then([&out] {
+            return out.write(packet("cd", 2));
+        }).then([&out] {
+            return out.write("ef");
+        });
+    }).then([] (std::vector<sstring> puts) {
+        // coalesced into a single packet on flush
+        BOOST_REQUIRE_EQUAL(puts.size(), 1u);
+        BOOST_REQUIRE_EQUAL(puts[0], "abcdef");
+    }).then([ctor] {
+        return collect_puts(ctor, [] (output_stream<char>& out) {
+            return out.write("ab").then([&out] {
+                return out.write(packet("cd", 2));
+            }).then([&out] {
+                return out.write("efghijklm");
+            }).then([&out] {
+                return out.write("n");
+            });
+        });
+    }).then([] (std::vector<sstring> puts) {
+        // sent once the buffer size is reached, in order
+        BOOST_REQUIRE_EQUAL(puts.size(), 2u);
+        BOOST_REQUIRE_EQUAL(puts[0], "abcdefghijklm");
+        BOOST_REQUIRE_EQUAL(puts[1], "n");
+    }).then([] {
+        return collect_puts(stream_maker().trim(true).size(4), [] (output_stream<char>& out) {
+            return out.write("ab").then([&out] {
+                return out.write(packet("cdefgh", 6));
+            }).then([&out] {
+                return out.write("ij");
+            });
+        });
+    }).then([] (std::vector<sstring> puts) {
+        // trimmed streams keep buffered data and packets in separate puts
+        std::vector<sstring> expected{"ab", "cdef", "gh", "ij"};
+        BOOST_REQUIRE(puts == expected);
+    });
+}
+
+SEASTAR_TEST_CASE(test_batched_flushes_are_coalesced) {
+    auto v = make_shared<std::vector<packet>>();
+    auto out = make_shared<output_stream<char>>(
+        data_sink(std::make_unique<vector_data_sink>(*v)), 8, false, true);
+    // several responses flushed from the same task go out in one put
+    return out->write("ab").then([out] {
+        return out->flush();
+    }).then([out] {
+        return out->write("cd");
+    }).then([out] {
+        return out->flush();
+    }).then([out, v] {
+        BOOST_REQUIRE(v->empty());
+        return out->close();
+    }).then([out, v] {
+        BOOST_REQUIRE_EQUAL(v->size(), 1u);
+        BOOST_REQUIRE_EQUAL(to_sstring((*v)[0]), "abcd");
+    });
+}
+
+static sstring concat(const std::vector<packet>& v) {
+    sstring ret;
+    for (auto& p : v) {
+        ret += to_sstring(p);
+    }
+    return ret;
+}
+
+SEASTAR_TEST_CASE(test_batched_bulk_write_keeps_order) {
+    // A write too big for the buffer drains it first; that must not wait
+    // for the batch, or the bulk data would overtake the buffered bytes
+    auto v = make_shared<std::vector<packet>>();
+    auto out = make_shared<output_stream<char>>(
+        data_sink(std::make_unique<vector_data_sink>(*v)), 8, false, true);
+    return out->write("ab").then([out] {
+        return out->write("cdefghijklmnopqrstuvwxyz");
+    }).then([out] {
+        return out->close();
+    }).then([out, v] {
+        BOOST_REQUIRE_EQUAL(concat(*v), "abcdefghijklmnopqrstuvwxyz");
+    }).then([] {
+        // same for a packet written after buffered data to a trimmed stream
+        auto v = make_shared<std::vector<packet>>();
+        auto out = make_shared<output_stream<char>>(
+            data_sink(std::make_unique<vector_data_sink>(*v)), 4, true, true);
+        return out->write("ab").then([out] {
+            return out->write(packet("cdefgh", 6));
+        }).then([out] {
+            return out->close();
+        }).then([out, v] {
+            BOOST_REQUIRE_EQUAL(concat(*v), "abcdefgh");
+        });
+    });
+}
+
+// Resolves once the reactor has been through its pollers again
+static future<> next_poll() {
+    auto pr = make_lw_shared<promise<>>();
+    auto t = make_lw_shared<::timer<>>([pr] { pr->set_value(); });
+    t->arm(std::chrono::milliseconds(1));
+    return pr->get_future().then([t] {});
+}
+
+SEASTAR_TEST_CASE(test_batched_stream_leaves_batch) {
+    auto v = make_shared<std::vector<packet>>();
+    auto out = std::make_unique<output_stream<char>>(
+        data_sink(std::make_unique<vector_data_sink>(*v)), 8, false, true);
+    return out->write("ab").then([out = std::move(out)] () mutable {
+        auto f = out->flush();
+        // destroyed while queued: the reactor must not poll it
+        out.reset();
+        return f;
+    }).then([] {
+        return next_poll();
+    }).then([v] {
+        BOOST_REQUIRE(v->empty());
+        auto out = make_lw_shared<output_stream<char>>(
+            data_sink(std::make_unique<vector_data_sink>(*v)), 8, false, true);
+        return out->write("cd").then([out] {
+            return out->flush();
+        }).then([out, v] {
+            // moved while queued: the new stream is flushed
+            auto moved = make_lw_shared<output_stream<char>>(std::move(*out));
+            return next_poll().then([moved, v] {
+                BOOST_REQUIRE_EQUAL(v->size(), 1u);
+                BOOST_REQUIRE_EQUAL(to_sstring((*v)[0]), "cd");
+                return moved->close();
+            });
+        });
+    });
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#include "core/reactor.hh"
+#include "core/shared_ptr.hh"
+#include "core/future-util.hh"
+#include "net/posix-stack.hh"
+#include "net/packet.hh"
+#include "test-utils.hh"
+
+using namespace net;
+
+static constexpr size_t message_size = 1 << 20;
+
+struct loopback_pair {
+    pollable_fd listener;
+    std::experimental::optional<pollable_fd> client;
+    std::experimental::optional<pollable_fd> server;
+    std::string received;
+    bool released = false;
+    loopback_pair(pollable_fd l) : listener(std::move(l)) {}
+};
+
+static future<> receive_all(lw_shared_ptr<loopback_pair> lp, data_source& src) {
+    return src.get().then([lp, &src] (temporary_buffer<char> buf) {
+        if (buf.empty()) {
+            return make_ready_future<>();
+        }
+        lp->received.append(buf.get(), buf.size());
+        return receive_all(lp, src);
+    });
+}
+
+SEASTAR_TEST_CASE(test_zero_copy_send_over_loopback) {
+    listen_options lo;
+    lo.reuse_address = true;
+    auto sa = make_ipv4_address({0x7f000001, 10010});
+    auto lp = make_lw_shared<loopback_pair>(engine().posix_listen(sa, lo));
+    auto accepted = lp->listener.accept();
+    return engine().posix_connect(sa).then([lp, accepted = std::move(accepted)] (pollable_fd fd) mutable {
+        lp->client = std::move(fd);
+        return std::move(accepted);
+    }).then([lp] (pollable_fd fd, socket_address) {
+        lp->server = std::move(fd);
+        auto sink = make_lw_shared<data_sink>(posix_data_sink(*lp->client, 64 * 1024));
+        auto src = make_lw_shared<data_source>(posix_data_source(*lp->server));
+        std::string expected;
+        for (size_t i = 0; i < message_size; ++i) {
+            expected.push_back('a' + i % 26);
+        }
+        auto msg = new char[message_size];
+        std::copy(expected.begin(), expected.end(), msg);
+        packet p(fragment{msg, message_size}, make_deleter([lp, msg] {
+            lp->released = true;
+            delete[] msg;
+        }));
+        // the receiver must run concurrently, or the sender blocks once the
+        // socket buffers fill up
+        auto received = receive_all(lp, *src);
+        return sink->put(std::move(p)).then([sink] {
+            // waits until the kernel no longer references the packet
+            return sink->close();
+        }).then([lp] {
+            BOOST_REQUIRE(lp->released);
+        }).then([received = std::move(received)] () mutable {
+            return std::move(received);
+        }).then([lp, src, expected = std::move(expected)] {
+            BOOST_REQUIRE(lp->received == expected);
+        });
+    });
+}
+
+static future<> wait_for_release(lw_shared_ptr<loopback_pair> lp, unsigned tries = 1000) {
+    if (lp->released || !tries) {
+        return make_ready_future<>();
+    }
+    auto pr = make_lw_shared<promise<>>();
+    auto t = make_lw_shared<::timer<>>([pr] { pr->set_value(); });
+    t->arm(std::chrono::milliseconds(1));
+    return pr->get_future().then([lp, t, tries] {
+        return wait_for_release(lp, tries - 1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_zero_copy_sink_destroyed_without_close) {
+    listen_options lo;
+    lo.reuse_address = true;
+    auto sa = make_ipv4_address({0x7f000001, 10011});
+    auto lp = make_lw_shared<loopback_pair>(engine().posix_listen(sa, lo));
+    auto accepted = lp->listener.accept();
+    return engine().posix_connect(sa).then([lp, accepted = std::move(accepted)] (pollable_fd fd) mutable {
+        lp->client = std::move(fd);
+        return std::move(accepted);
+    }).then([lp] (pollable_fd fd, socket_address) {
+        lp->server = std::move(fd);
+        auto sink = make_lw_shared<data_sink>(posix_data_sink(*lp->client, 64 * 1024));
+        auto src = make_lw_shared<data_source>(posix_data_source(*lp->server));
+        std::string expected;
+        for (size_t i = 0; i < message_size; ++i) {
+            expected.push_back('a' + i % 26);
+        }
+        auto msg = new char[message_size];
+        std::copy(expected.begin(), expected.end(), msg);
+        packet p(fragment{msg, message_size}, make_deleter([lp, msg] {
+            lp->released = true;
+            delete[] msg;
+        }));
+        auto received = receive_all(lp, *src);
+        return sink->put(std::move(p)).then([lp, sink] () mutable {
+            // Neither the sink nor the connection waits for the kernel,
+            // but the packet must stay pinned until it is done with it.
+            sink = {};
+            lp->client = {};
+        }).then([received = std::move(received)] () mutable {
+            return std::move(received);
+        }).then([lp, src, expected = std::move(expected)] {
+            BOOST_REQUIRE(lp->received == expected);
+            return wait_for_release(lp);
+        }).then([lp] {
+            BOOST_REQUIRE(lp->released);
+        });
+    });
+}
@@ -22,6 +22,9 @@
 #include "core/reactor.hh"
 #include "core/app-template.hh"
 #include "core/print.hh"
+#include "core/future-util.hh"
+#include "core/memory.hh"
+#include <chrono>
 
 future<bool> test_smp_call() {
     return smp::submit_to(1, [] {
@@ -55,6 +58,54 @@ future<bool> test_smp_exception() {
     });
 }
 
+// Round trip latency of a trivial submit_to(), one message in flight.
+future<bool> test_smp_ping_pong() {
+    using clock = std::chrono::steady_clock;
+    auto n = make_lw_shared<unsigned>(0);
+    auto mallocs = memory::stats().mallocs();
+    auto start = clock::now();
+    auto end = start + std::chrono::milliseconds(200);
+    return do_until([n, end] { return clock::now() >= end; }, [n] {
+        return smp::submit_to(1, [n = *n] {
+            return make_ready_future<unsigned>(n + 1);
+        }).then([n] (unsigned next) {
+            *n = next;
+        });
+    }).then([n, start, mallocs] {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        auto rounds = std::max(*n, 1u);
+        print("ping-pong: %d round trips, %d ns and %.2f local allocations per round trip\n", *n,
+                elapsed.count() / rounds, double(memory::stats().mallocs() - mallocs) / rounds);
+        return make_ready_future<bool>(*n > 0);
+    });
+}
+
+// Throughput with many messages in flight from this cpu to every other cpu.
+future<bool> test_smp_throughput() {
+    using clock = std::chrono::steady_clock;
+    static constexpr unsigned in_flight = 64;
+    auto n = make_lw_shared<size_t>(0);
+    auto start = clock::now();
+    auto end = start + std::chrono::milliseconds(200);
+    auto workers = make_lw_shared<std::vector<unsigned>>();
+    for (unsigned i = 0; i < in_flight * (smp::count - 1); ++i) {
+        workers->push_back(1 + i % (smp::count - 1));
+    }
+    return parallel_for_each(workers->begin(), workers->end(), [n, end] (unsigned cpu) {
+        return do_until([end] { return clock::now() >= end; }, [n, cpu] {
+            return smp::submit_to(cpu, [] {
+                return make_ready_future<>();
+            }).then([n] {
+                ++*n;
+            });
+        });
+    }).then([n, start, workers] {
+        auto elapsed = std::chrono::duration<double>(clock::now() - start);
+        print("throughput: %d messages in flight, %.0f messages/s\n", workers->size(), *n / elapsed.count());
+        return make_ready_future<bool>(*n > 0);
+    });
+}
+
 int tests, fails;
 
 future<>
@@ -70,6 +121,10 @@ int main(int ac, char** av) {
     return app_template().run(ac, av, [] {
        return report("smp call", test_smp_call()).then([] {
            return report("smp exception", test_smp_exception());
+       }).then([] {
+           return report("smp ping-pong", test_smp_ping_pong());
+       }).then([] {
+           return report("smp throughput", test_smp_throughput());
        }).then([] {
            print("\n%d tests / %d failures\n", tests, fails);
            engine().exit(fails ? 1 : 0);
@@ -0,0 +1,431 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#pragma once
+
+// Two native stacks, a client and a server, connected back to back by a
+// simulated wire, for exercising TCP without a NIC.
+
+#include "core/reactor.hh"
+#include "core/shared_ptr.hh"
+#include "core/future-util.hh"
+#include "core/print.hh"
+#include "net/ip.hh"
+#include "net/tcp.hh"
+#include <deque>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using tcp_type = net::tcp<net::ipv4_traits>;
+
+constexpr uint16_t server_port = 10000;
+// TCP frames larger than this carry data; SYNs and pure ACKs are smaller
+constexpr size_t data_frame_size = 200;
+
+class sim_device;
+
+// Carries frames between the two devices, and decides when, whether and
+// in which order each one reaches the other side.
+class sim_wire {
+public:
+    sim_device* client = nullptr;
+    sim_device* server = nullptr;
+    virtual ~sim_wire() {}
+    virtual void transmit(sim_device* from, net::packet p) = 0;
+    sim_device* peer(sim_device* from) { return from == client ? server : client; }
+};
+
+struct sim_options {
+    net::hw_features hw;
+    // Receive frames in bursts from an rx poller, as from a NIC ring,
+    // rather than one by one as they are sent
+    bool rx_bursts = false;
+    bool gro = true;
+};
+
+class sim_qp : public net::qp {
+    sim_wire& _wire;
+    sim_device* _dev;
+public:
+    sim_qp(sim_wire& wire, sim_device* dev) : _wire(wire), _dev(dev) {}
+    virtual future<> send(net::packet p) override {
+        // A real wire copies the frame, so the receiver cannot scribble
+        // over data the sender keeps for retransmission
+        p.linearize();
+        _wire.transmit(_dev, net::packet(p.frag(0).base, p.len()));
+        return make_ready_future<>();
+    }
+};
+
+class sim_device : public net::device {
+    static constexpr size_t max_burst = 32;
+    sim_wire& _wire;
+    net::ethernet_address _hw_address;
+    net::hw_features _hw_features;
+    std::deque<net::packet> _ring;
+    std::vector<net::packet> _burst;
+    std::experimental::optional<reactor::poller> _rx_poller;
+public:
+    sim_device(sim_wire& wire, net::ethernet_address hw_address, net::hw_features hw)
+        : _wire(wire), _hw_address(hw_address), _hw_features(hw) {}
+    virtual net::ethernet_address hw_address() override { return _hw_address; }
+    virtual net::hw_features hw_features() override { return _hw_features; }
+    virtual std::unique_ptr<net::qp> init_local_queue(boost::program_options::variables_map opts, uint16_t qid) override {
+        return std::make_unique<sim_qp>(_wire, this);
+    }
+    void enable_rx_bursts() {
+        _rx_poller = reactor::poller([this] { return poll_rx(); });
+    }
+    // Hands a frame that came off the wire to the stack
+    void receive(net::packet p) {
+        if (!_rx_poller) {
+            l2receive(std::move(p));
+            return;
+        }
+        _ring.push_back(std::move(p));
+    }
+private:
+    bool poll_rx() {
+        while (!_ring.empty() && _burst.size() < max_burst) {
+            _burst.push_back(std::move(_ring.front()));
+            _ring.pop_front();
+        }
+        if (_burst.empty()) {
+            return false;
+        }
+        l2receive(_burst);
+        return true;
+    }
+};
+
+// Locates the TCP header of a linearized ethernet frame
+inline net::tcp_hdr* frame_tcp_hdr(net::packet& p) {
+    auto eh = p.get_header<net::eth_hdr>(0);
+    if (!eh || net::ntoh(eh->eth_proto) != uint16_t(net::eth_protocol_num::ipv4)) {
+        return nullptr;
+    }
+    auto iph = p.get_header<net::ip_hdr>(sizeof(net::eth_hdr));
+    if (!iph || iph->ip_proto != uint8_t(net::ip_protocol_num::tcp)) {
+        return nullptr;
+    }
+    return p.get_header<net::tcp_hdr>(sizeof(net::eth_hdr) + iph->ihl * 4);
+}
+
+inline std::pair<uint8_t*, uint8_t*> tcp_options(net::tcp_hdr* th) {
+    auto beg = reinterpret_cast<uint8_t*>(th) + sizeof(net::tcp_hdr);
+    return { beg, beg + th->data_offset * 4 - sizeof(net::tcp_hdr) };
+}
+
+// Frames from the client to the server pass an impairment stage that can
+// drop, delay (reorder) or rewrite them; both directions can be given a
+// latency.
+struct sim_link : sim_wire {
+    // Indexes of client->server data frames to drop or to hold back for
+    // reorder_delay, so that the frames sent after them overtake them
+    std::set<unsigned> drop;
+    std::set<unsigned> delay;
+    std::chrono::microseconds reorder_delay{1000};
+    // Remove the SACK-permitted option from the client's SYN
+    bool strip_sack_permitted = false;
+    unsigned data_frames = 0;
+    unsigned dropped = 0;
+    unsigned acks_with_sack_blocks = 0;
+    // Server ACKs whose window ended before an earlier one did
+    unsigned window_retreats = 0;
+    uint8_t server_window_scale = 0;
+    std::experimental::optional<net::tcp_seq> server_window_edge;
+    unsigned frames_with_timestamps = 0;
+    // Largest frame the client sent
+    unsigned largest_frame = 0;
+    // Time from dropping the first frame in drop to its retransmission
+    std::experimental::optional<net::tcp_seq> lost_seq;
+    std::chrono::steady_clock::time_point lost_time;
+    std::chrono::steady_clock::duration recovery_time{};
+    // One-way delay of the link in either direction
+    std::chrono::microseconds latency{0};
+    struct in_flight {
+        clock_type::time_point due;
+        sim_device* to;
+        net::packet p;
+    };
+    std::deque<in_flight> flying;
+    ::timer<> deliver_timer;
+
+    sim_link() {
+        deliver_timer.set_callback([this] { deliver_due(); });
+    }
+    virtual void transmit(sim_device* from, net::packet p) override;
+    void deliver(sim_device* to, net::packet p, std::chrono::microseconds extra_delay = {});
+    void deliver_due();
+};
+
+inline void sim_link::transmit(sim_device* from, net::packet frame) {
+    using net::tcp_option;
+    auto th = frame_tcp_hdr(frame);
+    if (from == server) {
+        if (th) {
+            tcp_option opt;
+            auto o = tcp_options(th);
+            opt.parse(o.first, o.second);
+            if (opt._nr_remote_sack_blocks) {
+                acks_with_sack_blocks++;
+            }
+            auto h = net::ntoh(*th);
+            if (h.f_syn) {
+                server_window_scale = opt._win_scale_received ? opt._remote_win_scale : 0;
+            } else if (h.f_ack && !h.f_rst) {
+                net::tcp_seq ack = h.ack;
+                auto edge = ack + (uint32_t(h.window) << server_window_scale);
+                if (server_window_edge && edge < *server_window_edge) {
+                    window_retreats++;
+                } else {
+                    server_window_edge = edge;
+                }
+            }
+        }
+        deliver(client, std::move(frame));
+        return;
+    }
+    largest_frame = std::max(largest_frame, frame.len());
+    if (th) {
+        tcp_option opt;
+        auto o = tcp_options(th);
+        opt.parse(o.first, o.second);
+        if (opt._remote_ts_present) {
+            frames_with_timestamps++;
+        }
+    }
+    if (th && th->f_syn && strip_sack_permitted) {
+        auto o = tcp_options(th);
+        for (auto opt = o.first; opt < o.second && *opt != uint8_t(tcp_option::option_kind::eol);) {
+            if (*opt == uint8_t(tcp_option::option_kind::nop)) {
+                opt++;
+            } else if (*opt == uint8_t(tcp_option::option_kind::sack)) {
+                opt[0] = opt[1] = uint8_t(tcp_option::option_kind::nop);
+                opt += 2;
+            } else {
+                opt += opt[1];
+            }
+        }
+    }
+    if (th && frame.len() > data_frame_size) {
+        auto idx = data_frames++;
+        net::tcp_seq seq = net::ntoh(*th).seq;
+        if (drop.count(idx)) {
+            if (!lost_seq) {
+                lost_seq = seq;
+                lost_time = std::chrono::steady_clock::now();
+            }
+            dropped++;
+            return;
+        }
+        if (lost_seq && *lost_seq == seq && recovery_time == recovery_time.zero()) {
+            recovery_time = std::chrono::steady_clock::now() - lost_time;
+        }
+        if (delay.count(idx)) {
+            deliver(server, std::move(frame), reorder_delay);
+            return;
+        }
+    }
+    deliver(server, std::move(frame));
+}
+
+inline void sim_link::deliver(sim_device* to, net::packet p, std::chrono::microseconds extra_delay) {
+    auto delay = latency + extra_delay;
+    if (delay == delay.zero()) {
+        to->receive(std::move(p));
+        return;
+    }
+    auto due = clock_type::now() + delay;
+    // Frames held back are overtaken by those sent after them
+    auto it = flying.end();
+    while (it != flying.begin() && std::prev(it)->due > due) {
+        --it;
+    }
+    flying.insert(it, in_flight{due, to, std::move(p)});
+    deliver_timer.rearm(flying.front().due);
+}
+
+inline void sim_link::deliver_due() {
+    auto now = clock_type::now();
+    while (!flying.empty() && flying.front().due <= now) {
+        auto f = std::move(flying.front());
+        flying.pop_front();
+        f.to->receive(std::move(f.p));
+    }
+    if (!flying.empty()) {
+        deliver_timer.arm(flying.front().due);
+    }
+}
+
+template <typename Wire = sim_link>
+struct sim_network {
+    Wire link;
+    std::shared_ptr<sim_device> client_dev;
+    std::shared_ptr<sim_device> server_dev;
+    std::unique_ptr<net::interface> client_netif;
+    std::unique_ptr<net::interface> server_netif;
+    std::unique_ptr<net::ipv4> client_inet;
+    std::unique_ptr<net::ipv4> server_inet;
+
+    template <typename... WireArgs>
+    explicit sim_network(sim_options so, WireArgs&&... wire_args)
+            : link(std::forward<WireArgs>(wire_args)...) {
+        boost::program_options::variables_map opts;
+        client_dev = std::make_shared<sim_device>(link, net::ethernet_address{0x12, 0x23, 0x34, 0x56, 0x67, 0x01}, so.hw);
+        server_dev = std::make_shared<sim_device>(link, net::ethernet_address{0x12, 0x23, 0x34, 0x56, 0x67, 0x02}, so.hw);
+        link.client = client_dev.get();
+        link.server = server_dev.get();
+        for (auto& dev : { client_dev, server_dev }) {
+            if (so.rx_bursts) {
+                dev->enable_rx_bursts();
+            }
+            dev->set_gro(so.gro);
+            dev->set_local_queue(dev->init_local_queue(opts, 0));
+        }
+        client_netif = std::make_unique<net::interface>(client_dev);
+        server_netif = std::make_unique<net::interface>(server_dev);
+        client_inet = std::make_unique<net::ipv4>(client_netif.get());
+        server_inet = std::make_unique<net::ipv4>(server_netif.get());
+        client_inet->set_host_address(net::ipv4_address("10.0.0.1"));
+        server_inet->set_host_address(net::ipv4_address("10.0.0.2"));
+        // ARP replies are learned through the engine's native stack, which
+        // does not exist here, so neither side may need to ask
+        client_inet->learn(server_dev->hw_address(), net::ipv4_address("10.0.0.2"));
+        server_inet->learn(client_dev->hw_address(), net::ipv4_address("10.0.0.1"));
+    }
+    tcp_type& client() { return client_inet->get_tcp(); }
+    tcp_type& server() { return server_inet->get_tcp(); }
+};
+
+// Keeps the stacks alive as long as the reactor, since timers and
+// pollers may still refer to them once a test is done
+template <typename Wire = sim_link, typename... WireArgs>
+inline sim_network<Wire>& make_network(sim_options so = sim_options(), WireArgs&&... wire_args) {
+    auto net = std::make_unique<sim_network<Wire>>(so, std::forward<WireArgs>(wire_args)...);
+    auto& n = *net;
+    engine().at_destroy([net = std::move(net)] {});
+    return n;
+}
+
+inline future<> send_all(tcp_type::connection& c, const std::string& data, size_t off = 0) {
+    if (off == data.size()) {
+        return make_ready_future<>();
+    }
+    // The send queue is bounded, so hand the data over in pieces
+    auto len = std::min(size_t(16384), data.size() - off);
+    return c.send(net::packet(data.data() + off, len)).then([&c, &data, off, len] {
+        return send_all(c, data, off + len);
+    });
+}
+
+// Appends what c receives to buf until it holds len bytes
+inline future<> read_exactly(tcp_type::connection& c, size_t len, lw_shared_ptr<std::string> buf) {
+    if (buf->size() >= len) {
+        return make_ready_future<>();
+    }
+    return c.wait_for_data().then([&c, len, buf] {
+        auto p = c.read();
+        if (!p.len()) {
+            throw std::runtime_error("connection closed early");
+        }
+        for (auto& frag : p.fragments()) {
+            buf->append(frag.base, frag.size);
+        }
+        return read_exactly(c, len, buf);
+    });
+}
+
+// Appends what c receives to buf until the peer closes, then closes too
+inline future<> read_until_eof(tcp_type::connection& c, lw_shared_ptr<std::string> buf) {
+    return c.wait_for_data().then([&c, buf] {
+        auto p = c.read();
+        if (!p.len()) {
+            c.close_write();
+            return make_ready_future<>();
+        }
+        for (auto& frag : p.fragments()) {
+            buf->append(frag.base, frag.size);
+        }
+        return read_until_eof(c, buf);
+    });
+}
+
+inline std::string make_contents(size_t size) {
+    std::string contents;
+    contents.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        contents.push_back('a' + i % 26);
+    }
+    return contents;
+}
+
+template <typename Wire>
+struct transfer {
+    sim_network<Wire>& net;
+    tcp_type::listener listener;
+    std::experimental::optional<tcp_type::connection> client;
+    std::experimental::optional<tcp_type::connection> server;
+    std::string contents;
+    lw_shared_ptr<std::string> received = make_lw_shared<std::string>();
+    transfer(sim_network<Wire>& n, size_t size)
+        : net(n)
+        , listener(net.server().listen(server_port))
+        , contents(make_contents(size)) {
+    }
+};
+
+// Sends size bytes from the client to the server, which reads them until
+// the client closes, and checks they arrived intact
+template <typename Wire>
+inline future<lw_shared_ptr<transfer<Wire>>> run_transfer(sim_network<Wire>& n, size_t size = 1 << 20) {
+    auto t = make_lw_shared<transfer<Wire>>(n, size);
+    auto accepted = t->listener.accept();
+    auto sa = make_ipv4_address({0x0a000002, server_port});
+    return n.client().connect(sa).then([t, accepted = std::move(accepted)] (tcp_type::connection c) mutable {
+        t->client = std::move(c);
+        return std::move(accepted);
+    }).then([t] (tcp_type::connection c) {
+        t->server = std::move(c);
+        auto sent = send_all(*t->client, t->contents).then([t] {
+            t->client->close_write();
+        });
+        return when_all(std::move(sent), read_until_eof(*t->server, t->received));
+    }).then([t] (std::tuple<future<>, future<>> done) {
+        std::get<0>(done).get();
+        std::get<1>(done).get();
+        if (*t->received != t->contents) {
+            throw std::runtime_error(sprint("received %d bytes that differ from the %d sent",
+                    t->received->size(), t->contents.size()));
+        }
+        return make_ready_future<lw_shared_ptr<transfer<Wire>>>(t);
+    });
+}
+
+inline future<> sleep(std::chrono::milliseconds ms) {
+    auto t = make_lw_shared<::timer<>>();
+    auto pr = make_lw_shared<promise<>>();
+    t->set_callback([pr] { pr->set_value(); });
+    t->arm(ms);
+    return pr->get_future().then([t] {});
+}
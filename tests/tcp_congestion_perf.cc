@@ -0,0 +1,222 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+// Runs bulk transfers between two native stacks over a simulated
+// bottleneck link, and reports the throughput and queueing delay each
+// congestion control algorithm gets at several round trip times and
+// loss rates.
+
+#include "core/app-template.hh"
+#include "tcp-sim.hh"
+#include <random>
+
+using namespace net;
+
+// Frames in one direction of the link, delivered in order once due
+struct sim_pipe {
+    struct in_flight {
+        clock_type::time_point due;
+        sim_device* to;
+        packet p;
+    };
+    std::deque<in_flight> flying;
+    ::timer<> deliver_timer;
+
+    sim_pipe() {
+        deliver_timer.set_callback([this] { deliver_due(); });
+    }
+    void send(clock_type::time_point due, sim_device* to, packet p) {
+        flying.push_back(in_flight{due, to, std::move(p)});
+        if (!deliver_timer.armed()) {
+            deliver_timer.arm(flying.front().due);
+        }
+    }
+    void deliver_due();
+};
+
+// The client's data passes a rate limited, drop tail bottleneck and
+// random loss; acknowledgments only see the propagation delay.
+struct bottleneck_link : sim_wire {
+    sim_pipe to_server;
+    sim_pipe to_client;
+    // Bottleneck rate in bytes per second, and its queue limit in bytes
+    uint64_t rate;
+    size_t queue_limit;
+    std::chrono::microseconds one_way_delay;
+    std::default_random_engine rng;
+    std::bernoulli_distribution lose;
+    // When the bottleneck finishes sending what is queued
+    clock_type::time_point busy_until;
+    uint64_t data_frames = 0;
+    uint64_t overflows = 0;
+    uint64_t losses = 0;
+    uint64_t queued_frames = 0;
+    std::chrono::microseconds total_queueing{0};
+    std::chrono::microseconds max_queueing{0};
+
+    bottleneck_link(uint64_t rate, size_t queue_limit, std::chrono::microseconds rtt, double loss)
+        : rate(rate), queue_limit(queue_limit), one_way_delay(rtt / 2), lose(loss) {}
+    virtual void transmit(sim_device* from, packet p) override;
+};
+
+void sim_pipe::deliver_due() {
+    auto now = clock_type::now();
+    while (!flying.empty() && flying.front().due <= now) {
+        auto f = std::move(flying.front());
+        flying.pop_front();
+        f.to->receive(std::move(f.p));
+    }
+    if (!flying.empty()) {
+        deliver_timer.arm(flying.front().due);
+    }
+}
+
+void bottleneck_link::transmit(sim_device* from, packet frame) {
+    auto now = clock_type::now();
+    if (from != client) {
+        to_client.send(now + one_way_delay, client, std::move(frame));
+        return;
+    }
+    if (frame.len() > data_frame_size) {
+        data_frames++;
+        if (lose(rng)) {
+            losses++;
+            return;
+        }
+    }
+    auto start = std::max(now, busy_until);
+    auto queueing = std::chrono::duration_cast<std::chrono::microseconds>(start - now);
+    if (queueing.count() * rate / 1000000 + frame.len() > queue_limit) {
+        overflows++;
+        return;
+    }
+    queued_frames++;
+    total_queueing += queueing;
+    max_queueing = std::max(max_queueing, queueing);
+    busy_until = start + std::chrono::microseconds(frame.len() * 1000000 / rate);
+    to_server.send(busy_until + one_way_delay, server, std::move(frame));
+}
+
+using bottleneck_network = sim_network<bottleneck_link>;
+
+struct bulk_transfer {
+    bottleneck_network& net;
+    tcp_type::listener listener;
+    std::experimental::optional<tcp_type::connection> client;
+    std::experimental::optional<tcp_type::connection> server;
+    std::string contents;
+    size_t received = 0;
+    clock_type::time_point start;
+    clock_type::time_point end;
+    bulk_transfer(bottleneck_network& n, tcp_congestion_algorithm cc, size_t size)
+        : net(n)
+        , listener(net.server().listen(server_port, 100, cc))
+        , contents(size, 'x') {
+    }
+};
+
+static future<> receive_all(lw_shared_ptr<bulk_transfer> t) {
+    return t->server->wait_for_data().then([t] {
+        auto p = t->server->read();
+        if (!p.len()) {
+            t->end = clock_type::now();
+            t->server->close_write();
+            return make_ready_future<>();
+        }
+        t->received += p.len();
+        return receive_all(t);
+    });
+}
+
+struct scenario {
+    tcp_congestion_algorithm cc;
+    std::chrono::microseconds rtt;
+    double loss;
+};
+
+static future<> run_scenario(scenario s, uint64_t rate, size_t queue_limit, size_t size) {
+    auto& n = make_network<bottleneck_link>(sim_options(), rate, queue_limit, s.rtt, s.loss);
+    auto t = make_lw_shared<bulk_transfer>(n, s.cc, size);
+    auto accepted = t->listener.accept();
+    auto sa = make_ipv4_address({0x0a000002, server_port});
+    t->start = clock_type::now();
+    return n.client().connect(sa, s.cc).then([t, accepted = std::move(accepted)] (tcp_type::connection c) mutable {
+        t->client = std::move(c);
+        return std::move(accepted);
+    }).then([t] (tcp_type::connection c) {
+        t->server = std::move(c);
+        auto sent = send_all(*t->client, t->contents).then([t] {
+            t->client->close_write();
+        });
+        return when_all(std::move(sent), receive_all(t));
+    }).then([t, s] (std::tuple<future<>, future<>> done) {
+        std::get<0>(done).get();
+        std::get<1>(done).get();
+        if (t->received != t->contents.size()) {
+            print("received %d bytes, expected %d\n", t->received, t->contents.size());
+            engine().exit(1);
+        }
+        auto& link = t->net.link;
+        std::chrono::duration<double> elapsed = t->end - t->start;
+        auto cc = make_tcp_congestion_control(s.cc);
+        print("%-8s %7.1f %7.3f %10.1f %12.2f %12.2f %9d\n", cc->name(),
+                s.rtt.count() / 1000.0, s.loss * 100,
+                t->contents.size() * 8 / elapsed.count() / 1e6,
+                link.total_queueing.count() / 1000.0 / link.queued_frames,
+                link.max_queueing.count() / 1000.0,
+                link.overflows);
+        return make_ready_future<>();
+    });
+}
+
+int main(int ac, char** av) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("size", bpo::value<unsigned>()->default_value(4), "MB to transfer per run")
+        ("rate", bpo::value<unsigned>()->default_value(100), "bottleneck rate, in Mbit/s")
+        ("queue", bpo::value<unsigned>()->default_value(256), "bottleneck queue limit, in KB")
+        ;
+
+    return app.run(ac, av, [&app] {
+        auto&& config = app.configuration();
+        size_t size = size_t(config["size"].as<unsigned>()) << 20;
+        uint64_t rate = uint64_t(config["rate"].as<unsigned>()) * 1000000 / 8;
+        size_t queue_limit = size_t(config["queue"].as<unsigned>()) << 10;
+
+        std::vector<scenario> scenarios;
+        for (auto cc : { tcp_congestion_algorithm::newreno, tcp_congestion_algorithm::cubic }) {
+            for (auto rtt : { 1, 10, 40 }) {
+                for (auto loss : { 0.0, 0.0001, 0.001 }) {
+                    scenarios.push_back(scenario{cc, std::chrono::milliseconds(rtt), loss});
+                }
+            }
+        }
+        print("%-8s %7s %7s %10s %12s %12s %9s\n", "algo", "rtt(ms)", "loss(%)",
+                "Mbit/s", "avg-queue", "max-queue", "overflows");
+        auto s = make_lw_shared<std::vector<scenario>>(std::move(scenarios));
+        do_for_each(s->begin(), s->end(), [rate, queue_limit, size] (scenario sc) {
+            return run_scenario(sc, rate, queue_limit, size);
+        }).then([s] {
+            engine().exit(0);
+        });
+    });
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+#include "core/print.hh"
+#include "tcp-sim.hh"
+#include "test-utils.hh"
+
+using namespace net;
+
+static sim_network<>& make_burst_network(bool gro) {
+    sim_options so;
+    so.rx_bursts = true;
+    so.gro = gro;
+    return make_network(so);
+}
+
+// Sends size bytes from client to server, checks they arrive intact, and
+// reports how long the transfer took; both stacks share the reactor, so
+// that is their CPU time
+static future<> bulk_transfer(sim_network<>& n, size_t size, const char* label) {
+    struct state {
+        tcp_type::listener listener;
+        std::experimental::optional<tcp_type::connection> client;
+        std::experimental::optional<tcp_type::connection> server;
+        std::string contents;
+        std::chrono::steady_clock::time_point start;
+        explicit state(tcp_type& t, size_t size) : listener(t.listen(server_port)), contents(make_contents(size)) {}
+    };
+    auto s = make_lw_shared<state>(n.server(), size);
+    auto accepted = s->listener.accept();
+    return n.client().connect(make_ipv4_address({0x0a000002, server_port})).then(
+            [s, accepted = std::move(accepted)] (tcp_type::connection c) mutable {
+        s->client = std::move(c);
+        return std::move(accepted);
+    }).then([s, size, label] (tcp_type::connection c) {
+        s->server = std::move(c);
+        auto buf = make_lw_shared<std::string>();
+        buf->reserve(size);
+        s->start = std::chrono::steady_clock::now();
+        return when_all(send_all(*s->client, s->contents),
+                read_exactly(*s->server, size, buf)).then([s, buf, size, label] (std::tuple<future<>, future<>> done) {
+            std::get<0>(done).get();
+            std::get<1>(done).get();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - s->start;
+            BOOST_REQUIRE(*buf == s->contents);
+            print("bulk receive of %d MB %s: %.1f ms\n", size >> 20, label, elapsed.count() * 1000);
+        });
+    });
+}
+
+static constexpr size_t transfer_size = 16 << 20;
+
+SEASTAR_TEST_CASE(test_bulk_transfer_with_gro) {
+    auto& n = make_burst_network(true);
+    return bulk_transfer(n, transfer_size, "with GRO").then([&n] {
+        BOOST_REQUIRE(n.server_dev->local_queue().packets_merged() > 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_bulk_transfer_without_gro) {
+    auto& n = make_burst_network(false);
+    return bulk_transfer(n, transfer_size, "without GRO").then([&n] {
+        BOOST_REQUIRE_EQUAL(n.server_dev->local_queue().packets_merged(), 0u);
+    });
+}
@@ -0,0 +1,36 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#include "tcp-sim.hh"
+#include "test-utils.hh"
+
+using namespace net;
+
+SEASTAR_TEST_CASE(test_receive_buffer_grows) {
+    // The initial window allows 64K per 4ms round trip; a reader that keeps
+    // up should get a larger buffer
+    auto& n = make_network();
+    n.link.latency = std::chrono::milliseconds(2);
+    return run_transfer(n).then([&n] (auto t) {
+        BOOST_REQUIRE(t->server->receive_buffer_size() > 65536);
+        BOOST_REQUIRE_EQUAL(n.link.window_retreats, 0u);
+    });
+}
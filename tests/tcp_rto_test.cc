@@ -0,0 +1,52 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#include "tcp-sim.hh"
+#include "test-utils.hh"
+
+using namespace net;
+
+SEASTAR_TEST_CASE(test_burst_loss_with_low_rto_min) {
+    // A whole window is lost, so nothing but the retransmission timer can
+    // recover it.  Timestamps keep RTT samples coming while retransmitting,
+    // so the timer stays close to the configured floor.
+    auto& n = make_network();
+    n.client().set_rto_min(std::chrono::milliseconds(5));
+    for (unsigned i = 100; i < 140; ++i) {
+        n.link.drop.insert(i);
+    }
+    return run_transfer(n).then([&n] (auto t) {
+        BOOST_REQUIRE_EQUAL(n.link.dropped, 40u);
+        BOOST_REQUIRE(n.link.frames_with_timestamps > 0);
+        BOOST_REQUIRE(n.link.recovery_time > std::chrono::steady_clock::duration::zero());
+        // The default floor would have stalled for a full second
+        BOOST_REQUIRE(n.link.recovery_time < std::chrono::milliseconds(500));
+    });
+}
+
+SEASTAR_TEST_CASE(test_timestamps_fit_in_mtu) {
+    // The timestamps option comes out of the MSS, not on top of it
+    auto& n = make_network();
+    return run_transfer(n).then([&n] (auto t) {
+        BOOST_REQUIRE(n.link.frames_with_timestamps > 0);
+        BOOST_REQUIRE_EQUAL(n.link.largest_frame, sizeof(eth_hdr) + 1500u);
+    });
+}
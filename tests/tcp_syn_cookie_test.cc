@@ -0,0 +1,125 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2014 Cloudius Systems, Ltd.
+ */
+
+#include "tcp-sim.hh"
+#include "test-utils.hh"
+#include <vector>
+
+using namespace net;
+
+// Opens nr connections at once; each sends its index and expects it echoed
+static future<> connection_storm(sim_network<>& n, unsigned nr) {
+    struct state {
+        tcp_type::listener listener;
+        std::vector<tcp_type::connection> server_conns;
+        std::vector<tcp_type::connection> client_conns;
+        unsigned echoed = 0;
+        explicit state(tcp_type& t) : listener(t.listen(server_port)) {}
+    };
+    auto s = make_lw_shared<state>(n.server());
+    // Connections are referred to by address until the storm is over
+    s->server_conns.reserve(nr);
+    s->client_conns.reserve(nr);
+    auto sa = make_ipv4_address({0x0a000002, server_port});
+    std::vector<unsigned> idx;
+    for (unsigned i = 0; i < nr; ++i) {
+        idx.push_back(i);
+    }
+    // A listener takes one accept() at a time
+    auto servers = do_until([s, nr] { return s->server_conns.size() == nr; }, [s] {
+        return s->listener.accept().then([s] (tcp_type::connection c) {
+            s->server_conns.push_back(std::move(c));
+            auto& conn = s->server_conns.back();
+            auto buf = make_lw_shared<std::string>();
+            return read_exactly(conn, 4, buf).then([&conn, buf] {
+                return conn.send(packet(buf->data(), 4));
+            });
+        });
+    });
+    auto clients = parallel_for_each(idx.begin(), idx.end(), [s, &n, sa] (unsigned i) {
+        return n.client().connect(sa).then([s, i] (tcp_type::connection c) {
+            s->client_conns.push_back(std::move(c));
+            auto& conn = s->client_conns.back();
+            auto msg = make_lw_shared<std::string>(sprint("%04d", i));
+            return conn.send(packet(msg->data(), msg->size())).then([s, &conn, msg] {
+                auto buf = make_lw_shared<std::string>();
+                return read_exactly(conn, 4, buf).then([s, msg, buf] {
+                    BOOST_REQUIRE_EQUAL(*buf, *msg);
+                    s->echoed++;
+                });
+            });
+        });
+    });
+    return when_all(std::move(servers), std::move(clients)).then([s, nr] (std::tuple<future<>, future<>> done) {
+        std::get<0>(done).get();
+        std::get<1>(done).get();
+        BOOST_REQUIRE_EQUAL(s->echoed, nr);
+    });
+}
+
+SEASTAR_TEST_CASE(test_handshakes_without_cookies) {
+    auto& n = make_network();
+    return connection_storm(n, 64).then([&n] {
+        BOOST_REQUIRE_EQUAL(n.server().syn_cookies_sent(), 0u);
+    });
+}
+
+SEASTAR_TEST_CASE(test_connection_storm_with_cookies) {
+    // Only a few handshakes get state; the rest must complete statelessly
+    auto& n = make_network();
+    n.server().set_syn_backlog(4);
+    return connection_storm(n, 256).then([&n] {
+        BOOST_REQUIRE(n.server().syn_cookies_sent() > 0);
+        BOOST_REQUIRE_EQUAL(n.server().syn_cookies_validated(), n.server().syn_cookies_sent());
+    });
+}
+
+SEASTAR_TEST_CASE(test_bulk_transfer_after_cookie) {
+    // The connection rebuilt from the cookie's ACK must carry data like
+    // any other
+    static constexpr size_t size = 1 << 20;
+    auto& n = make_network();
+    n.server().set_syn_backlog(0);
+    struct state {
+        tcp_type::listener listener;
+        std::experimental::optional<tcp_type::connection> client;
+        std::experimental::optional<tcp_type::connection> server;
+        std::string contents = make_contents(size);
+        explicit state(tcp_type& t) : listener(t.listen(server_port)) {}
+    };
+    auto s = make_lw_shared<state>(n.server());
+    auto accepted = s->listener.accept();
+    return n.client().connect(make_ipv4_address({0x0a000002, server_port})).then(
+            [s, accepted = std::move(accepted)] (tcp_type::connection c) mutable {
+        s->client = std::move(c);
+        return std::move(accepted);
+    }).then([s, &n] (tcp_type::connection c) {
+        BOOST_REQUIRE_EQUAL(n.server().syn_cookies_validated(), 1u);
+        s->server = std::move(c);
+        auto buf = make_lw_shared<std::string>();
+        return when_all(send_all(*s->client, s->contents),
+                read_exactly(*s->server, size, buf)).then([s, buf] (std::tuple<future<>, future<>> done) {
+            std::get<0>(done).get();
+            std::get<1>(done).get();
+            BOOST_REQUIRE(*buf == s->contents);
+        });
+    });
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#include "tcp-sim.hh"
+#include "test-utils.hh"
+
+using namespace net;
+
+// Keeps a copy of the server's FIN, and counts the client's ACKs
+struct fin_recording_link : sim_link {
+    std::experimental::optional<packet> server_fin;
+    unsigned client_acks = 0;
+    net::tcp_seq last_client_ack;
+    virtual void transmit(sim_device* from, packet p) override {
+        auto th = frame_tcp_hdr(p);
+        if (th) {
+            auto h = ntoh(*th);
+            if (from == server && h.f_fin) {
+                server_fin = packet(p.frag(0).base, p.len());
+            } else if (from == client && h.f_ack) {
+                client_acks++;
+                last_client_ack = h.ack;
+            }
+        }
+        sim_link::transmit(from, std::move(p));
+    }
+    // Delivers a copy of the server's FIN to the client, its sequence
+    // number moved by delta
+    void replay_fin(int32_t delta) {
+        packet p(server_fin->frag(0).base, server_fin->len());
+        auto th = frame_tcp_hdr(p);
+        net::tcp_seq seq = ntoh(*th).seq;
+        th->seq = hton(seq + delta);
+        deliver(client, std::move(p));
+    }
+};
+
+static sim_options no_rx_csum() {
+    sim_options so;
+    // Replayed FINs are rewritten without fixing their checksums
+    so.hw.rx_csum_offload = true;
+    return so;
+}
+
+SEASTAR_TEST_CASE(test_time_wait) {
+    // The client closes first, so it ends up in TIME_WAIT, without a tcb
+    auto& n = make_network();
+    return run_transfer(n).then([&n] (auto t) {
+        // Give the server's FIN time to reach the client
+        return sleep(std::chrono::milliseconds(10)).then([&n, t] {
+            BOOST_REQUIRE_EQUAL(n.client().time_wait_connections(), 1u);
+            BOOST_REQUIRE_EQUAL(n.server().time_wait_connections(), 0u);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_time_wait_acks_fin) {
+    // A retransmitted FIN, and a stale one, are both answered with an ACK
+    // of the FIN the connection did receive
+    auto& n = make_network<fin_recording_link>(no_rx_csum());
+    static const std::vector<int32_t> deltas = { 0, -1000, 0, 1000 };
+    return run_transfer(n).then([&n] (auto t) {
+        return sleep(std::chrono::milliseconds(10));
+    }).then([&n] {
+        BOOST_REQUIRE(n.link.server_fin);
+        return do_for_each(deltas.begin(), deltas.end(), [&n] (int32_t delta) {
+            auto acks = n.link.client_acks;
+            n.link.replay_fin(delta);
+            return sleep(std::chrono::milliseconds(1)).then([&n, acks] {
+                net::tcp_seq fin_seq = ntoh(*frame_tcp_hdr(*n.link.server_fin)).seq;
+                BOOST_REQUIRE_EQUAL(n.link.client_acks, acks + 1);
+                BOOST_REQUIRE(n.link.last_client_ack == fin_seq + 1);
+            });
+        });
+    }).then([&n] {
+        BOOST_REQUIRE_EQUAL(n.client().time_wait_connections(), 1u);
+    });
+}
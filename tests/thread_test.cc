@@ -0,0 +1,96 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2015 Cloudius Systems, Ltd.
+ */
+
+#include "tests/test-utils.hh"
+#include "core/thread.hh"
+#include "core/shared_ptr.hh"
+
+using namespace std::chrono_literals;
+
+static future<> delay(std::chrono::milliseconds d) {
+    auto pr = make_lw_shared<promise<>>();
+    auto t = make_lw_shared<::timer<>>([pr] { pr->set_value(); });
+    t->arm(d);
+    return pr->get_future().then([t] {});
+}
+
+SEASTAR_TEST_CASE(test_thread_1) {
+    auto x = make_lw_shared<sstring>();
+    auto th = make_lw_shared<seastar::thread>([x] {
+        *x = "abc";
+    });
+    return th->join().then([x, th] {
+        BOOST_REQUIRE_EQUAL(*x, "abc");
+    });
+}
+
+SEASTAR_TEST_CASE(test_thread_2) {
+    auto th = make_lw_shared<std::vector<seastar::thread>>();
+    auto cnt = make_lw_shared<int>(0);
+    for (int i = 0; i < 1000; ++i) {
+        th->emplace_back([cnt] {
+            // each thread blocks, so they are all alive at the same time
+            delay(1ms).get();
+            ++*cnt;
+        });
+    }
+    return parallel_for_each(th->begin(), th->end(), [] (seastar::thread& t) {
+        return t.join();
+    }).then([th, cnt] {
+        BOOST_REQUIRE_EQUAL(*cnt, 1000);
+    });
+}
+
+SEASTAR_TEST_CASE(test_async_value) {
+    return seastar::async([] (int a, int b) {
+        auto x = std::get<0>(make_ready_future<int>(a).get());
+        promise<int> pr;
+        auto f = pr.get_future();
+        schedule(make_task([pr = std::move(pr), b] () mutable {
+            pr.set_value(b);
+        }));
+        return x + std::get<0>(f.get());
+    }, 1, 2).then([] (int r) {
+        BOOST_REQUIRE_EQUAL(r, 3);
+    });
+}
+
+SEASTAR_TEST_CASE(test_async_exception) {
+    return seastar::async([] {
+        delay(1ms).get();
+        throw std::runtime_error("expected");
+    }).then_wrapped([] (future<> f) {
+        BOOST_REQUIRE_THROW(f.get(), std::runtime_error);
+        return make_ready_future<>();
+    });
+}
+
+SEASTAR_TEST_CASE(test_exception_from_get_inside_thread) {
+    return seastar::async([] {
+        auto f = delay(1ms).then([] {
+            throw std::logic_error("expected");
+        });
+        BOOST_REQUIRE_THROW(f.get(), std::logic_error);
+        return 7;
+    }).then([] (int r) {
+        BOOST_REQUIRE_EQUAL(r, 7);
+    });
+}
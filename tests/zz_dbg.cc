@@ -0,0 +1,26 @@
+#include "tcp-sim.hh"
+#include "test-utils.hh"
+using namespace net;
+struct dbg_link : sim_link {
+    unsigned n = 0;
+    virtual void transmit(sim_device* from, net::packet p) override {
+        auto th = frame_tcp_hdr(p);
+        if (th && n++ < 3000) {
+            auto h = ntoh(*th);
+            tcp_option opt; auto o = tcp_options(th); opt.parse(o.first, o.second);
+            fprintf(stderr, "%s seq=%u ack=%u win=%u len=%zu f=%s%s%s sack=%u", from == client ? "C>" : "  <S", h.seq.raw, h.ack.raw, unsigned(h.window), p.len() - 14 - 20 - h.data_offset*4,
+                h.f_syn ? "S" : "", h.f_fin ? "F" : "", h.f_ack ? "A" : "", opt._nr_remote_sack_blocks);
+            for (unsigned i = 0; i < opt._nr_remote_sack_blocks; ++i) fprintf(stderr, " [%u,%u)", opt._remote_sack_blocks[i].left.raw, opt._remote_sack_blocks[i].right.raw);
+            fprintf(stderr, " idx=%u\n", from == client && p.len() > data_frame_size ? data_frames : 0);
+        }
+        sim_link::transmit(from, std::move(p));
+    }
+};
+SEASTAR_TEST_CASE(test_dbg) {
+    auto& n = make_network<dbg_link>();
+    n.link.drop = { 40, 43, 47, 120, 121, 125, 130, 300, 302, 304 };
+    n.link.delay = { 60, 200, 250 };
+    return run_transfer(n).then([&n] (auto t) {
+        fprintf(stderr, "done dropped=%u\n", n.link.dropped);
+    });
+}